@@ -1,4 +1,5 @@
 #include "SDL_rect.h"
+#include "SDL_filesystem.h"
 #include "SDL_image.h"
 #include "denis_math.h"
 #include "math.h"
@@ -33,7 +34,8 @@ static char* getFileNameFromPath(char *path)
 static char* getProgramPathName()
 {
     char *result = 0;
-    
+
+#if defined(_WIN32)
     TCHAR fileNameBuffer[MAX_PATH+1];
     DWORD getFileNameResult = GetModuleFileName(NULL, fileNameBuffer, MAX_PATH+1);
     if (getFileNameResult != 0 &&
@@ -56,6 +58,16 @@ static char* getProgramPathName()
     {
 	//TODO(denis): try again with a bigger buffer?
     }
+#else
+    //NOTE(denis): SDL knows where the program is everywhere else, it keeps the
+    // last slash like the windows version does
+    char *basePath = SDL_GetBasePath();
+    if (basePath)
+    {
+	result = duplicateString(basePath);
+	SDL_free(basePath);
+    }
+#endif
 
     return result;
 }
@@ -72,6 +84,11 @@ static inline bool pointInRect(Point2 point, SDL_Rect rect)
         point.y > rect.y && point.y < rect.y+rect.h;
 }
 
+static inline bool rectsEqual(SDL_Rect a, SDL_Rect b)
+{
+    return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+}
+
 static inline char* convertIntToString(int num)
 {
     //NOTE(denis): +1 because log10 is one character off
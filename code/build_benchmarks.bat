@@ -0,0 +1,15 @@
+@echo off
+
+REM NOTE(denis): console programs built from the editor code minus main.cpp,
+REM allocations are counted in these builds
+
+SET cflags=-Zi /FC -nologo /W4 /WX /wd4100 /wd4189 /wd4706 /wd4101 /wd4505 /wd4701 /wd4703 /wd4127 /wd4201 /DPROFILE_ALLOCATIONS
+
+SET editorfiles=..\code\ui_elements.cpp ..\code\file_saving_loading.cpp ..\code\denis_adt.cpp ..\code\new_tile_map_panel.cpp ..\code\tile_set_panel.cpp ..\code\tile_map_panel.cpp ..\code\import_tile_set_panel.cpp ..\code\tile_map_file.cpp ..\code\tile_map_pages.cpp ..\code\tile_map_history.cpp ..\code\minimap_panel.cpp ..\code\profiler.cpp
+
+SET libs=SDL2.lib SDL2_ttf.lib SDL2_image.lib Comdlg32.lib
+
+pushd ..\build
+cl %cflags% ..\code\render_benchmark.cpp %editorfiles% /Fe:render_benchmark.exe /I C:\SDL2-2.0.4\include\ /link /LIBPATH:C:\SDL2-2.0.4\lib\x64\ SDL2main.lib %libs% /SUBSYSTEM:CONSOLE
+cl %cflags% ..\code\io_benchmark.cpp %editorfiles% /Fe:io_benchmark.exe /I C:\SDL2-2.0.4\include\ /link /LIBPATH:C:\SDL2-2.0.4\lib\x64\ %libs% Psapi.lib /SUBSYSTEM:CONSOLE
+popd
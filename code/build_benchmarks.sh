@@ -0,0 +1,17 @@
+#!/bin/sh
+
+# NOTE(denis): linux build of render_benchmark, for running it on machines with
+# no display through SDL's dummy video driver (render_benchmark --dummy).
+# needs SDL2, SDL2_ttf and SDL2_image with their headers, sdl2-config finds them.
+# io_benchmark still reads memory counters from psapi so it is windows only
+
+cflags="-g -O2 -std=c++11 -Wall -Wno-unused -Wno-write-strings -Wno-missing-braces -DPROFILE_ALLOCATIONS"
+
+editorfiles="../code/ui_elements.cpp ../code/file_saving_loading.cpp ../code/denis_adt.cpp ../code/new_tile_map_panel.cpp ../code/tile_set_panel.cpp ../code/tile_map_panel.cpp ../code/import_tile_set_panel.cpp ../code/tile_map_file.cpp ../code/tile_map_pages.cpp ../code/tile_map_history.cpp ../code/minimap_panel.cpp ../code/profiler.cpp"
+
+libs="$(sdl2-config --libs) -lSDL2_ttf -lSDL2_image -lpthread"
+
+cd "$(dirname "$0")"
+mkdir -p ../build
+cd ../build
+c++ $cflags $(sdl2-config --cflags) ../code/render_benchmark.cpp $editorfiles -o render_benchmark $libs
@@ -2,8 +2,13 @@
 #define DENIS_META_H_
 
 #include "assert.h"
+
+#if defined(_WIN32)
 #include "windows.h"
 #undef max
+#else
+#include "stdlib.h"
+#endif
 
 #include "stdint.h"
 
@@ -20,8 +25,37 @@ typedef int64_t int64;
 typedef float real32;
 typedef double real64;
 
+#if defined(_WIN32)
+typedef LONG AllocationCount;
+#else
+typedef int32 AllocationCount;
+#endif
+
+#if defined(PROFILE_ALLOCATIONS)
+//NOTE(denis): the benchmarks are built with this so they can count allocations,
+// the count lives in profiler.cpp
+extern volatile AllocationCount _numHeapAllocations;
+#endif
+
+#if defined(_WIN32)
+#if defined(PROFILE_ALLOCATIONS)
+#define HEAP_ALLOC(bytes) (InterlockedIncrement(&_numHeapAllocations), \
+			   HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, bytes));
+#else
 #define HEAP_ALLOC(bytes) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, bytes);
+#endif
 #define HEAP_FREE(ptr) HeapFree(GetProcessHeap(), 0, ptr);
+#else
+//NOTE(denis): everywhere else is only for the benchmarks on linux, same as in
+// tile_map_file.cpp, calloc zeroes the memory like HEAP_ZERO_MEMORY does
+#if defined(PROFILE_ALLOCATIONS)
+#define HEAP_ALLOC(bytes) (__sync_fetch_and_add(&_numHeapAllocations, 1), \
+			   calloc(1, bytes));
+#else
+#define HEAP_ALLOC(bytes) calloc(1, bytes);
+#endif
+#define HEAP_FREE(ptr) free(ptr);
+#endif
 
 #define MAX(val1, val2) ((val1) > (val2) ? (val1) : (val2))
 #define MIN(val1, val2) ((val1) < (val2) ? (val1) : (val2))
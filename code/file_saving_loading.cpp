@@ -3,8 +3,826 @@
 #include "file_saving_loading.h"
 #include "tile_map_panel.h"
 #include "tile_set_panel.h"
+#include "SDL_thread.h"
+#include "SDL_atomic.h"
+#include "SDL_timer.h"
+#if defined(_WIN32)
 #include "windows.h"
-#include "assert.h"
+#endif
+
+//NOTE(denis): the palette is every sheet position the map uses, it starts out
+// as the tile set's list of valid tiles so saved indices line up with the tile
+// set, any sheet position the tile set doesn't know about is appended to it
+struct TilePalette
+{
+    Point2 *entries;
+    uint32 count;
+    uint32 maxCount;
+
+    //NOTE(denis): palette index + 1 for every tile sized cell of the sheet,
+    // 0 means the cell isn't in the palette yet
+    uint32 *sheetLookup;
+    int32 sheetWidthInTiles;
+    int32 sheetHeightInTiles;
+    int32 tileSize;
+
+    //NOTE(denis): set once there wasn't enough memory for a new entry
+    bool failed;
+};
+
+static uint32 getPaletteIndex(TilePalette *palette, Point2 sheetPos)
+{
+    uint32 result = 0;
+    bool found = false;
+
+    int32 tileSize = palette->tileSize;
+    int32 cellX = sheetPos.x/tileSize;
+    int32 cellY = sheetPos.y/tileSize;
+    bool inSheet = sheetPos.x >= 0 && sheetPos.y >= 0 &&
+	sheetPos.x%tileSize == 0 && sheetPos.y%tileSize == 0 &&
+	cellX < palette->sheetWidthInTiles && cellY < palette->sheetHeightInTiles;
+
+    uint32 *lookup = 0;
+    if (inSheet)
+    {
+	lookup = palette->sheetLookup + cellY*palette->sheetWidthInTiles + cellX;
+	if (*lookup != 0)
+	{
+	    result = *lookup - 1;
+	    found = true;
+	}
+    }
+    else
+    {
+	//NOTE(denis): should basically never happen, only if the map was made
+	// with a different version of the tile sheet
+	for (uint32 i = 0; i < palette->count && !found; ++i)
+	{
+	    if (palette->entries[i].x == sheetPos.x && palette->entries[i].y == sheetPos.y)
+	    {
+		result = i;
+		found = true;
+	    }
+	}
+    }
+
+    if (!found)
+    {
+	if (palette->count == palette->maxCount)
+	{
+	    uint32 newMaxCount = palette->maxCount*2;
+	    Point2 *newEntries = (Point2*)growArray(palette->entries, palette->maxCount,
+						    sizeof(Point2), newMaxCount);
+	    if (newEntries)
+	    {
+		palette->entries = newEntries;
+		palette->maxCount = newMaxCount;
+	    }
+	    else
+	    {
+		palette->failed = true;
+	    }
+	}
+
+	if (!palette->failed)
+	{
+	    result = palette->count;
+	    palette->entries[palette->count++] = sheetPos;
+
+	    if (lookup)
+		*lookup = result + 1;
+	}
+    }
+
+    return result;
+}
+
+static TilePalette createTilePalette(TileSet *tileSet, int32 tileSize)
+{
+    TilePalette result = {};
+    result.tileSize = tileSize;
+
+    uint32 numTileSetTiles = 0;
+    if (tileSet && tileSet->tiles)
+    {
+	numTileSetTiles = tileSet->numTiles;
+	result.sheetWidthInTiles = tileSet->imageSize.w/tileSize;
+	result.sheetHeightInTiles = tileSet->imageSize.h/tileSize;
+    }
+
+    result.maxCount = numTileSetTiles + 16;
+    result.entries = (Point2*)HEAP_ALLOC(result.maxCount*sizeof(Point2));
+    
+    uint32 lookupSize = result.sheetWidthInTiles*result.sheetHeightInTiles;
+    if (lookupSize > 0)
+	result.sheetLookup = (uint32*)HEAP_ALLOC(lookupSize*sizeof(uint32));
+
+    if (!result.entries || (lookupSize > 0 && !result.sheetLookup))
+	result.failed = true;
+
+    for (uint32 i = 0; i < numTileSetTiles && !result.failed; ++i)
+    {
+	getPaletteIndex(&result, tileSet->tiles[i].sheetPos);
+    }
+
+    return result;
+}
+
+static void freeTilePalette(TilePalette *palette)
+{
+    if (palette->entries)
+	HEAP_FREE(palette->entries);
+    if (palette->sheetLookup)
+	HEAP_FREE(palette->sheetLookup);
+
+    *palette = {};
+}
+
+#define SAVE_CHUNK_TILES 4096
+//NOTE(denis): has to be a multiple of TILE_MAP_PAGE_SIZE, so allocating a page
+// for an edit never touches the page table of a block the save is reading
+#define SNAPSHOT_ROWS_PER_BLOCK MAP_FILE_ROWS_PER_BLOCK
+
+//NOTE(denis): every block of rows starts out shared with the live map, the
+// editor copies a block before it changes it (unless the save thread is
+// already done with it) and the save thread reads whichever version it finds
+enum SnapshotBlockState
+{
+    BLOCK_SHARED,
+    BLOCK_READING,
+    BLOCK_COPYING,
+    BLOCK_COPIED,
+    BLOCK_DONE
+};
+
+#define NO_FILE_INDEX 0xFFFFFFFF
+
+struct TileMapSnapshot
+{
+    //NOTE(denis): a copy of the map's page table, nothing gets written out to
+    // the page file while a save is running so the copy stays good
+    TileMapPages pages;
+    //NOTE(denis): a copy of the file the map is mapped from, tiles that haven't
+    // been copied out of it yet are read from here. nothing is mapped if they
+    // were all copied into the pages before the save started
+    TileMapView source;
+    int32 widthInTiles;
+    int32 heightInTiles;
+
+    //NOTE(denis): a copy of the map's palette, the map can add to its own while
+    // the save is running. idToFileIndex is filled in by the first pass
+    Point2 *mapPalette;
+    uint32 mapPaletteSize;
+    uint32 *idToFileIndex;
+
+    //NOTE(denis): the map's ids for the source's palette, it belongs to the map
+    TileId *sourceIds;
+    //NOTE(denis): set when the file being replaced is the map's own source, it
+    // can't be replaced until the map lets go of it, so the finished file is
+    // left at tempFileName for the main thread to move over it
+    bool replacesSource;
+    char *tempFileName;
+
+    MapFileHeaderV2 fileHeader;
+    TilePalette palette;
+    char *fileName;
+    bool compressed;
+
+    int32 numBlocks;
+    SDL_atomic_t *blockStates;
+    TileId **blockCopies;
+    //NOTE(denis): where the save thread puts the blocks it reads from the pages
+    TileId *readBlock;
+
+    SDL_atomic_t blocksProcessed;
+    SDL_atomic_t finished;
+    bool succeeded;
+
+    SDL_Thread *thread;
+};
+
+static TileMapSnapshot *_activeSave;
+//NOTE(denis): reported as a failed save the next time the save is polled
+static bool _saveFailedToStart;
+
+static TileSet* getTileSetToSaveWith(TileMap *tileMap)
+{
+    TileSet *result = 0;
+    if (tileMap->tileSetName)
+	result = tileSetPanelGetTileSetByName(tileMap->tileSetName);
+    if (!result)
+	result = tileSetPanelGetCurrentTileSet();
+
+    return result;
+}
+
+static void freeSnapshot(TileMapSnapshot *snapshot)
+{
+    if (snapshot->blockCopies)
+    {
+	for (int32 i = 0; i < snapshot->numBlocks; ++i)
+	{
+	    if (snapshot->blockCopies[i])
+		HEAP_FREE(snapshot->blockCopies[i]);
+	}
+
+	HEAP_FREE(snapshot->blockCopies);
+    }
+    if (snapshot->readBlock)
+    {
+	HEAP_FREE(snapshot->readBlock);
+    }
+    if (snapshot->blockStates)
+    {
+	HEAP_FREE(snapshot->blockStates);
+    }
+    if (snapshot->fileName)
+    {
+	HEAP_FREE(snapshot->fileName);
+    }
+    if (snapshot->tempFileName)
+    {
+	HEAP_FREE(snapshot->tempFileName);
+    }
+    if (snapshot->mapPalette)
+    {
+	HEAP_FREE(snapshot->mapPalette);
+    }
+    if (snapshot->idToFileIndex)
+    {
+	HEAP_FREE(snapshot->idToFileIndex);
+    }
+    freeTilePalette(&snapshot->palette);
+    HEAP_FREE(snapshot);
+}
+
+//NOTE(denis): returns 0 if there wasn't enough memory, the map is only changed
+// if it has a version 1 source, which is copied into the pages either way
+static TileMapSnapshot* createSnapshot(TileMap *tileMap, TileSet *tileSet,
+				       char *fileName, bool compressed)
+{
+    //NOTE(denis): version 1 tiles have to go through the map's palette one at a
+    // time, which can't be done from the save thread, so those are copied out
+    // first. everything else keeps being read from the file by the save thread
+    TileMapView *source = &tileMap->source;
+    if (source->mappedMemory && !tileMap->sourceIds)
+	tileMap->detachSource();
+
+    TileMapSnapshot *result = (TileMapSnapshot*)HEAP_ALLOC(sizeof(TileMapSnapshot));
+    if (!result)
+	return 0;
+
+    result->pages = tileMap->pages;
+    if (source->mappedMemory)
+    {
+	result->source = *source;
+	result->sourceIds = tileMap->sourceIds;
+#if defined(_WIN32)
+	result->replacesSource = source->fileName && lstrcmpiA(source->fileName, fileName) == 0;
+#else
+	result->replacesSource = source->fileName && stringsEqual(source->fileName, fileName);
+#endif
+    }
+    result->widthInTiles = tileMap->widthInTiles;
+    result->heightInTiles = tileMap->heightInTiles;
+
+    //NOTE(denis): tiles that were never set have id 0, so there is always at
+    // least one entry even if the map's palette is empty. tiles that are
+    // duplicates of another one on the sheet are saved as that one
+    result->mapPaletteSize = MAX(tileMap->paletteSize, 1);
+    result->mapPalette = (Point2*)HEAP_ALLOC((uint64)result->mapPaletteSize*sizeof(Point2));
+    result->idToFileIndex = (uint32*)HEAP_ALLOC((uint64)result->mapPaletteSize*sizeof(uint32));
+    result->palette = createTilePalette(tileSet, tileMap->tileSize);
+    result->fileName = duplicateString(fileName);
+    result->compressed = compressed;
+
+    result->numBlocks = (tileMap->heightInTiles + SNAPSHOT_ROWS_PER_BLOCK-1)/SNAPSHOT_ROWS_PER_BLOCK;
+    result->blockStates = (SDL_atomic_t*)HEAP_ALLOC((uint64)result->numBlocks*sizeof(SDL_atomic_t));
+    result->blockCopies = (TileId**)HEAP_ALLOC((uint64)result->numBlocks*sizeof(TileId*));
+    result->readBlock =
+	(TileId*)HEAP_ALLOC((uint64)SNAPSHOT_ROWS_PER_BLOCK*tileMap->widthInTiles*sizeof(TileId));
+
+    if (!result->mapPalette || !result->idToFileIndex || result->palette.failed ||
+	!result->fileName || !result->blockStates || !result->blockCopies || !result->readBlock)
+    {
+	freeSnapshot(result);
+	return 0;
+    }
+
+    for (uint32 i = 0; i < result->mapPaletteSize; ++i)
+    {
+	if (i < tileMap->paletteSize)
+	    result->mapPalette[i] = getCanonicalSheetPos(tileSet, tileMap->palette[i]);
+	result->idToFileIndex[i] = NO_FILE_INDEX;
+    }
+
+    result->fileHeader.magic = MAP_FILE_MAGIC;
+    result->fileHeader.version = MAP_FILE_VERSION;
+    result->fileHeader.tileMapWidth = tileMap->widthInTiles;
+    result->fileHeader.tileMapHeight = tileMap->heightInTiles;
+    result->fileHeader.tileSize = tileMap->tileSize;
+    copyIntoString(result->fileHeader.tileSheetFileName, tileSet->name);
+    copyIntoString(result->fileHeader.tileMapName, tileMap->name);
+
+    return result;
+}
+
+static inline int32 getNumBlockRows(TileMapSnapshot *snapshot, int32 block)
+{
+    return MIN(SNAPSHOT_ROWS_PER_BLOCK,
+	       snapshot->heightInTiles - block*SNAPSHOT_ROWS_PER_BLOCK);
+}
+
+static inline TileMapView* getSnapshotSource(TileMapSnapshot *snapshot)
+{
+    return snapshot->source.mappedMemory ? &snapshot->source : 0;
+}
+
+//NOTE(denis): returns the first tile of the block as it was when the save started
+static TileId* acquireSnapshotBlock(TileMapSnapshot *snapshot, int32 block)
+{
+    TileId *result = 0;
+    SDL_atomic_t *state = snapshot->blockStates + block;
+
+    while (!result)
+    {
+	int32 currentState = SDL_AtomicGet(state);
+
+	if (currentState == BLOCK_COPIED)
+	{
+	    result = snapshot->blockCopies[block];
+	}
+	else if (currentState == BLOCK_SHARED &&
+		 SDL_AtomicCAS(state, BLOCK_SHARED, BLOCK_READING))
+	{
+	    copyTileMapPageRows(&snapshot->pages, getSnapshotSource(snapshot), snapshot->sourceIds,
+				block*SNAPSHOT_ROWS_PER_BLOCK, getNumBlockRows(snapshot, block),
+				snapshot->readBlock);
+	    result = snapshot->readBlock;
+	}
+	else
+	{
+	    //NOTE(denis): the editor is in the middle of copying this block
+	    SDL_Delay(0);
+	}
+    }
+
+    return result;
+}
+
+static void releaseSnapshotBlock(TileMapSnapshot *snapshot, int32 block, bool lastPass)
+{
+    SDL_atomic_t *state = snapshot->blockStates + block;
+
+    if (lastPass)
+    {
+	//NOTE(denis): the editor never touches a copy once it exists, so it is
+	// safe to free here, and after this the block can be edited in place
+	if (SDL_AtomicGet(state) == BLOCK_COPIED)
+	{
+	    HEAP_FREE(snapshot->blockCopies[block]);
+	    snapshot->blockCopies[block] = 0;
+	}
+
+	SDL_AtomicSet(state, BLOCK_DONE);
+    }
+    else if (SDL_AtomicGet(state) == BLOCK_READING)
+    {
+	SDL_AtomicSet(state, BLOCK_SHARED);
+    }
+
+    SDL_AtomicAdd(&snapshot->blocksProcessed, 1);
+}
+
+//NOTE(denis): only after the first pass, every id in the map has a file index by then
+static void makePaletteIndices(uint32 *idToFileIndex, TileId *ids, uint64 numTiles,
+			       uint32 indexSize, void *indices)
+{
+    if (indexSize == 2)
+    {
+	uint16 *smallIndices = (uint16*)indices;
+	for (uint64 i = 0; i < numTiles; ++i)
+	    smallIndices[i] = (uint16)idToFileIndex[ids[i]];
+    }
+    else
+    {
+	uint32 *largeIndices = (uint32*)indices;
+	for (uint64 i = 0; i < numTiles; ++i)
+	    largeIndices[i] = idToFileIndex[ids[i]];
+    }
+}
+
+static void writeUncompressedBlocks(TileMapSnapshot *snapshot, TileMapFileWriter *writer)
+{
+    int32 width = snapshot->widthInTiles;
+    TilePalette *palette = &snapshot->palette;
+    MapFileHeaderV2 *fileHeader = &snapshot->fileHeader;
+
+    writeToTileMapFile(writer, fileHeader, sizeof(MapFileHeaderV2));
+    writeToTileMapFile(writer, palette->entries, palette->count*sizeof(Point2));
+
+    //NOTE(denis): the indices are made a chunk of a row at a time straight
+    // out of the tiles, so the whole file never has to be in memory at once
+    uint32 chunk[SAVE_CHUNK_TILES];
+    for (int32 block = 0; block < snapshot->numBlocks; ++block)
+    {
+	TileId *blockIds = acquireSnapshotBlock(snapshot, block);
+	int32 numBlockRows = getNumBlockRows(snapshot, block);
+
+	for (int32 i = 0; i < numBlockRows && !writer->failed; ++i)
+	{
+	    TileId *row = blockIds + (uint64)i*width;
+
+	    for (int32 j = 0; j < width; j += SAVE_CHUNK_TILES)
+	    {
+		int32 numChunkTiles = MIN(SAVE_CHUNK_TILES, width - j);
+		makePaletteIndices(snapshot->idToFileIndex, row + j, numChunkTiles,
+				   fileHeader->indexSize, chunk);
+
+		writeToTileMapFile(writer, chunk, numChunkTiles*fileHeader->indexSize);
+	    }
+	}
+
+	releaseSnapshotBlock(snapshot, block, true);
+    }
+}
+
+//NOTE(denis): the block index goes before the blocks but their sizes aren't known
+// until they are compressed, so it is written as zeroes and filled in at the end
+static void writeCompressedBlocks(TileMapSnapshot *snapshot, TileMapFileWriter *writer)
+{
+    int32 width = snapshot->widthInTiles;
+    TilePalette *palette = &snapshot->palette;
+    MapFileHeaderV2 *snapshotHeader = &snapshot->fileHeader;
+
+    MapFileHeaderV3 fileHeader = {};
+    fileHeader.magic = MAP_FILE_MAGIC;
+    fileHeader.version = MAP_FILE_VERSION_COMPRESSED;
+    copyIntoString(fileHeader.tileMapName, snapshotHeader->tileMapName);
+    fileHeader.tileMapWidth = snapshotHeader->tileMapWidth;
+    fileHeader.tileMapHeight = snapshotHeader->tileMapHeight;
+    fileHeader.tileSize = snapshotHeader->tileSize;
+    copyIntoString(fileHeader.tileSheetFileName, snapshotHeader->tileSheetFileName);
+    fileHeader.paletteSize = snapshotHeader->paletteSize;
+    fileHeader.indexSize = snapshotHeader->indexSize;
+    fileHeader.rowsPerBlock = SNAPSHOT_ROWS_PER_BLOCK;
+    fileHeader.numBlocks = snapshot->numBlocks;
+
+    writeToTileMapFile(writer, &fileHeader, sizeof(MapFileHeaderV3));
+    writeToTileMapFile(writer, palette->entries, palette->count*sizeof(Point2));
+
+    uint32 blockIndexSize = snapshot->numBlocks*sizeof(MapFileBlock);
+    MapFileBlock *blocks = (MapFileBlock*)HEAP_ALLOC(blockIndexSize);
+
+    //NOTE(denis): the codec only takes 32 bit sizes, a block of a map that wide
+    // can't be saved compressed
+    uint64 maxBlockSize = (uint64)SNAPSHOT_ROWS_PER_BLOCK*width*fileHeader.indexSize;
+    uint8 *rawBlock = 0;
+    uint8 *compressedBlock = 0;
+    if (maxBlockSize <= 0xFFFFFFFF)
+    {
+	rawBlock = (uint8*)HEAP_ALLOC(maxBlockSize);
+	compressedBlock = (uint8*)HEAP_ALLOC(maxBlockSize);
+    }
+    if (!blocks || !rawBlock || !compressedBlock)
+	writer->failed = true;
+
+    //NOTE(denis): blocks starts out zeroed, so this just saves room for the index
+    uint64 blockIndexOffset = getTileMapFilePosition(writer);
+    if (blocks)
+	writeToTileMapFile(writer, blocks, blockIndexSize);
+
+    for (int32 block = 0; block < snapshot->numBlocks; ++block)
+    {
+	TileId *blockIds = acquireSnapshotBlock(snapshot, block);
+
+	if (!writer->failed)
+	{
+	    uint64 numBlockTiles = (uint64)getNumBlockRows(snapshot, block)*width;
+	    uint32 rawSize = (uint32)(numBlockTiles*fileHeader.indexSize);
+	    makePaletteIndices(snapshot->idToFileIndex, blockIds, numBlockTiles,
+			       fileHeader.indexSize, rawBlock);
+
+	    //NOTE(denis): anything that doesn't come out smaller is stored as is
+	    uint32 compressedSize = compressTileMapBlock(rawBlock, rawSize,
+							 compressedBlock, rawSize-1);
+
+	    blocks[block].offset = getTileMapFilePosition(writer);
+	    blocks[block].uncompressedSize = rawSize;
+	    if (compressedSize)
+	    {
+		blocks[block].compressedSize = compressedSize;
+		writeToTileMapFile(writer, compressedBlock, compressedSize);
+	    }
+	    else
+	    {
+		blocks[block].compressedSize = rawSize;
+		writeToTileMapFile(writer, rawBlock, rawSize);
+	    }
+	}
+
+	releaseSnapshotBlock(snapshot, block, true);
+    }
+
+    if (blocks)
+    {
+	rewriteTileMapFile(writer, blockIndexOffset, blocks, blockIndexSize);
+	HEAP_FREE(blocks);
+    }
+    if (rawBlock)
+	HEAP_FREE(rawBlock);
+    if (compressedBlock)
+	HEAP_FREE(compressedBlock);
+}
+
+static bool writeSnapshotToFile(TileMapSnapshot *snapshot)
+{
+    int32 width = snapshot->widthInTiles;
+    TilePalette *palette = &snapshot->palette;
+    MapFileHeaderV2 *fileHeader = &snapshot->fileHeader;
+
+    //NOTE(denis): first pass finds every sheet position used so we know
+    // how wide the indices have to be, each id only has to be looked up once
+    uint32 *idToFileIndex = snapshot->idToFileIndex;
+    for (int32 block = 0; block < snapshot->numBlocks; ++block)
+    {
+	TileId *blockIds = acquireSnapshotBlock(snapshot, block);
+	uint64 numBlockTiles = (uint64)getNumBlockRows(snapshot, block)*width;
+
+	for (uint64 i = 0; i < numBlockTiles; ++i)
+	{
+	    TileId id = blockIds[i];
+	    if (idToFileIndex[id] == NO_FILE_INDEX)
+		idToFileIndex[id] = getPaletteIndex(palette, snapshot->mapPalette[id]);
+	}
+
+	releaseSnapshotBlock(snapshot, block, false);
+    }
+
+    if (palette->failed)
+	return false;
+
+    fileHeader->paletteSize = palette->count;
+    fileHeader->indexSize = palette->count <= 0x10000 ? 2 : 4;
+
+    TileMapFileWriter writer = {};
+    beginTileMapFile(&writer, snapshot->fileName);
+
+    if (snapshot->compressed)
+	writeCompressedBlocks(snapshot, &writer);
+    else
+	writeUncompressedBlocks(snapshot, &writer);
+
+    bool result;
+    if (snapshot->replacesSource)
+	result = endTileMapFileInTemp(&writer, &snapshot->tempFileName);
+    else
+	result = endTileMapFile(&writer);
+
+    return result;
+}
+
+//NOTE(denis): the saved file's palette index of every id is known from the
+// first pass, so this just turns that around. lower ids win when several ids
+// became the same index, indices nothing was saved with are left as 0
+static TileId* makeSavedPaletteIds(TileMapSnapshot *snapshot)
+{
+    uint32 numIndices = snapshot->palette.count;
+    TileId *result = (TileId*)HEAP_ALLOC(numIndices*sizeof(TileId));
+
+    if (result)
+    {
+	for (uint32 id = snapshot->mapPaletteSize; id > 0; --id)
+	{
+	    uint32 index = snapshot->idToFileIndex[id-1];
+	    if (index < numIndices)
+		result[index] = (TileId)(id-1);
+	}
+    }
+
+    return result;
+}
+
+//NOTE(denis): has to be on the main thread, the map's source gets swapped for
+// the file that was just saved. every tile that isn't in the pages is in the new
+// file at the same place, so nothing has to be copied out of the old one
+static bool replaceMapSource(TileMapSnapshot *snapshot, TileMap *tileMap)
+{
+    TileId *newIds = makeSavedPaletteIds(snapshot);
+    TileId *oldIds = tileMap->sourceIds;
+    tileMap->sourceIds = 0;
+    closeTileMapView(&tileMap->source);
+
+    bool result = replaceTileMapFile(snapshot->tempFileName, snapshot->fileName);
+
+    //NOTE(denis): whichever file is there now, the old one if replacing it failed
+    TileId *ids = result ? newIds : oldIds;
+    TileId *unusedIds = result ? oldIds : newIds;
+    if (unusedIds)
+    {
+	HEAP_FREE(unusedIds);
+    }
+
+    TileMapView view = openTileMapView(snapshot->fileName);
+    if (view.mappedMemory)
+    {
+	//NOTE(denis): with no ids the tiles are looked up in the map's palette
+	// one by one, the way version 1 files are
+	tileMap->attachSource(&view, ids);
+    }
+    else
+    {
+	//NOTE(denis): there's nothing left to read the untouched tiles from,
+	// which only happens if a file we just had open can't be opened again
+	result = false;
+	if (ids)
+	{
+	    HEAP_FREE(ids);
+	}
+    }
+
+    return result;
+}
+
+//NOTE(denis): the last part of a save, always on the main thread
+static bool finishSnapshot(TileMapSnapshot *snapshot, TileMap *tileMap)
+{
+    bool result = snapshot->succeeded;
+
+    if (result && snapshot->tempFileName)
+	result = tileMap && replaceMapSource(snapshot, tileMap);
+
+    freeSnapshot(snapshot);
+
+    return result;
+}
+
+static int saveThreadProc(void *data)
+{
+    TileMapSnapshot *snapshot = (TileMapSnapshot*)data;
+
+    snapshot->succeeded = writeSnapshotToFile(snapshot);
+    SDL_AtomicSet(&snapshot->finished, 1);
+
+    return 0;
+}
+
+bool writeTileMapToFile(TileMap *tileMap, char *fileName, bool compressed)
+{
+    return writeTileMapToFile(tileMap, getTileSetToSaveWith(tileMap), fileName, compressed);
+}
+
+bool writeTileMapToFile(TileMap *tileMap, TileSet *tileSet, char *fileName, bool compressed)
+{
+    TileMapSnapshot *snapshot = createSnapshot(tileMap, tileSet, fileName, compressed);
+    if (!snapshot)
+	return false;
+
+    snapshot->succeeded = writeSnapshotToFile(snapshot);
+
+    return finishSnapshot(snapshot, tileMap);
+}
+
+bool startTileMapSave(TileMap *tileMap, char *fileName, bool compressed)
+{
+    //NOTE(denis): only one save at a time
+    waitForTileMapSave();
+
+    _activeSave = createSnapshot(tileMap, getTileSetToSaveWith(tileMap), fileName, compressed);
+    _saveFailedToStart = !_activeSave;
+
+    if (_activeSave)
+    {
+	_activeSave->thread = SDL_CreateThread(saveThreadProc, "TileMapSave", _activeSave);
+
+	if (!_activeSave->thread)
+	{
+	    saveThreadProc(_activeSave);
+	}
+    }
+
+    return _activeSave != 0;
+}
+
+//NOTE(denis): returns false if there was no save or it failed
+static bool finishActiveSave()
+{
+    bool result = false;
+    
+    if (_activeSave)
+    {
+	if (_activeSave->thread)
+	    SDL_WaitThread(_activeSave->thread, 0);
+
+	TileMap *tileMap = tileMapPanelGetTileMapWithPages(&_activeSave->pages);
+	result = finishSnapshot(_activeSave, tileMap);
+	_activeSave = 0;
+    }
+
+    return result;
+}
+
+SaveProgress pollTileMapSave()
+{
+    SaveProgress result = {};
+
+    if (_saveFailedToStart)
+    {
+	_saveFailedToStart = false;
+	result.finished = true;
+    }
+    else if (_activeSave)
+    {
+	if (SDL_AtomicGet(&_activeSave->finished))
+	{
+	    result.finished = true;
+	    result.succeeded = finishActiveSave();
+	}
+	else
+	{
+	    result.inProgress = true;
+	    result.percentDone = (100*SDL_AtomicGet(&_activeSave->blocksProcessed))/
+		(2*_activeSave->numBlocks);
+	}
+    }
+
+    return result;
+}
+
+bool tileMapSaveInProgress()
+{
+    return _activeSave != 0;
+}
+
+//NOTE(denis): the snapshot's pages are a copy of the map's, so they share a table
+bool tileMapSaveIsReading(TileMapPages *pages)
+{
+    return _activeSave != 0 && _activeSave->pages.table == pages->table;
+}
+
+void waitForTileMapSave()
+{
+    finishActiveSave();
+}
+
+void tileMapBeforeEdit(TileMap *tileMap, int32 row)
+{
+    TileMapSnapshot *snapshot = _activeSave;
+
+    if (snapshot && snapshot->pages.table == tileMap->pages.table)
+    {
+	int32 block = row/SNAPSHOT_ROWS_PER_BLOCK;
+	SDL_atomic_t *state = snapshot->blockStates + block;
+
+	bool readyToEdit = false;
+	while (!readyToEdit)
+	{
+	    int32 currentState = SDL_AtomicGet(state);
+
+	    if (currentState == BLOCK_COPIED || currentState == BLOCK_DONE ||
+		SDL_AtomicGet(&snapshot->finished))
+	    {
+		readyToEdit = true;
+	    }
+	    else if (currentState == BLOCK_SHARED &&
+		     SDL_AtomicCAS(state, BLOCK_SHARED, BLOCK_COPYING))
+	    {
+		int32 numBlockRows = getNumBlockRows(snapshot, block);
+		uint64 numBlockTiles = (uint64)numBlockRows*snapshot->widthInTiles;
+
+		TileId *copy = (TileId*)HEAP_ALLOC(numBlockTiles*sizeof(TileId));
+		if (copy)
+		{
+		    copyTileMapPageRows(&snapshot->pages, getSnapshotSource(snapshot),
+					snapshot->sourceIds, block*SNAPSHOT_ROWS_PER_BLOCK,
+					numBlockRows, copy);
+
+		    snapshot->blockCopies[block] = copy;
+		    SDL_AtomicSet(state, BLOCK_COPIED);
+		}
+		else
+		{
+		    //NOTE(denis): with no memory for the copy the edit has to wait
+		    // until the save thread is done reading anything, the block
+		    // goes back to shared first so the save thread can get to it
+		    SDL_AtomicSet(state, BLOCK_SHARED);
+		    while (!SDL_AtomicGet(&snapshot->finished))
+		    {
+			SDL_Delay(1);
+		    }
+		}
+
+		readyToEdit = true;
+	    }
+	    else
+	    {
+		//NOTE(denis): the save thread is reading this block right now,
+		// which only takes as long as converting SNAPSHOT_ROWS_PER_BLOCK rows
+		SDL_Delay(0);
+	    }
+	}
+    }
+}
 
 void saveTileMapToFile(TileMap *tileMap, char *tileMapName)
 {
@@ -30,6 +848,7 @@ void saveTileMapToFile(TileMap *tileMap, char *tileMapName)
 	    fileName[i] = tileMapName[i];
     }
     
+#if defined(_WIN32)
     OPENFILENAME openFileName = {};
     openFileName.lStructSize = sizeof(OPENFILENAME);
     char *filter = "Map File\0*.map\0\0";
@@ -41,56 +860,15 @@ void saveTileMapToFile(TileMap *tileMap, char *tileMapName)
     openFileName.lpstrDefExt = "map";
     
     BOOL result =  GetSaveFileName(&openFileName);
+#else
+    //NOTE(denis): there's no file dialog outside of windows, the map is saved
+    // under its own name in the working folder
+    bool result = true;
+#endif
     
     if (result != 0)
     {
-	HANDLE fileHandle = CreateFile(fileName, GENERIC_WRITE, FILE_SHARE_READ,
-				       NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
-				       NULL);
-
-	if (fileHandle != INVALID_HANDLE_VALUE)
-	{
-	    MapFileHeader fileHeader = {};
-	    fileHeader.tileMapWidth = tileMap->widthInTiles;
-	    fileHeader.tileMapHeight = tileMap->heightInTiles;
-	    fileHeader.tileSize = tileMap->tileSize;
-
-	    char *tempString = tileSetPanelGetCurrentTileSetFileName();
-	    copyIntoString(fileHeader.tileSheetFileName, tempString);
-
-	    copyIntoString(fileHeader.tileMapName, tileMap->name);
-	    
-	    uint32 tileMapSizeInBytes = tileMap->widthInTiles*tileMap->heightInTiles*sizeof(Tile);
-	    uint32 bytesToWrite = sizeof(MapFileHeader) + tileMapSizeInBytes;
-	    DWORD bytesWritten = 0;
-
-	    void *bufferToWrite = HEAP_ALLOC(bytesToWrite);
-
-	    for (uint32 i = 0; i < bytesToWrite; ++i)
-	    {
-		uint8 *nextBufferByte = (uint8*)bufferToWrite + i;
-		uint8 *nextCopiedByte = 0;
-		
-		if (i < sizeof(fileHeader))
-		{
-		    nextCopiedByte = (uint8*)(&fileHeader) + i;
-		}
-		else
-		{
-		    nextCopiedByte = (uint8*)(&(tileMap->tiles + (i-sizeof(fileHeader))/sizeof(Tile))->tile) + (i-sizeof(fileHeader))%sizeof(Tile);
-		}
-
-		*nextBufferByte = *nextCopiedByte;
-	    }
-	    
-	    WriteFile(fileHandle, bufferToWrite, bytesToWrite, &bytesWritten, NULL);
-
-	    assert(bytesToWrite == bytesWritten);
-	    
-	    HEAP_FREE(bufferToWrite);
-	    
-	    CloseHandle(fileHandle);
-	}
+	startTileMapSave(tileMap, fileName, true);
     }
 }
 
@@ -98,6 +876,7 @@ static char* showOpenFileDialog(char *descriptionOfFile, char *fileExtension)
 {
     char *result = 0;
 
+#if defined(_WIN32)
     const uint32 fileNameSize = 512;
     char *fileNameBuffer = (char*)HEAP_ALLOC(fileNameSize);
     
@@ -129,18 +908,25 @@ static char* showOpenFileDialog(char *descriptionOfFile, char *fileExtension)
     {
 	result = fileNameBuffer;
     }
+#else
+    //NOTE(denis): there's no file dialog outside of windows, so nothing is picked
+#endif
     
     return result;
 }
 
-LoadTileMapResult loadTileMapFromFile()
+TileMapView openTileMapFromFile()
 {    
     char *fileDescription = "Tile Map file";
     char *fileExtension = "map";
 
     char *fileName = showOpenFileDialog(fileDescription, fileExtension);
+    TileMapView result = openTileMapView(fileName);
 
-    return loadTileMap(fileName);
+    if (fileName)
+	HEAP_FREE(fileName);
+
+    return result;
 }
 
 char* getTileSheetFileName()
@@ -4,9 +4,46 @@
 #include "tile_map_file.h"
 
 struct TileMap;
+struct TileSet;
+struct TileMapPages;
 
+struct SaveProgress
+{
+    bool inProgress;
+    bool finished;
+    bool succeeded;
+    int32 percentDone;
+};
+
+//NOTE(denis): asks the user where to save and then starts a background save
 void saveTileMapToFile(TileMap *tileMap, char *tileMapName);
-LoadTileMapResult loadTileMapFromFile();
+//NOTE(denis): saves on the calling thread, returns false if the file couldn't
+// be written, the old file is left as it was in that case. compressed writes a
+// version 3 file with compressed blocks of rows instead of a version 2 file
+bool writeTileMapToFile(TileMap *tileMap, char *fileName, bool compressed);
+//NOTE(denis): same as above, but with the tile set given instead of looked up
+// in the tile set panel, so it works without any of the UI set up
+bool writeTileMapToFile(TileMap *tileMap, TileSet *tileSet, char *fileName, bool compressed);
+
+//NOTE(denis): saves on a worker thread from a copy-on-write snapshot of the
+// map, so the map can keep being edited while the file is written. returns
+// false and leaves the map alone if there wasn't memory for the snapshot, the
+// next poll reports it as a failed save. maps opened from version 1 files are
+// the exception, their untouched tiles are still copied into the pages on the
+// calling thread before the save starts
+bool startTileMapSave(TileMap *tileMap, char *fileName, bool compressed);
+//NOTE(denis): call once a frame, finished is only true on the frame the save ends
+SaveProgress pollTileMapSave();
+void waitForTileMapSave();
+//NOTE(denis): stays true until the save has been polled or waited on
+bool tileMapSaveInProgress();
+//NOTE(denis): true if the save that is running is reading these pages
+bool tileMapSaveIsReading(TileMapPages *pages);
+//NOTE(denis): has to be called before any tile in the row is changed
+void tileMapBeforeEdit(TileMap *tileMap, int32 row);
+//NOTE(denis): the returned view has to be closed with closeTileMapView or
+// handed off to the tile map panel
+TileMapView openTileMapFromFile();
 
 char* getTileSheetFileName();
 
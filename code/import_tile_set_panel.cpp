@@ -3,6 +3,9 @@
 #include "tile_set_panel.h"
 #include "file_saving_loading.h"
 #include "TEMP_GeneralFunctions.cpp"
+#if !defined(_WIN32)
+#include "SDL_rwops.h"
+#endif
 
 #define MIN_WIDTH 950
 #define MIN_HEIGHT 150
@@ -24,6 +27,35 @@ static Button _cancelButton;
 static Button _openButton;
 static TexturedRect _warningText;
 
+#if !defined(_WIN32)
+//NOTE(denis): stands in for CopyFileEx everywhere else
+static bool copyFile(char *source, char *destination)
+{
+    bool result = false;
+
+    SDL_RWops *input = SDL_RWFromFile(source, "rb");
+    SDL_RWops *output = input ? SDL_RWFromFile(destination, "wb") : 0;
+    if (input && output)
+    {
+	uint8 buffer[4096];
+	size_t bytesRead = 0;
+
+	result = true;
+	while (result && (bytesRead = SDL_RWread(input, buffer, 1, sizeof(buffer))) > 0)
+	{
+	    result = SDL_RWwrite(output, buffer, 1, bytesRead) == bytesRead;
+	}
+    }
+
+    if (output)
+	SDL_RWclose(output);
+    if (input)
+	SDL_RWclose(input);
+
+    return result;
+}
+#endif
+
 void importTileSetPanelCreateNew(SDL_Renderer *renderer, int32 x, int32 y,
 				 int32 width, int32 height)
 {
@@ -133,8 +165,12 @@ void importTileSetPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
 		    char *tileSheetFolderPath = concatStrings(programPath, TILE_SHEET_FOLDER);
 		    char *tileSheetNewFullPath = concatStrings(tileSheetFolderPath, fileNameTruncated);
 
-		    BOOL result = CopyFileEx(_tileSheetEditText.text, tileSheetNewFullPath, 0, 0, 0, 0);
-		    if (result == 0)
+#if defined(_WIN32)
+		    bool copied = CopyFileEx(_tileSheetEditText.text, tileSheetNewFullPath, 0, 0, 0, 0) != 0;
+#else
+		    bool copied = copyFile(_tileSheetEditText.text, tileSheetNewFullPath);
+#endif
+		    if (!copied)
 		    {
 			//TODO(denis): failed to copy the file
 		    }
@@ -143,10 +179,17 @@ void importTileSetPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
 		    HEAP_FREE(tileSheetFolderPath);
 		}
 		
-		tileSetPanelInitializeNewTileSet(fileNameTruncated, newTileSheet,
-						 tileSize);
-		
-		_panel.visible = false;
+		if (tileSetPanelInitializeNewTileSet(fileNameTruncated, newTileSheet,
+						     tileSize))
+		{
+		    _panel.visible = false;
+		}
+		else
+		{
+		    warning = "couldn't add the tile set";
+		    SDL_FreeSurface(newTileSheet);
+		    HEAP_FREE(fileNameTruncated);
+		}
 	    }
 	    else
 	    {
@@ -172,7 +215,7 @@ void importTileSetPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
 	    }
 	}
 
-	HeapFree(GetProcessHeap(), 0, fileName);
+	HEAP_FREE(fileName);
     }
 }
 
@@ -0,0 +1,297 @@
+/* NOTE(denis): benchmark for loading and saving .map files
+ *
+ * makes synthetic tile maps from 64x64 up to 16384x16384, saves each one as a
+ * version 2 and a version 3 (compressed) file with writeTileMapToFile, loads
+ * it back with loadTileMap and prints the results as JSON
+ *
+ * usage: io_benchmark [--max-size N] [--dir folder]
+ *
+ * --max-size  biggest map to try, the 16384x16384 map needs over 10GB of memory
+ * --dir       where the files are written, they are deleted afterwards
+ *
+ * peak_rss_mb is the peak for the whole process so far, since the maps get
+ * bigger each case it is effectively the peak of the biggest case
+ */
+
+#include "windows.h"
+#include "psapi.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "ui_elements.h"
+#include "main.h"
+#include "file_saving_loading.h"
+#include "tile_map_panel.h"
+#include "TEMP_GeneralFunctions.cpp"
+
+#define MIN_MAP_SIZE 64
+#define MAX_MAP_SIZE 16384
+#define BENCHMARK_TILE_SIZE 32
+#define TILE_SHEET_WIDTH_IN_TILES 8
+
+struct IOBenchmarkResult
+{
+    char *operation;
+    bool compressed;
+    bool succeeded;
+
+    uint64 fileBytes;
+    real64 seconds;
+    uint32 allocations;
+    uint64 peakWorkingSet;
+};
+
+static inline real64 ticksToSeconds(uint64 ticks)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+
+    return (real64)ticks/(real64)frequency.QuadPart;
+}
+
+static inline uint64 getTicks()
+{
+    LARGE_INTEGER counter;
+    QueryPerformanceCounter(&counter);
+
+    return counter.QuadPart;
+}
+
+static uint64 getPeakWorkingSet()
+{
+    PROCESS_MEMORY_COUNTERS counters = {};
+    counters.cb = sizeof(counters);
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+    return counters.PeakWorkingSetSize;
+}
+
+static uint64 getFileSize(char *fileName)
+{
+    uint64 result = 0;
+
+    WIN32_FILE_ATTRIBUTE_DATA fileInformation = {};
+    if (GetFileAttributesEx(fileName, GetFileExInfoStandard, &fileInformation) != 0)
+    {
+	result = ((uint64)fileInformation.nFileSizeHigh << 32) | fileInformation.nFileSizeLow;
+    }
+
+    return result;
+}
+
+//NOTE(denis): only what the palette needs, the benchmark never draws so the
+// tile set has no image
+static TileSet createSyntheticTileSet()
+{
+    TileSet result = {};
+    result.name = "benchmark.png";
+    result.tileSize = BENCHMARK_TILE_SIZE;
+    result.imageSize.w = TILE_SHEET_WIDTH_IN_TILES*BENCHMARK_TILE_SIZE;
+    result.imageSize.h = TILE_SHEET_WIDTH_IN_TILES*BENCHMARK_TILE_SIZE;
+
+    uint32 numTiles = TILE_SHEET_WIDTH_IN_TILES*TILE_SHEET_WIDTH_IN_TILES;
+    result.tiles = (Tile*)HEAP_ALLOC(numTiles*sizeof(Tile));
+    for (int32 i = 0; i < TILE_SHEET_WIDTH_IN_TILES; ++i)
+    {
+	for (int32 j = 0; j < TILE_SHEET_WIDTH_IN_TILES; ++j)
+	{
+	    Tile *tile = result.tiles + result.numTiles++;
+	    tile->size = BENCHMARK_TILE_SIZE;
+	    tile->sheetPos.x = j*BENCHMARK_TILE_SIZE;
+	    tile->sheetPos.y = i*BENCHMARK_TILE_SIZE;
+	}
+    }
+
+    return result;
+}
+
+//NOTE(denis): patches of the same tile with the odd different tile in them,
+// roughly what a painted map looks like, so the compressed files are neither
+// trivially small nor incompressible
+static inline Point2 getSyntheticSheetPos(int32 x, int32 y)
+{
+    uint32 hash = (uint32)(x/8)*73856093u ^ (uint32)(y/8)*19349663u;
+    if (((uint32)x*2654435761u ^ (uint32)y*40503u) % 17 == 0)
+	hash = (uint32)x*83492791u ^ (uint32)y;
+
+    uint32 tile = hash % (TILE_SHEET_WIDTH_IN_TILES*TILE_SHEET_WIDTH_IN_TILES);
+
+    Point2 result;
+    result.x = (tile % TILE_SHEET_WIDTH_IN_TILES)*BENCHMARK_TILE_SIZE;
+    result.y = (tile / TILE_SHEET_WIDTH_IN_TILES)*BENCHMARK_TILE_SIZE;
+
+    return result;
+}
+
+static bool createSyntheticTileMap(TileMap *tileMap, int32 mapSize)
+{
+    *tileMap = {};
+    tileMap->name = "benchmark";
+    tileMap->tileSize = BENCHMARK_TILE_SIZE;
+    tileMap->widthInTiles = mapSize;
+    tileMap->heightInTiles = mapSize;
+
+    //NOTE(denis): no budget, the benchmark is for the file code not the page file
+    bool result = tileMap->createTiles(0);
+    if (result)
+    {
+	for (int32 i = 0; i < mapSize; ++i)
+	{
+	    for (int32 j = 0; j < mapSize; ++j)
+	    {
+		tileMap->setTile(j, i, getSyntheticSheetPos(j, i));
+	    }
+	}
+    }
+
+    return result;
+}
+
+static bool loadedTilesMatch(LoadTileMapResult *loaded, TileMap *tileMap)
+{
+    bool result = loaded->tiles &&
+	loaded->tileMapWidth == (uint32)tileMap->widthInTiles &&
+	loaded->tileMapHeight == (uint32)tileMap->heightInTiles;
+
+    for (int32 i = 0; i < tileMap->heightInTiles && result; ++i)
+    {
+	LoadedTile *row = loaded->tiles + (uint64)i*tileMap->widthInTiles;
+	for (int32 j = 0; j < tileMap->widthInTiles && result; ++j)
+	{
+	    Point2 sheetPos = {};
+	    result = tileMap->getTile(j, i, &sheetPos) &&
+		row[j].sheetPos.x == sheetPos.x && row[j].sheetPos.y == sheetPos.y;
+	}
+    }
+
+    return result;
+}
+
+static IOBenchmarkResult benchmarkSave(TileMap *tileMap, TileSet *tileSet,
+				       char *fileName, bool compressed)
+{
+    IOBenchmarkResult result = {};
+    result.operation = "save";
+    result.compressed = compressed;
+
+    uint32 allocationsBefore = profilerGetNumAllocations();
+    uint64 start = getTicks();
+
+    result.succeeded = writeTileMapToFile(tileMap, tileSet, fileName, compressed);
+
+    result.seconds = ticksToSeconds(getTicks() - start);
+    result.allocations = profilerGetNumAllocations() - allocationsBefore;
+    result.fileBytes = getFileSize(fileName);
+    result.peakWorkingSet = getPeakWorkingSet();
+
+    return result;
+}
+
+static IOBenchmarkResult benchmarkLoad(TileMap *tileMap, char *fileName, bool compressed)
+{
+    IOBenchmarkResult result = {};
+    result.operation = "load";
+    result.compressed = compressed;
+
+    uint32 allocationsBefore = profilerGetNumAllocations();
+    uint64 start = getTicks();
+
+    LoadTileMapResult loaded = loadTileMap(fileName);
+
+    result.seconds = ticksToSeconds(getTicks() - start);
+    result.allocations = profilerGetNumAllocations() - allocationsBefore;
+    result.fileBytes = getFileSize(fileName);
+    result.peakWorkingSet = getPeakWorkingSet();
+
+    //NOTE(denis): checked after the timing so it doesn't count
+    result.succeeded = loadedTilesMatch(&loaded, tileMap);
+
+    if (loaded.tiles)
+	HEAP_FREE(loaded.tiles);
+    if (loaded.tileMapName)
+	HEAP_FREE(loaded.tileMapName);
+    if (loaded.tileSheetFileName)
+	HEAP_FREE(loaded.tileSheetFileName);
+
+    return result;
+}
+
+static void printResult(IOBenchmarkResult *result, int32 mapSize, bool first)
+{
+    uint64 numTiles = (uint64)mapSize*mapSize;
+    real64 megabytes = (real64)result->fileBytes/(1024.0*1024.0);
+    real64 seconds = MAX(result->seconds, 0.000001);
+
+    printf("%s    {\"map_size\": %d, \"operation\": \"%s\", \"format\": %d, "
+	   "\"succeeded\": %s, \"file_bytes\": %llu, \"seconds\": %.6f, "
+	   "\"mb_per_s\": %.1f, \"mtiles_per_s\": %.1f, \"allocations\": %u, "
+	   "\"peak_rss_mb\": %.1f}",
+	   first ? "" : ",\n", mapSize, result->operation,
+	   result->compressed ? MAP_FILE_VERSION_COMPRESSED : MAP_FILE_VERSION,
+	   result->succeeded ? "true" : "false", result->fileBytes, result->seconds,
+	   megabytes/seconds, (real64)numTiles/1000000.0/seconds, result->allocations,
+	   (real64)result->peakWorkingSet/(1024.0*1024.0));
+}
+
+int main(int argc, char* argv[])
+{
+    int32 maxSize = MAX_MAP_SIZE;
+    char *folder = 0;
+
+    for (int32 i = 1; i < argc; ++i)
+    {
+	if (strcmp(argv[i], "--max-size") == 0 && i+1 < argc)
+	{
+	    maxSize = atoi(argv[++i]);
+	}
+	else if (strcmp(argv[i], "--dir") == 0 && i+1 < argc)
+	{
+	    folder = argv[++i];
+	}
+    }
+
+    TileSet tileSet = createSyntheticTileSet();
+
+    char *fileName = "io_benchmark.map";
+    if (folder)
+	fileName = concatStrings(folder, "\\io_benchmark.map");
+
+    printf("{\n  \"benchmark\": \"io\",\n  \"tile_size\": %d,\n  \"results\": [\n",
+	   BENCHMARK_TILE_SIZE);
+
+    bool first = true;
+    for (int32 mapSize = MIN_MAP_SIZE; mapSize <= maxSize; mapSize *= 2)
+    {
+	TileMap tileMap;
+	if (!createSyntheticTileMap(&tileMap, mapSize))
+	{
+	    fprintf(stderr, "couldn't allocate a %dx%d map, stopping\n", mapSize, mapSize);
+	    break;
+	}
+
+	for (int32 format = 0; format < 2; ++format)
+	{
+	    bool compressed = format == 1;
+
+	    IOBenchmarkResult save = benchmarkSave(&tileMap, &tileSet, fileName, compressed);
+	    printResult(&save, mapSize, first);
+	    first = false;
+
+	    if (save.succeeded)
+	    {
+		IOBenchmarkResult load = benchmarkLoad(&tileMap, fileName, compressed);
+		printResult(&load, mapSize, first);
+	    }
+
+	    fflush(stdout);
+	    DeleteFile(fileName);
+	}
+
+	tileMap.freeTiles();
+    }
+
+    printf("\n  ]\n}\n");
+
+    return 0;
+}
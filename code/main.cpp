@@ -38,6 +38,7 @@
 #include "tile_set_panel.h"
 #include "tile_map_panel.h"
 #include "import_tile_set_panel.h"
+#include "minimap_panel.h"
 #include "TEMP_GeneralFunctions.cpp"
 
 #define TITLE "Tile Map Editor"
@@ -194,13 +195,70 @@ static inline void openImportTileSetPanel()
     }
 }
 
-static inline void addTileMapToMenuBar(DropDownMenu *menu, char *tileMapName)
+//NOTE(denis): the open maps in the order they are listed in the tile map
+// menu, item i+1 of the menu is _menuTileMaps[i]
+static TileMapHandle *_menuTileMaps;
+static int32 _numMenuTileMaps;
+static int32 _maxMenuTileMaps;
+
+static inline void addTileMapToMenuBar(DropDownMenu *menu, TileMapHandle handle)
 {
+    TileMap *tileMap = tileMapPanelGetTileMap(handle);
+    if (!tileMap)
+	return;
+    
     if (menu->itemCount == 2)
     {
         menu->addItem("Close Tile Map", menu->itemCount-1);
     }
-    menu->addItem(tileMapName, menu->itemCount-2);
+    menu->addItem(tileMap->name, menu->itemCount-2);
+
+    if (_numMenuTileMaps == _maxMenuTileMaps)
+    {
+	int32 newMaxCount = MAX(_maxMenuTileMaps*2, 16);
+	_menuTileMaps = (TileMapHandle*)growArray(_menuTileMaps, _maxMenuTileMaps,
+						  sizeof(TileMapHandle), newMaxCount);
+	_maxMenuTileMaps = newMaxCount;
+    }
+    _menuTileMaps[_numMenuTileMaps++] = handle;
+}
+
+//NOTE(denis): the map listed next to it in the menu is selected afterwards
+static void closeSelectedTileMap(DropDownMenu *menu)
+{
+    TileMapHandle selected = tileMapPanelGetCurrentTileMapHandle();
+
+    int32 position = -1;
+    for (int32 i = 0; i < _numMenuTileMaps && position == -1; ++i)
+    {
+	if (_menuTileMaps[i].slot == selected.slot &&
+	    _menuTileMaps[i].generation == selected.generation)
+	{
+	    position = i;
+	}
+    }
+
+    if (position != -1)
+    {
+	menu->removeItem(position+1);
+	tileMapPanelRemoveTileMap(selected);
+
+	for (int32 i = position+1; i < _numMenuTileMaps; ++i)
+	{
+	    _menuTileMaps[i-1] = _menuTileMaps[i];
+	}
+	--_numMenuTileMaps;
+
+	if (_numMenuTileMaps > 0)
+	{
+	    tileMapPanelSelectTileMap(_menuTileMaps[MIN(position, _numMenuTileMaps-1)]);
+	}
+	else
+	{
+	    //NOTE(denis): remove "close tile map" from the menu
+	    menu->removeItem(1);
+	}
+    }
 }
 
 int main(int argc, char* argv[])
@@ -282,8 +340,19 @@ int main(int argc, char* argv[])
 		tileMapPanelCreateNew(renderer, x, y, width, height);
 	    }
 
+	    //NOTE(denis): minimap, over the bottom right corner of the tile map
+	    {
+		int32 padding = 10;
+		int32 size = 200;
+		SDL_Rect mapArea = tileMapPanelGetMapArea();
+		int32 x = mapArea.x + mapArea.w - size - padding;
+		int32 y = mapArea.y + mapArea.h - size - padding;
+
+		minimapPanelCreateNew(renderer, x, y, size, size);
+	    }
+
 	    //NOTE(denis): automatic tile sheet opening panel
-	    LoadTileMapResult loadedTileMapData = {};
+	    TileMapView loadedTileMapView = {};
 	    SDL_Surface *loadedTileSet = 0;
 	    
 	    UIPanel openTileSheetPanel = {};
@@ -366,15 +435,41 @@ int main(int argc, char* argv[])
 
 	    HEAP_FREE(programPathName);
 	    programPathName = 0;
+
+	    int32 lastSavePercent = -1;
 	    
 	    while (running)
 	    {
-		static uint32 topMenuOpenDelay = 0;
-                #define DELAY_THRESHOLD 20
+		//NOTE(denis): clicks are ignored for a moment after a menu item is
+		// picked so the same click doesn't also land on the panel behind it
+		static uint32 topMenuClosedTicks = 0;
+		#define TOP_MENU_CLICK_DELAY 330
+
+		//NOTE(denis): nothing gets drawn until something changes, while a
+		// save or a tile sheet import is running we still wake up to check on it
+		#define MAX_IDLE_WAIT 500
+		#define SAVE_PROGRESS_WAIT 100
+		if (!ui_redrawNeeded())
+		{
+		    uint32 maxWait = lastSavePercent != -1 || tileSetPanelImportInProgress() ?
+			SAVE_PROGRESS_WAIT : MAX_IDLE_WAIT;
+		    SDL_WaitEventTimeout(NULL, ui_getTimeUntilRedraw(maxWait));
+		}
+
+		bool topMenuReady = SDL_TICKS_PASSED(SDL_GetTicks(),
+						     topMenuClosedTicks + TOP_MENU_CLICK_DELAY);
+
+		profilerBeginFrame();
+		profilerBeginSection(PROFILE_EVENTS);
 		
 		SDL_Event event;
 		while (SDL_PollEvent(&event))
 		{
+		    //NOTE(denis): mouse movement only redraws if a panel says
+		    // it changed something
+		    if (event.type != SDL_MOUSEMOTION)
+			ui_requestRedraw();
+		    
 		    switch(event.type)
 		    {
 			case SDL_QUIT:
@@ -409,6 +504,11 @@ int main(int argc, char* argv[])
 			    
 			} break;
 
+			case SDL_RENDER_TARGETS_RESET:
+			{
+			    tileMapPanelOnRenderTargetsReset();
+			} break;
+
 			case SDL_MOUSEMOTION:
 			{
 			    //TODO(denis): also handle when the user has focus on our
@@ -425,7 +525,10 @@ int main(int argc, char* argv[])
 				    tileSetPanelOnMouseMove(mouse);
 				}
 
-				if (tileMapPanelVisible())
+				//NOTE(denis): dragging in the minimap scrolls the map, the
+				// map shouldn't also be painted on
+				if (tileMapPanelVisible() &&
+				    !minimapPanelOnMouseMove(mouse, leftClickFlag))
 				{
 				    tileMapPanelOnMouseMove(mouse, leftClickFlag);
 				}
@@ -454,14 +557,15 @@ int main(int argc, char* argv[])
 			    else if (tileSetPanelVisible() || tileMapPanelVisible())
 			    {
 				if (!topMenuBar.isOpen() &&
-				    topMenuOpenDelay > DELAY_THRESHOLD)
+				    topMenuReady)
 				{
 				    if (tileSetPanelVisible())
 				    {
 					tileSetPanelOnMouseDown(mouse, mouseButton);
 				    }
 
-				    if (tileMapPanelVisible())
+				    if (tileMapPanelVisible() &&
+					!minimapPanelOnMouseDown(mouse, mouseButton))
 				    {
 					tileMapPanelOnMouseDown(mouse, mouseButton);
 				    }
@@ -482,7 +586,7 @@ int main(int argc, char* argv[])
 				if (ui_wasClicked(cancelButton, mouse))
 				{
 				    openTileSheetPanel.visible = false;
-				    //TODO(denis): cancel the opening of the tile map
+				    closeTileMapView(&loadedTileMapView);
 				}
 				else if (ui_wasClicked(openButton, mouse))
 				{
@@ -490,28 +594,33 @@ int main(int argc, char* argv[])
 				    
 				    if (!stringsEqual(tileSheetNameText.string, "No tile sheet found"))
 				    {
-					uint32 tileMapHeight = loadedTileMapData.tileMapHeight;
-					uint32 tileMapWidth = loadedTileMapData.tileMapWidth;
-					
-					TileMapTile *tileMapTiles = (TileMapTile*)HEAP_ALLOC(tileMapWidth*tileMapHeight*sizeof(TileMapTile));
-
-					assert(tileMapTiles);
-					for (uint32 i = 0; i < tileMapHeight; ++i)
+					//NOTE(denis): the tiles aren't copied here, the panel
+					// keeps the file mapped and copies them as they are used.
+					// the map and the tile set each free their own name
+					char *mapTileSetName = duplicateString(tileSheetNameText.string);
+					TileMapHandle handle = tileMapPanelAddMappedTileMap(&loadedTileMapView,
+											    mapTileSetName);
+					TileMap *tileMap = tileMapPanelGetTileMap(handle);
+					if (tileMap)
 					{
-					    for (uint32 j = 0; j < tileMapWidth; ++j)
+					    uint32 tileSize = tileMap->tileSize;
+					    addTileMapToMenuBar(&topMenuBar.menus[1], handle);
+
+					    if (!tileSetPanelInitializeNewTileSet(tileSheetNameText.string,
+										  loadedTileSet, tileSize))
 					    {
-						(tileMapTiles + i*tileMapWidth + j)->tile = *(loadedTileMapData.tiles + i*tileMapWidth + j);
-						(tileMapTiles + i*tileMapWidth + j)->initialized = true;
+						warning = "couldn't add the tile set";
+						SDL_FreeSurface(loadedTileSet);
 					    }
 					}
-
-					HEAP_FREE(loadedTileMapData.tiles);
-					
-					TileMap *tileMap = tileMapPanelAddTileMap(tileMapTiles, loadedTileMapData.tileMapName, tileMapWidth, tileMapHeight, loadedTileMapData.tileSize,
-										  tileSheetNameText.string);
-					addTileMapToMenuBar(&topMenuBar.menus[1], tileMap->name);
-
-					tileSetPanelInitializeNewTileSet(tileSheetNameText.string, loadedTileSet, tileMap->tileSize);
+					else
+					{
+					    //NOTE(denis): the panel didn't take the view, it
+					    // has to be let go of here
+					    warning = "couldn't open the tile map";
+					    closeTileMapView(&loadedTileMapView);
+					    HEAP_FREE(mapTileSetName);
+					}
 
 					openTileSheetPanel.visible = false;
 				    }
@@ -556,7 +665,7 @@ int main(int argc, char* argv[])
 			    }
 			    else if (topMenuBar.onMouseUp(mouse, event.button.button))
 			    {
-				topMenuOpenDelay = 0;
+				topMenuClosedTicks = SDL_GetTicks();
 				
 				//TODO(denis): need better solution
 				tileSetPanelOnMouseUp({0,0}, mouseButton);
@@ -576,16 +685,17 @@ int main(int argc, char* argv[])
 				    else if (selectionY == 2)
 				    {
 					//NOTE(denis): 2 == "open tile map file"
-					loadedTileMapData = loadTileMapFromFile();
+					closeTileMapView(&loadedTileMapView);
+					loadedTileMapView = openTileMapFromFile();
 
-					if (loadedTileMapData.tileMapName)
+					if (loadedTileMapView.mappedMemory)
 					{
 					    //TODO(denis): need to free
 					    char *tileSheetFullPath = 0;
 					
 					    if (tileSheetDirectory)
 					    {
-						tileSheetFullPath = concatStrings(tileSheetDirectory, loadedTileMapData.tileSheetFileName);
+						tileSheetFullPath = concatStrings(tileSheetDirectory, loadedTileMapView.tileSheetFileName);
 						loadedTileSet = loadImageAsSurface(tileSheetFullPath);
 					    }
 
@@ -607,7 +717,8 @@ int main(int argc, char* argv[])
 						char *lastModifiedString = createLastModifiedString(tileSheetFullPath);
 						ui_setText(&lastModifiedText, lastModifiedString);
 
-						ui_setText(&tileSheetNameText, loadedTileMapData.tileSheetFileName);
+						//NOTE(denis): the view's string lives in the mapped file
+						ui_setText(&tileSheetNameText, duplicateString(loadedTileMapView.tileSheetFileName));
 					    }
 					}
 				    }
@@ -648,20 +759,12 @@ int main(int argc, char* argv[])
 					     topMenuBar.menus[1].itemCount > 2)
 				    {
 					//NOTE(denis): close tile map
-					uint32 selectedTileMap = tileMapPanelGetCurrentTileMapIndex();
-					topMenuBar.menus[1].removeItem(selectedTileMap+1);
-
-					tileMapPanelRemoveTileMap(selectedTileMap);
-
-					if (!tileMapPanelGetCurrentTileMap()->tiles)
-					{
-					    //NOTE(denis): remove "close tile map" from the menu
-					    topMenuBar.menus[1].removeItem(1);
-					}
+					closeSelectedTileMap(&topMenuBar.menus[1]);
 				    }
-				    else if (selectionY != 0)
+				    else if (selectionY != 0 &&
+					     selectionY-1 < (uint32)_numMenuTileMaps)
 				    {
-					tileMapPanelSelectTileMap(selectionY-1);
+					tileMapPanelSelectTileMap(_menuTileMaps[selectionY-1]);
 				    }
 				    else if (selectionY == 0)
 				    {
@@ -672,7 +775,7 @@ int main(int argc, char* argv[])
 			    else if (tileSetPanelVisible() || tileMapPanelVisible())
 			    {
 				if (!topMenuBar.isOpen() &&
-				    topMenuOpenDelay > DELAY_THRESHOLD)
+				    topMenuReady)
 				{
 				    if (tileSetPanelVisible())
 				    {
@@ -684,12 +787,32 @@ int main(int argc, char* argv[])
 			    
 				    if (tileMapPanelVisible())
 				    {
+					//NOTE(denis): a click in the minimap shouldn't
+					// finish a fill on the map under it, the map
+					// still gets the mouse up to end a paint stroke
+					// dragged onto it
+					if (minimapPanelOnMouseUp(mouse, mouseButton))
+					    tileMapPanelForgetFillStart();
 					tileMapPanelOnMouseUp(mouse, mouseButton);
 				    }
 				}
 			    }
 			} break;
 
+			case SDL_MOUSEWHEEL:
+			{
+			    //NOTE(denis): wheel events don't say where the mouse is
+			    Vector2 mouse = {};
+			    SDL_GetMouseState(&mouse.x, &mouse.y);
+
+			    if (!openTileSheetPanel.visible && !importTileSetPanelVisible() &&
+				!newTileMapPanelVisible() && !topMenuBar.isOpen() &&
+				tileMapPanelVisible())
+			    {
+				tileMapPanelOnMouseWheel(mouse, event.wheel.y);
+			    }
+			} break;
+
 			case SDL_TEXTINPUT:
 			{
 			    char* theText = event.text.text;
@@ -724,6 +847,26 @@ int main(int argc, char* argv[])
 			    {
 				tileMapPanelOnKeyPressed(SDLK_SPACE);
 			    }
+
+			    SDL_Keymod mod = SDL_GetModState();
+			    if ((mod & KMOD_CTRL) && tileMapPanelVisible() &&
+				!newTileMapPanelVisible() && !importTileSetPanelVisible())
+			    {
+				//NOTE(denis): ctrl+shift+z redoes too
+				if (event.key.keysym.sym == SDLK_z && !(mod & KMOD_SHIFT))
+				    tileMapPanelUndo();
+				else if (event.key.keysym.sym == SDLK_y || event.key.keysym.sym == SDLK_z)
+				    tileMapPanelRedo();
+			    }
+
+			    if (event.key.keysym.sym == SDLK_F3)
+			    {
+				profilerToggleOverlay();
+			    }
+			    else if (event.key.keysym.sym == SDLK_F4)
+			    {
+				profilerWriteCSV("profile.csv");
+			    }
 			    
 			} break;
 
@@ -747,41 +890,95 @@ int main(int argc, char* argv[])
 				if (newTileMapPanelVisible())
 				    newTileMapPanelEnterPressed();
 			    }
+			    else if (event.key.keysym.sym == SDLK_n)
+			    {
+				if (!newTileMapPanelVisible() && !importTileSetPanelVisible())
+				    minimapPanelSetVisible(!minimapPanelVisible());
+			    }
 
 			    tileMapPanelOnKeyReleased(event.key.keysym.sym);
 			} break;
 		    }
 		}
 
-		if (topMenuOpenDelay <= DELAY_THRESHOLD)
-		    ++topMenuOpenDelay;
-		
-		SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOUR);
-		SDL_RenderClear(renderer);
+		profilerEndSection(PROFILE_EVENTS);
+
+		//NOTE(denis): saving happens on another thread, the title bar shows
+		// how far along it is
+		SaveProgress saveProgress = pollTileMapSave();
+		if (saveProgress.inProgress && saveProgress.percentDone != lastSavePercent)
+		{
+		    lastSavePercent = saveProgress.percentDone;
+
+		    char *percentString = lastSavePercent > 0 ?
+			convertIntToString(lastSavePercent) : duplicateString("0");
+		    char *partialTitle = concatStrings(TITLE " - Saving ", percentString);
+		    char *newTitle = concatStrings(partialTitle, "%");
+		    SDL_SetWindowTitle(window, newTitle);
+
+		    HEAP_FREE(percentString);
+		    HEAP_FREE(partialTitle);
+		    HEAP_FREE(newTitle);
+		}
+		else if (saveProgress.finished && !saveProgress.succeeded)
+		{
+		    lastSavePercent = -1;
+		    SDL_SetWindowTitle(window, TITLE " - Save failed!");
+		}
+		else if (!saveProgress.inProgress && lastSavePercent != -1)
+		{
+		    lastSavePercent = -1;
+		    SDL_SetWindowTitle(window, TITLE);
+		}
 
+		tileSetPanelUpdateImport();
+		
 		if (newTileMapPanelVisible())
 		{   
 		    if (newTileMapPanelDataReady())
 		    {
-			TileMap *tileMap = tileMapPanelCreateNewTileMap();
+			TileMapHandle tileMap = tileMapPanelCreateNewTileMap();
 
-			addTileMapToMenuBar(&topMenuBar.menus[1], tileMap->name);
+			addTileMapToMenuBar(&topMenuBar.menus[1], tileMap);
 		    }
 		}
 
-		tileSetPanelDraw();
-		tileMapPanelDraw();    
+		//NOTE(denis): the back buffer isn't kept between presents, so when
+		// anything changed the whole window is drawn again
+		bool drawingFrame = ui_redrawNeeded();
+		if (drawingFrame)
+		{
+		    ui_redrawStarted();
+		    
+		    SDL_SetRenderDrawColor(renderer, BACKGROUND_COLOUR);
+		    SDL_RenderClear(renderer);
+
+		    tileSetPanelDraw();
+		    tileMapPanelDraw();    
+		    minimapPanelDraw();
 
-		newTileMapPanelDraw();
-		importTileSetPanelDraw();
+		    profilerBeginSection(PROFILE_UI_DRAW);
+		    newTileMapPanelDraw();
+		    importTileSetPanelDraw();
 
-		ui_draw(&openTileSheetPanel);
+		    ui_draw(&openTileSheetPanel);
 		
-		ui_draw(&topMenuBar);
+		    ui_draw(&topMenuBar);
+		    profilerEndSection(PROFILE_UI_DRAW);
+
+		    profilerDrawOverlay(renderer);
 	
-		SDL_RenderPresent(renderer);
+		    profilerBeginSection(PROFILE_PRESENT);
+		    SDL_RenderPresent(renderer);
+		    profilerEndSection(PROFILE_PRESENT);
+		}
+
+		profilerEndFrame(drawingFrame);
 	    }
 
+	    tileSetPanelFinishImport();
+	    waitForTileMapSave();
+	    stopTileMapPrefetching();
 	    IMG_Quit();
 	}
 	
@@ -6,6 +6,7 @@
 
 #include "SDL_rect.h"
 #include "SDL_render.h"
+#include "profiler.h"
 #undef max
 #include "denis_meta.h"
 #include "denis_math.h"
@@ -22,6 +23,9 @@ struct Tile
     Point2 sheetPos;
 };
 
+//NOTE(denis): enough for tiles up to 32768 pixels across
+#define MAX_TILE_SET_MIPS 16
+
 struct TileSet
 {
     char *name;
@@ -36,6 +40,20 @@ struct TileSet
     uint32 numTiles;
 
     Tile selectedTile;
+
+    //NOTE(denis): mips[0] is image, every level after it has each tile at half
+    // the size it is in the level before, down to one pixel a tile. the tiles
+    // stay in the same grid as on the sheet
+    SDL_Texture *mips[MAX_TILE_SET_MIPS];
+    uint32 numMips;
+    //NOTE(denis): the average colour of every tile on the sheet as ARGB, a row
+    // of the sheet's grid at a time. 0 if it couldn't be made
+    uint32 *tileColours;
+    uint32 widthInTiles;
+    //NOTE(denis): for every cell of the sheet, the cell of the first tile with
+    // exactly the same pixels, which is itself if there is none before it. only
+    // the first of each is in tiles. 0 if the sheet has no duplicates
+    uint32 *canonicalTiles;
 };
 
 //TODO(denis): not sure where to put this
@@ -62,4 +80,75 @@ static inline void drawTile(SDL_Renderer *renderer, SDL_Texture *tileSheet,
     SDL_RenderCopy(renderer, tileSheet, &sheetRect, &screenRect);
 }
 
+static inline uint32 getTileMipSize(uint32 tileSize, uint32 mipLevel)
+{
+    return MAX(tileSize >> mipLevel, 1);
+}
+
+//NOTE(denis): where a tile at sheetPos on the full size sheet is in a mip level
+static inline SDL_Rect getTileMipRect(int32 tileSize, uint32 mipLevel, Point2 sheetPos)
+{
+    int32 mipSize = (int32)getTileMipSize(tileSize, mipLevel);
+    SDL_Rect result = {sheetPos.x/tileSize*mipSize, sheetPos.y/tileSize*mipSize,
+		       mipSize, mipSize};
+
+    return result;
+}
+
+//NOTE(denis): false for positions that aren't a tile on this sheet, maps can
+// have those if the sheet was cropped, a different one was picked or the file
+// is bad. cells are counted a row of the sheet's grid at a time
+static inline bool getSheetCell(TileSet *tileSet, Point2 sheetPos, uint32 *cell)
+{
+    bool result = false;
+
+    int32 tileSize = (int32)tileSet->tileSize;
+    if (tileSize > 0)
+    {
+	int32 widthInTiles = tileSet->imageSize.w/tileSize;
+	int32 heightInTiles = tileSet->imageSize.h/tileSize;
+	int32 cellX = sheetPos.x/tileSize;
+	int32 cellY = sheetPos.y/tileSize;
+
+	result = sheetPos.x >= 0 && sheetPos.y >= 0 &&
+	    sheetPos.x%tileSize == 0 && sheetPos.y%tileSize == 0 &&
+	    cellX < widthInTiles && cellY < heightInTiles;
+	if (result)
+	    *cell = (uint32)(cellY*widthInTiles + cellX);
+    }
+
+    return result;
+}
+
+//NOTE(denis): maps can still have tiles that are duplicates of another tile on
+// the sheet, this is where the one that was kept is
+static inline Point2 getCanonicalSheetPos(TileSet *tileSet, Point2 sheetPos)
+{
+    Point2 result = sheetPos;
+
+    uint32 cell;
+    if (tileSet->canonicalTiles && getSheetCell(tileSet, sheetPos, &cell))
+    {
+	int32 tileSize = (int32)tileSet->tileSize;
+	uint32 widthInTiles = tileSet->imageSize.w/tileSize;
+	uint32 canonicalCell = tileSet->canonicalTiles[cell];
+	result.x = (int32)(canonicalCell%widthInTiles)*tileSize;
+	result.y = (int32)(canonicalCell/widthInTiles)*tileSize;
+    }
+
+    return result;
+}
+
+//NOTE(denis): emptyColour for tiles that aren't on the sheet
+static inline uint32 getTileColour(TileSet *tileSet, Point2 sheetPos, uint32 emptyColour)
+{
+    uint32 result = emptyColour;
+
+    uint32 cell;
+    if (getSheetCell(tileSet, sheetPos, &cell))
+	result = tileSet->tileColours[cell];
+
+    return result;
+}
+
 #endif
@@ -0,0 +1,270 @@
+#include "ui_elements.h"
+#include "main.h"
+#include "tile_set_panel.h"
+#include "tile_map_panel.h"
+#include "minimap_panel.h"
+#include "TEMP_GeneralFunctions.cpp"
+
+#define PADDING 5
+
+#define PANEL_COLOUR 0xFF222222
+#define EMPTY_TILE_COLOUR 0xFF808080
+#define VIEW_OUTLINE_COLOUR 255, 255, 255, 255
+
+//NOTE(denis): maps bigger than this are shown at a texel for every few tiles
+// in each direction, the texel is the colour of the first of them
+#define MAX_MINIMAP_TEXTURE_SIZE 2048
+
+static SDL_Renderer *_renderer;
+
+static UIPanel _panel;
+static SDL_Rect _mapArea;
+
+//NOTE(denis): the texture is only made from scratch when a different map is
+// selected or its tile set changes, after that only the tiles the map says
+// changed are drawn into it again
+static SDL_Texture *_texture;
+static int32 _textureWidth;
+static int32 _textureHeight;
+static int32 _tilesPerTexel;
+static TileMapHandle _shownMap;
+static uint32 *_shownColours;
+
+//NOTE(denis): where the texture is drawn inside _mapArea, it keeps the map's shape
+static SDL_Rect _textureRect;
+
+static bool _dragging;
+//NOTE(denis): a bit for every button that went down in the minimap, so
+// letting go of it doesn't land on the map under it
+static uint32 _pressedButtons;
+
+void minimapPanelCreateNew(SDL_Renderer *renderer, int32 x, int32 y,
+			   int32 width, int32 height)
+{
+    _renderer = renderer;
+
+    _panel = ui_createPanel(x, y, width, height, PANEL_COLOUR);
+
+    _mapArea.x = x + PADDING;
+    _mapArea.y = y + PADDING;
+    _mapArea.w = width - PADDING*2;
+    _mapArea.h = height - PADDING*2;
+}
+
+//NOTE(denis): the same tile set the tile map panel draws the map with
+static TileSet* getTileSet(TileMap *tileMap)
+{
+    TileSet *result = 0;
+
+    if (tileMap->tileSetName)
+	result = tileSetPanelGetTileSetByName(tileMap->tileSetName);
+    else
+	result = tileSetPanelGetCurrentTileSet();
+
+    return result;
+}
+
+//NOTE(denis): the rectangle is in texels
+static void drawTexels(TileMap *tileMap, TileSet *tileSet, SDL_Rect texels)
+{
+    void *pixels;
+    int32 pitch;
+    if (SDL_LockTexture(_texture, &texels, &pixels, &pitch) == 0)
+    {
+	for (int32 i = 0; i < texels.h; ++i)
+	{
+	    uint32 *row = (uint32*)((uint8*)pixels + i*pitch);
+	    int32 tileY = (texels.y + i)*_tilesPerTexel;
+
+	    for (int32 j = 0; j < texels.w; ++j)
+	    {
+		int32 tileX = (texels.x + j)*_tilesPerTexel;
+
+		Point2 sheetPos;
+		uint32 colour = EMPTY_TILE_COLOUR;
+		if (tileSet && tileSet->tileColours && tileMap->peekTile(tileX, tileY, &sheetPos))
+		    colour = getTileColour(tileSet, sheetPos, EMPTY_TILE_COLOUR);
+
+		row[j] = colour;
+	    }
+	}
+
+	SDL_UnlockTexture(_texture);
+    }
+}
+
+static bool remakeTexture(TileMap *tileMap)
+{
+    _tilesPerTexel = 1;
+    while ((tileMap->widthInTiles + _tilesPerTexel-1)/_tilesPerTexel > MAX_MINIMAP_TEXTURE_SIZE ||
+	   (tileMap->heightInTiles + _tilesPerTexel-1)/_tilesPerTexel > MAX_MINIMAP_TEXTURE_SIZE)
+    {
+	++_tilesPerTexel;
+    }
+
+    int32 width = (tileMap->widthInTiles + _tilesPerTexel-1)/_tilesPerTexel;
+    int32 height = (tileMap->heightInTiles + _tilesPerTexel-1)/_tilesPerTexel;
+
+    if (_texture && (_textureWidth != width || _textureHeight != height))
+    {
+	SDL_DestroyTexture(_texture);
+	_texture = 0;
+    }
+
+    if (!_texture)
+    {
+	_texture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888,
+				     SDL_TEXTUREACCESS_STREAMING, width, height);
+	if (!_texture)
+	    return false;
+
+	SDL_SetTextureBlendMode(_texture, SDL_BLENDMODE_BLEND);
+	_textureWidth = width;
+	_textureHeight = height;
+    }
+
+    real32 scale = MIN((real32)_mapArea.w/width, (real32)_mapArea.h/height);
+    _textureRect.w = MAX((int32)(width*scale), 1);
+    _textureRect.h = MAX((int32)(height*scale), 1);
+    _textureRect.x = _mapArea.x + (_mapArea.w - _textureRect.w)/2;
+    _textureRect.y = _mapArea.y + (_mapArea.h - _textureRect.h)/2;
+
+    return true;
+}
+
+//NOTE(denis): returns false if there is nothing to show
+static bool updateTexture(TileMap *tileMap, TileMapHandle handle)
+{
+    TileSet *tileSet = getTileSet(tileMap);
+    uint32 *tileColours = tileSet ? tileSet->tileColours : 0;
+
+    bool sameMap = _texture && _shownMap.slot == handle.slot &&
+	_shownMap.generation == handle.generation && _shownColours == tileColours;
+
+    if (!sameMap)
+    {
+	if (!remakeTexture(tileMap))
+	    return false;
+
+	SDL_Rect everything = {0, 0, _textureWidth, _textureHeight};
+	drawTexels(tileMap, tileSet, everything);
+
+	_shownMap = handle;
+	_shownColours = tileColours;
+    }
+    else
+    {
+	//NOTE(denis): only the texels the changed tiles are in
+	for (uint32 i = 0; i < tileMap->changedTiles.numRects; ++i)
+	{
+	    SDL_Rect tiles = tileMap->changedTiles.rects[i];
+	    int32 firstX = tiles.x/_tilesPerTexel;
+	    int32 firstY = tiles.y/_tilesPerTexel;
+	    int32 lastX = (tiles.x + tiles.w - 1)/_tilesPerTexel;
+	    int32 lastY = (tiles.y + tiles.h - 1)/_tilesPerTexel;
+
+	    SDL_Rect texels = {firstX, firstY, lastX - firstX + 1, lastY - firstY + 1};
+	    drawTexels(tileMap, tileSet, texels);
+	}
+    }
+
+    tileMap->changedTiles.numRects = 0;
+
+    return true;
+}
+
+void minimapPanelDraw()
+{
+    TileMap *tileMap = tileMapPanelGetCurrentTileMap();
+
+    if (_panel.visible && tileMapPanelVisible() && tileMap->pages.table &&
+	tileMap->widthInTiles != 0 && tileMap->heightInTiles != 0 &&
+	updateTexture(tileMap, tileMapPanelGetCurrentTileMapHandle()))
+    {
+	ui_draw(&_panel);
+	SDL_RenderCopy(_renderer, _texture, NULL, &_textureRect);
+
+	//NOTE(denis): the part of the map that can be seen in the tile map panel
+	real64 texelsPerPixel = 1.0/(tileMap->getViewTileSize()*_tilesPerTexel);
+	real64 scale = (real64)_textureRect.w/_textureWidth;
+
+	SDL_Rect view = {};
+	view.x = _textureRect.x + (int32)(tileMap->drawOffset.x*texelsPerPixel*scale);
+	view.y = _textureRect.y + (int32)(tileMap->drawOffset.y*texelsPerPixel*scale);
+	view.w = MAX((int32)(tileMap->visibleArea.w*texelsPerPixel*scale), 1);
+	view.h = MAX((int32)(tileMap->visibleArea.h*texelsPerPixel*scale), 1);
+
+	uint8 r, g, b, a;
+	SDL_GetRenderDrawColor(_renderer, &r, &g, &b, &a);
+	SDL_SetRenderDrawColor(_renderer, VIEW_OUTLINE_COLOUR);
+	SDL_RenderDrawRect(_renderer, &view);
+	SDL_SetRenderDrawColor(_renderer, r, g, b, a);
+    }
+}
+
+static void scrollMapToMouse(Vector2 mousePos)
+{
+    real64 tilesPerPixel = (real64)_textureWidth*_tilesPerTexel/_textureRect.w;
+
+    int32 tileX = (int32)((mousePos.x - _textureRect.x)*tilesPerPixel);
+    int32 tileY = (int32)((mousePos.y - _textureRect.y)*tilesPerPixel);
+
+    tileMapPanelCentreOnTile(tileX, tileY);
+}
+
+//NOTE(denis): only true while it is being drawn
+static bool minimapShown()
+{
+    TileMap *tileMap = tileMapPanelGetCurrentTileMap();
+
+    return _panel.visible && tileMapPanelVisible() && tileMap->pages.table && _texture;
+}
+
+bool minimapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
+{
+    if (_dragging && leftClickFlag && minimapShown())
+	scrollMapToMouse(mousePos);
+    else
+	_dragging = false;
+
+    return _dragging;
+}
+
+bool minimapPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton)
+{
+    bool result = minimapShown() && pointInRect(mousePos, _panel.panel.pos);
+
+    if (result)
+	_pressedButtons |= SDL_BUTTON(mouseButton);
+
+    if (result && mouseButton == SDL_BUTTON_LEFT && pointInRect(mousePos, _textureRect))
+    {
+	_dragging = true;
+	scrollMapToMouse(mousePos);
+    }
+
+    return result;
+}
+
+bool minimapPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
+{
+    if (mouseButton == SDL_BUTTON_LEFT)
+	_dragging = false;
+
+    bool result = (_pressedButtons & SDL_BUTTON(mouseButton)) != 0;
+    _pressedButtons &= ~SDL_BUTTON(mouseButton);
+
+    return result;
+}
+
+bool minimapPanelVisible()
+{
+    return _panel.visible;
+}
+
+void minimapPanelSetVisible(bool newValue)
+{
+    _panel.visible = newValue;
+    _dragging = false;
+    ui_requestRedraw();
+}
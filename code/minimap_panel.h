@@ -0,0 +1,23 @@
+#ifndef MINIMAP_PANEL_H_
+#define MINIMAP_PANEL_H_
+
+#include "denis_meta.h"
+
+//NOTE(denis): shows the whole selected tile map at a texel a tile, each one
+// the average colour of its tile. clicking or dragging in it scrolls the map
+void minimapPanelCreateNew(SDL_Renderer *renderer, int32 x, int32 y,
+			   int32 width, int32 height);
+
+void minimapPanelDraw();
+
+//NOTE(denis): these return true if the minimap used the mouse, then the
+// panels under it should leave it alone
+bool minimapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag);
+bool minimapPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton);
+//NOTE(denis): true if the button was pressed down in the minimap
+bool minimapPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton);
+
+bool minimapPanelVisible();
+void minimapPanelSetVisible(bool newValue);
+
+#endif
@@ -0,0 +1,345 @@
+#include "profiler.h"
+#include "ui_elements.h"
+#include "tile_map_file.h"
+#include "SDL_timer.h"
+
+//NOTE(denis): this file is the one place that calls the real thing
+#undef SDL_RenderCopy
+
+#define PROFILE_HISTORY_SIZE 512
+#define OVERLAY_X 10
+#define OVERLAY_Y 40
+#define OVERLAY_WIDTH 330
+#define OVERLAY_LINE_HEIGHT 18
+#define OVERLAY_TEXT_COLOUR 0xFFFFFFFF
+#define MAX_LINE_LENGTH 128
+#define MAX_OVERLAY_LINES (PROFILE_SECTION_COUNT + 4)
+//NOTE(denis): the numbers can't be read any faster than this anyway
+#define OVERLAY_UPDATES_PER_SECOND 4
+
+struct ProfileFrame
+{
+    uint64 frameTicks;
+    uint32 renderCopies;
+
+    uint64 sectionTicks[PROFILE_SECTION_COUNT];
+    uint32 sectionCalls[PROFILE_SECTION_COUNT];
+};
+
+static char *_sectionNames[PROFILE_SECTION_COUNT] =
+{
+    "events",
+    "tile map input",
+    "tile set input",
+    "tile map draw",
+    "chunk bake",
+    "tile set draw",
+    "ui draw",
+    "present"
+};
+
+static ProfileFrame _history[PROFILE_HISTORY_SIZE];
+static uint32 _numFramesKept;
+
+static ProfileFrame _currentFrame;
+static uint64 _frameStart;
+static uint64 _sectionStarts[PROFILE_SECTION_COUNT];
+
+static bool _overlayVisible;
+//NOTE(denis): the text is only made again a few times a second, making it
+// every frame cost more than everything it was measuring
+static TexturedRect _overlayLines[MAX_OVERLAY_LINES];
+static int32 _numOverlayLines;
+static uint64 _overlayBuiltAt;
+static bool _overlayBuilt;
+//NOTE(denis): time spent on the overlay this frame, left out of the frame time
+static uint64 _overlayTicks;
+
+#if defined(PROFILE_ALLOCATIONS)
+volatile AllocationCount _numHeapAllocations;
+#endif
+
+void profilerBeginSection(ProfileSection section)
+{
+    _sectionStarts[section] = SDL_GetPerformanceCounter();
+}
+
+void profilerEndSection(ProfileSection section)
+{
+    _currentFrame.sectionTicks[section] += SDL_GetPerformanceCounter() - _sectionStarts[section];
+    ++_currentFrame.sectionCalls[section];
+}
+
+void profilerBeginFrame()
+{
+    _currentFrame = {};
+    _overlayTicks = 0;
+    _frameStart = SDL_GetPerformanceCounter();
+}
+
+void profilerEndFrame(bool drewFrame)
+{
+    if (drewFrame)
+    {
+	_currentFrame.frameTicks = SDL_GetPerformanceCounter() - _frameStart - _overlayTicks;
+	_history[_numFramesKept % PROFILE_HISTORY_SIZE] = _currentFrame;
+	++_numFramesKept;
+    }
+}
+
+int profileRenderCopy(SDL_Renderer *renderer, SDL_Texture *texture,
+		      const SDL_Rect *source, const SDL_Rect *dest)
+{
+    ++_currentFrame.renderCopies;
+    return SDL_RenderCopy(renderer, texture, source, dest);
+}
+
+uint32 profilerGetLastFrameRenderCopies()
+{
+    uint32 result = 0;
+
+    if (_numFramesKept > 0)
+	result = _history[(_numFramesKept-1) % PROFILE_HISTORY_SIZE].renderCopies;
+
+    return result;
+}
+
+uint32 profilerGetNumAllocations()
+{
+#if defined(PROFILE_ALLOCATIONS)
+    return (uint32)_numHeapAllocations;
+#else
+    return 0;
+#endif
+}
+
+static void deleteOverlayLines()
+{
+    for (int32 i = 0; i < _numOverlayLines; ++i)
+    {
+	ui_delete(_overlayLines + i);
+    }
+    _numOverlayLines = 0;
+    _overlayBuilt = false;
+}
+
+void profilerToggleOverlay()
+{
+    _overlayVisible = !_overlayVisible;
+
+    if (!_overlayVisible)
+	deleteOverlayLines();
+}
+
+static inline uint64 ticksToMicroseconds(uint64 ticks)
+{
+    return ticks*1000000/SDL_GetPerformanceFrequency();
+}
+
+//NOTE(denis): returns where the string ends so more can be appended
+static char* appendText(char *line, char *text)
+{
+    while (*text)
+    {
+	*line++ = *text++;
+    }
+    *line = 0;
+
+    return line;
+}
+
+static char* appendNumber(char *line, uint64 number)
+{
+    char digits[20];
+    int32 numDigits = 0;
+
+    do
+    {
+	digits[numDigits++] = (char)('0' + number % 10);
+	number /= 10;
+    } while (number > 0);
+
+    while (numDigits > 0)
+    {
+	*line++ = digits[--numDigits];
+    }
+    *line = 0;
+
+    return line;
+}
+
+//NOTE(denis): spaces become underscores so the names work as column headers
+static char* appendColumnName(char *line, char *name)
+{
+    while (*name)
+    {
+	*line++ = *name == ' ' ? '_' : *name;
+	++name;
+    }
+    *line = 0;
+
+    return line;
+}
+
+static uint32 getNumFramesInHistory()
+{
+    return MIN(_numFramesKept, PROFILE_HISTORY_SIZE);
+}
+
+//NOTE(denis): percent is 0 to 100
+static uint64 getFrameTimePercentile(uint64 *sortedTimes, uint32 numTimes, uint32 percent)
+{
+    uint32 index = (numTimes-1)*percent/100;
+    return sortedTimes[index];
+}
+
+static void addOverlayLine(char *line, int32 lineNumber)
+{
+    if (_numOverlayLines < MAX_OVERLAY_LINES)
+    {
+	TexturedRect text = ui_createTextField(line, OVERLAY_X + 5,
+					       OVERLAY_Y + 5 + lineNumber*OVERLAY_LINE_HEIGHT,
+					       OVERLAY_TEXT_COLOUR);
+	if (text.image)
+	    _overlayLines[_numOverlayLines++] = text;
+    }
+}
+
+static void buildOverlayLines()
+{
+    deleteOverlayLines();
+    _overlayBuilt = true;
+
+    uint32 numFrames = getNumFramesInHistory();
+
+    char line[MAX_LINE_LENGTH];
+    int32 lineNumber = 0;
+
+    if (numFrames == 0)
+    {
+	addOverlayLine("no frames yet", lineNumber);
+	return;
+    }
+
+    //NOTE(denis): frame times sorted smallest to largest for the percentiles
+    uint64 sortedTimes[PROFILE_HISTORY_SIZE];
+    for (uint32 i = 0; i < numFrames; ++i)
+    {
+	uint64 time = _history[i].frameTicks;
+
+	uint32 j = i;
+	for (; j > 0 && sortedTimes[j-1] > time; --j)
+	{
+	    sortedTimes[j] = sortedTimes[j-1];
+	}
+	sortedTimes[j] = time;
+    }
+
+    char *end = appendText(line, "frame us  p50 ");
+    end = appendNumber(end, ticksToMicroseconds(getFrameTimePercentile(sortedTimes, numFrames, 50)));
+    end = appendText(end, "  p90 ");
+    end = appendNumber(end, ticksToMicroseconds(getFrameTimePercentile(sortedTimes, numFrames, 90)));
+    end = appendText(end, "  p99 ");
+    end = appendNumber(end, ticksToMicroseconds(getFrameTimePercentile(sortedTimes, numFrames, 99)));
+    addOverlayLine(line, lineNumber++);
+
+    ProfileFrame *lastFrame = _history + (_numFramesKept-1) % PROFILE_HISTORY_SIZE;
+    end = appendText(line, "render copies  ");
+    end = appendNumber(end, lastFrame->renderCopies);
+    addOverlayLine(line, lineNumber++);
+
+    //NOTE(denis): section times are the average per frame over the whole history
+    for (int32 section = 0; section < PROFILE_SECTION_COUNT; ++section)
+    {
+	uint64 totalTicks = 0;
+	uint64 totalCalls = 0;
+	for (uint32 i = 0; i < numFrames; ++i)
+	{
+	    totalTicks += _history[i].sectionTicks[section];
+	    totalCalls += _history[i].sectionCalls[section];
+	}
+
+	end = appendText(line, _sectionNames[section]);
+	end = appendText(end, "  ");
+	end = appendNumber(end, ticksToMicroseconds(totalTicks/numFrames));
+	end = appendText(end, " us  ");
+	end = appendNumber(end, totalCalls/numFrames);
+	end = appendText(end, " calls");
+	addOverlayLine(line, lineNumber++);
+    }
+
+    addOverlayLine("F3 hide  F4 save profile.csv", ++lineNumber);
+}
+
+void profilerDrawOverlay(SDL_Renderer *renderer)
+{
+    if (!_overlayVisible)
+	return;
+
+    ui_requestRedraw();
+
+    uint64 start = SDL_GetPerformanceCounter();
+
+    if (!_overlayBuilt ||
+	start - _overlayBuiltAt >= SDL_GetPerformanceFrequency()/OVERLAY_UPDATES_PER_SECOND)
+    {
+	buildOverlayLines();
+	_overlayBuiltAt = start;
+    }
+
+    SDL_Rect background = {OVERLAY_X, OVERLAY_Y, OVERLAY_WIDTH,
+			   MAX_OVERLAY_LINES*OVERLAY_LINE_HEIGHT + 10};
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(renderer, &background);
+
+    //NOTE(denis): the real SDL_RenderCopy, so the overlay isn't in the render
+    // copies it reports
+    for (int32 i = 0; i < _numOverlayLines; ++i)
+    {
+	SDL_RenderCopy(renderer, _overlayLines[i].image, NULL, &_overlayLines[i].pos);
+    }
+
+    _overlayTicks += SDL_GetPerformanceCounter() - start;
+}
+
+bool profilerWriteCSV(char *fileName)
+{
+    TileMapFileWriter writer = {};
+    beginTileMapFile(&writer, fileName);
+
+    char line[MAX_LINE_LENGTH*2];
+
+    char *end = appendText(line, "frame,frame_us,render_copies");
+    for (int32 section = 0; section < PROFILE_SECTION_COUNT; ++section)
+    {
+	end = appendText(end, ",");
+	end = appendColumnName(end, _sectionNames[section]);
+	end = appendText(end, "_us");
+    }
+    end = appendText(end, "\n");
+    writeToTileMapFile(&writer, line, (uint32)(end - line));
+
+    //NOTE(denis): oldest frame first
+    uint32 numFrames = getNumFramesInHistory();
+    uint32 firstFrame = _numFramesKept - numFrames;
+    for (uint32 i = firstFrame; i < _numFramesKept; ++i)
+    {
+	ProfileFrame *frame = _history + i % PROFILE_HISTORY_SIZE;
+
+	end = appendNumber(line, i);
+	end = appendText(end, ",");
+	end = appendNumber(end, ticksToMicroseconds(frame->frameTicks));
+	end = appendText(end, ",");
+	end = appendNumber(end, frame->renderCopies);
+	for (int32 section = 0; section < PROFILE_SECTION_COUNT; ++section)
+	{
+	    end = appendText(end, ",");
+	    end = appendNumber(end, ticksToMicroseconds(frame->sectionTicks[section]));
+	}
+	end = appendText(end, "\n");
+
+	writeToTileMapFile(&writer, line, (uint32)(end - line));
+    }
+
+    return endTileMapFile(&writer);
+}
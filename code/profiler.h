@@ -0,0 +1,69 @@
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include "SDL_render.h"
+#include "denis_meta.h"
+
+enum ProfileSection
+{
+    PROFILE_EVENTS,
+    PROFILE_TILE_MAP_INPUT,
+    PROFILE_TILE_SET_INPUT,
+    PROFILE_TILE_MAP_DRAW,
+    PROFILE_CHUNK_BAKE,
+    PROFILE_TILE_SET_DRAW,
+    PROFILE_UI_DRAW,
+    PROFILE_PRESENT,
+
+    PROFILE_SECTION_COUNT
+};
+
+//NOTE(denis): sections can't be nested inside themselves, but can be nested
+// inside other sections, their times are just reported separately
+void profilerBeginSection(ProfileSection section);
+void profilerEndSection(ProfileSection section);
+
+//NOTE(denis): times the section from here to the end of the scope
+struct ProfileTimer
+{
+    ProfileSection section;
+
+    ProfileTimer(ProfileSection newSection)
+    {
+	section = newSection;
+	profilerBeginSection(section);
+    }
+
+    ~ProfileTimer()
+    {
+	profilerEndSection(section);
+    }
+};
+
+#define PROFILE_SCOPE(section) ProfileTimer profileTimer_##section(section)
+
+void profilerBeginFrame();
+//NOTE(denis): frames where nothing was drawn aren't kept
+void profilerEndFrame(bool drewFrame);
+
+//NOTE(denis): every SDL_RenderCopy after this header goes through here so the
+// draw calls of a frame can be counted
+int profileRenderCopy(SDL_Renderer *renderer, SDL_Texture *texture,
+		      const SDL_Rect *source, const SDL_Rect *dest);
+#define SDL_RenderCopy(renderer, texture, source, dest) \
+    profileRenderCopy(renderer, texture, source, dest)
+
+//NOTE(denis): while the overlay is up the window is redrawn every frame so
+// the numbers keep coming in
+void profilerToggleOverlay();
+void profilerDrawOverlay(SDL_Renderer *renderer);
+
+//NOTE(denis): for the benchmarks, allocations are only counted when built
+// with PROFILE_ALLOCATIONS, otherwise this is always 0
+uint32 profilerGetLastFrameRenderCopies();
+uint32 profilerGetNumAllocations();
+
+//NOTE(denis): writes one line per kept frame, times are in microseconds
+bool profilerWriteCSV(char *fileName);
+
+#endif
@@ -0,0 +1,318 @@
+/* NOTE(denis): headless benchmark for tileMapPanelDraw
+ *
+ * scrolls synthetic tile maps across the panel for a fixed number of frames
+ * and prints the results as JSON, one result per map size, tile size and zoom
+ *
+ * usage: render_benchmark [--frames N] [--accelerated] [--dummy]
+ *
+ * --accelerated  use the GPU renderer instead of the software one
+ * --dummy        use SDL's dummy video driver, for machines with no display
+ *                (only the software renderer works with it)
+ *
+ * run it from the data folder like the editor, it needs the font and icons
+ */
+
+#include <SDL.h>
+#include "SDL_ttf.h"
+#include "SDL_image.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "ui_elements.h"
+#include "main.h"
+#include "tile_set_panel.h"
+#include "tile_map_panel.h"
+#include "TEMP_GeneralFunctions.cpp"
+
+#define WINDOW_WIDTH 1280
+#define WINDOW_HEIGHT 720
+#define DEFAULT_FRAMES 300
+#define SCROLL_SPEED 37
+#define TILE_SHEET_WIDTH_IN_TILES 8
+#define ARRAY_COUNT(array) (int32)(sizeof(array)/sizeof((array)[0]))
+
+struct RenderBenchmarkResult
+{
+    int32 mapSize;
+    int32 tileSize;
+    real32 zoom;
+    real32 viewTileSize;
+    int32 frames;
+
+    real64 framesPerSecond;
+    real64 firstFrameMs;
+    real64 drawCallsPerFrame;
+    real64 allocationsPerFrame;
+};
+
+static int32 _mapSizes[] = {128, 1024, 2048};
+static int32 _tileSizes[] = {16, 32, 64};
+//NOTE(denis): wheel notches away from 1:1, in order, zooming out only. about
+// 1/2 and 1/8 draw from the tile set's mips, about 1/64 is small enough for the
+// overview on the bigger maps. the panel won't zoom out past where the whole
+// map fits, so the small maps stop short and say so in their zoom
+static int32 _zoomNotches[] = {0, -3, -9, -19};
+
+static char* getTileSheetName(int32 tileSize)
+{
+    char *sizeString = convertIntToString(tileSize);
+    char *result = concatStrings("benchmark_", sizeString);
+    HEAP_FREE(sizeString);
+
+    return result;
+}
+
+//NOTE(denis): every tile in the sheet is a different opaque colour so they
+// all count as valid tiles
+static void addTileSheet(int32 tileSize)
+{
+    int32 sheetSize = TILE_SHEET_WIDTH_IN_TILES*tileSize;
+    SDL_Surface *image = SDL_CreateRGBSurface(0, sheetSize, sheetSize, 32,
+					      0x00FF0000, 0x0000FF00,
+					      0x000000FF, 0xFF000000);
+
+    for (int32 i = 0; i < TILE_SHEET_WIDTH_IN_TILES; ++i)
+    {
+	for (int32 j = 0; j < TILE_SHEET_WIDTH_IN_TILES; ++j)
+	{
+	    SDL_Rect tile = {j*tileSize, i*tileSize, tileSize, tileSize};
+	    uint32 colour = SDL_MapRGBA(image->format, (uint8)(j*32), (uint8)(i*32),
+					(uint8)((i+j)*16), 255);
+	    SDL_FillRect(image, &tile, colour);
+	}
+    }
+
+    char *name = getTileSheetName(tileSize);
+    if (!tileSetPanelInitializeNewTileSet(name, image, tileSize))
+    {
+	SDL_FreeSurface(image);
+	HEAP_FREE(name);
+	return;
+    }
+    tileSetPanelFinishImport();
+}
+
+//NOTE(denis): a repeating pattern with no two neighbours the same, so nothing
+// gets to skip work because tiles match
+static TileMapHandle addSyntheticTileMap(int32 mapSize, int32 tileSize)
+{
+    char *name = duplicateString("benchmark");
+    char *tileSheetName = getTileSheetName(tileSize);
+    TileMapHandle result = tileMapPanelAddTileMap(name, mapSize, mapSize, tileSize,
+						  tileSheetName);
+    TileMap *tileMap = tileMapPanelGetTileMap(result);
+
+    if (tileMap)
+    {
+	for (int32 i = 0; i < mapSize; ++i)
+	{
+	    for (int32 j = 0; j < mapSize; ++j)
+	    {
+		Point2 sheetPos;
+		sheetPos.x = ((j + i*3) % TILE_SHEET_WIDTH_IN_TILES)*tileSize;
+		sheetPos.y = ((i + j*5) % TILE_SHEET_WIDTH_IN_TILES)*tileSize;
+
+		tileMap->setTile(j, i, sheetPos);
+	    }
+	}
+    }
+    else
+    {
+	//NOTE(denis): the names are only the map's once it has been added
+	HEAP_FREE(name);
+	HEAP_FREE(tileSheetName);
+    }
+
+    return result;
+}
+
+//NOTE(denis): bounces back and forth between 0 and max
+static inline int32 getScrollPosition(int32 frame, int32 speed, int32 max)
+{
+    int32 result = 0;
+
+    if (max > 0)
+    {
+	int32 position = (frame*speed) % (2*max);
+	result = position <= max ? position : 2*max - position;
+    }
+
+    return result;
+}
+
+static inline real64 ticksToMs(uint64 ticks)
+{
+    return (real64)ticks*1000.0/(real64)SDL_GetPerformanceFrequency();
+}
+
+static RenderBenchmarkResult runBenchmark(SDL_Renderer *renderer, TileMap *tileMap,
+					  int32 mapSize, int32 tileSize, int32 frames)
+{
+    RenderBenchmarkResult result = {};
+    result.mapSize = mapSize;
+    result.tileSize = tileSize;
+    result.zoom = tileMap->zoom;
+    result.viewTileSize = tileMap->getViewTileSize();
+
+    int32 mapSizeOnScreen = (int32)ceil((real64)mapSize*tileMap->getViewTileSize());
+    int32 maxScrollX = MAX(mapSizeOnScreen - tileMap->visibleArea.w, 0);
+    int32 maxScrollY = MAX(mapSizeOnScreen - tileMap->visibleArea.h, 0);
+
+    uint64 totalDrawCalls = 0;
+    uint32 allocationsBefore = profilerGetNumAllocations();
+    uint64 start = SDL_GetPerformanceCounter();
+
+    for (int32 frame = 0; frame < frames; ++frame)
+    {
+	//NOTE(denis): diagonal sweep, the vertical scroll is slower so the
+	// two directions don't line up
+	tileMap->drawOffset.x = getScrollPosition(frame, SCROLL_SPEED, maxScrollX);
+	tileMap->drawOffset.y = getScrollPosition(frame, SCROLL_SPEED/2, maxScrollY);
+
+	profilerBeginFrame();
+	uint64 frameStart = SDL_GetPerformanceCounter();
+
+	SDL_SetRenderDrawColor(renderer, 60, 67, 69, 255);
+	SDL_RenderClear(renderer);
+	tileMapPanelDraw();
+	SDL_RenderPresent(renderer);
+
+	if (frame == 0)
+	    result.firstFrameMs = ticksToMs(SDL_GetPerformanceCounter() - frameStart);
+
+	profilerEndFrame(true);
+	totalDrawCalls += profilerGetLastFrameRenderCopies();
+    }
+
+    uint64 elapsed = SDL_GetPerformanceCounter() - start;
+    uint32 allocations = profilerGetNumAllocations() - allocationsBefore;
+
+    result.frames = frames;
+    result.framesPerSecond = frames*1000.0/ticksToMs(elapsed);
+    result.drawCallsPerFrame = (real64)totalDrawCalls/frames;
+    result.allocationsPerFrame = (real64)allocations/frames;
+
+    return result;
+}
+
+static void printResult(RenderBenchmarkResult *result, bool last)
+{
+    printf("    {\"map_size\": %d, \"tile_size\": %d, \"zoom\": %.4f, "
+	   "\"view_tile_size\": %.2f, \"frames\": %d, "
+	   "\"fps\": %.1f, \"first_frame_ms\": %.2f, "
+	   "\"draw_calls_per_frame\": %.1f, \"allocations_per_frame\": %.2f}%s\n",
+	   result->mapSize, result->tileSize, result->zoom, result->viewTileSize, result->frames,
+	   result->framesPerSecond, result->firstFrameMs,
+	   result->drawCallsPerFrame, result->allocationsPerFrame,
+	   last ? "" : ",");
+}
+
+int main(int argc, char* argv[])
+{
+    int32 frames = DEFAULT_FRAMES;
+    bool accelerated = false;
+
+    for (int32 i = 1; i < argc; ++i)
+    {
+	if (strcmp(argv[i], "--frames") == 0 && i+1 < argc)
+	{
+	    frames = MAX(atoi(argv[++i]), 1);
+	}
+	else if (strcmp(argv[i], "--accelerated") == 0)
+	{
+	    accelerated = true;
+	}
+	else if (strcmp(argv[i], "--dummy") == 0)
+	{
+	    SDL_setenv("SDL_VIDEODRIVER", "dummy", 1);
+	}
+    }
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) != 0)
+    {
+	fprintf(stderr, "SDL_Init failed: %s\n", SDL_GetError());
+	return 1;
+    }
+
+    int result = 1;
+
+    SDL_Window *window = SDL_CreateWindow("Render Benchmark", SDL_WINDOWPOS_UNDEFINED,
+					  SDL_WINDOWPOS_UNDEFINED, WINDOW_WIDTH,
+					  WINDOW_HEIGHT, SDL_WINDOW_HIDDEN);
+
+    //NOTE(denis): no vsync, it would cap every result at the refresh rate
+    uint32 renderFlags = accelerated ? SDL_RENDERER_ACCELERATED : SDL_RENDERER_SOFTWARE;
+    SDL_Renderer *renderer = 0;
+    if (window)
+	renderer = SDL_CreateRenderer(window, -1, renderFlags);
+
+    if (renderer && ui_init(renderer, "LiberationMono-Regular.ttf", 16)
+	&& IMG_Init(IMG_INIT_PNG) != 0)
+    {
+	//NOTE(denis): same layout as the editor
+	tileSetPanelCreateNew(renderer, WINDOW_WIDTH - WINDOW_WIDTH/3 - 15, 35,
+			      WINDOW_WIDTH/3, WINDOW_HEIGHT - 50);
+	tileMapPanelCreateNew(renderer, 15, 35, 800, WINDOW_HEIGHT - 50);
+
+	for (int32 i = 0; i < ARRAY_COUNT(_tileSizes); ++i)
+	{
+	    addTileSheet(_tileSizes[i]);
+	}
+
+	SDL_RendererInfo rendererInfo = {};
+	SDL_GetRendererInfo(renderer, &rendererInfo);
+
+	printf("{\n  \"benchmark\": \"render\",\n  \"video_driver\": \"%s\",\n"
+	       "  \"renderer\": \"%s\",\n  \"results\": [\n",
+	       SDL_GetCurrentVideoDriver(), rendererInfo.name);
+
+	int32 numMapSizes = ARRAY_COUNT(_mapSizes);
+	int32 numTileSizes = ARRAY_COUNT(_tileSizes);
+	int32 numZooms = ARRAY_COUNT(_zoomNotches);
+	for (int32 i = 0; i < numMapSizes; ++i)
+	{
+	    for (int32 j = 0; j < numTileSizes; ++j)
+	    {
+		TileMapHandle handle = addSyntheticTileMap(_mapSizes[i], _tileSizes[j]);
+		TileMap *tileMap = tileMapPanelGetTileMap(handle);
+		int32 notches = 0;
+
+		for (int32 k = 0; k < numZooms; ++k)
+		{
+		    RenderBenchmarkResult benchmark = {};
+		    benchmark.mapSize = _mapSizes[i];
+		    benchmark.tileSize = _tileSizes[j];
+
+		    if (tileMap)
+		    {
+			//NOTE(denis): zoomed the same way the editor does it, so
+			// it gets clamped and the panel refitted the same way
+			Vector2 corner = {tileMap->visibleArea.x, tileMap->visibleArea.y};
+			tileMapPanelOnMouseWheel(corner, _zoomNotches[k] - notches);
+			notches = _zoomNotches[k];
+
+			benchmark = runBenchmark(renderer, tileMap, _mapSizes[i],
+						 _tileSizes[j], frames);
+		    }
+
+		    bool last = i == numMapSizes-1 && j == numTileSizes-1 && k == numZooms-1;
+		    printResult(&benchmark, last);
+		    fflush(stdout);
+		}
+
+		tileMapPanelRemoveTileMap(handle);
+	    }
+	}
+
+	printf("  ]\n}\n");
+
+	result = 0;
+    }
+    else
+    {
+	fprintf(stderr, "setup failed: %s\n", SDL_GetError());
+    }
+
+    SDL_Quit();
+    return result;
+}
@@ -3,11 +3,38 @@
  */
 
 #include "tile_map_file.h"
-#include "windows.h"
 #include "assert.h"
 
+#if defined(_WIN32)
+#include "windows.h"
+
+#if defined(PROFILE_ALLOCATIONS)
+extern volatile LONG _numHeapAllocations;
+#define HEAP_ALLOC(bytes) (InterlockedIncrement(&_numHeapAllocations), \
+			   HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, bytes));
+#else
 #define HEAP_ALLOC(bytes) HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, bytes);
+#endif
 #define HEAP_FREE(ptr) HeapFree(GetProcessHeap(), 0, ptr);
+#else
+#include "stdlib.h"
+#include "stdio.h"
+#include "fcntl.h"
+#include "unistd.h"
+#include "sys/mman.h"
+#include "sys/stat.h"
+#include "pthread.h"
+#include "sched.h"
+
+#if defined(PROFILE_ALLOCATIONS)
+extern volatile int32 _numHeapAllocations;
+#define HEAP_ALLOC(bytes) (__sync_fetch_and_add(&_numHeapAllocations, 1), \
+			   calloc(1, bytes));
+#else
+#define HEAP_ALLOC(bytes) calloc(1, bytes);
+#endif
+#define HEAP_FREE(ptr) free(ptr);
+#endif
 
 static char* duplicateString(char *string)
 {
@@ -32,61 +59,1140 @@ static char* duplicateString(char *string)
     return result;
 }
 
-LoadTileMapResult loadTileMap(char *fileName)
+//NOTE(denis): maps the entire file as read-only memory, returns 0 if the
+// file couldn't be opened or mapped
+static void* mapEntireFile(char *fileName, uint64 *fileSize)
 {
-    char *tileMapName = 0;
-    uint32 tileMapWidth = 0;
-    uint32 tileMapHeight = 0;
-    uint32 tileSize = 0;
-    char *tileSheetFileName = 0;
-    LoadedTile *tiles = 0;
-    
+    void *result = 0;
+    *fileSize = 0;
+
+#if defined(_WIN32)
     HANDLE fileHandle = CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, NULL,
 				   OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 
     if (fileHandle != INVALID_HANDLE_VALUE)
     {
-	LARGE_INTEGER bytesToRead = {};
-	DWORD bytesRead = 0;
-	GetFileSizeEx(fileHandle, &bytesToRead);
+	LARGE_INTEGER size = {};
+	if (GetFileSizeEx(fileHandle, &size) && size.QuadPart > 0)
+	{
+	    HANDLE mappingHandle = CreateFileMapping(fileHandle, NULL, PAGE_READONLY,
+						     0, 0, NULL);
+	    if (mappingHandle)
+	    {
+		result = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+		if (result)
+		    *fileSize = size.QuadPart;
 
-        void *buffer = HEAP_ALLOC(bytesToRead.QuadPart);
+		//NOTE(denis): the view keeps the mapping alive, so neither handle
+		// has to stick around after this
+		CloseHandle(mappingHandle);
+	    }
+	}
+
+	CloseHandle(fileHandle);
+    }
+#else
+    int fileDescriptor = open(fileName, O_RDONLY);
 
-	//NOTE(denis): could be a problem if we ever read files that are
-	// gigabytes in size (shouldn't happen though)
-	assert(bytesToRead.HighPart == 0);
-	if (ReadFile(fileHandle, buffer, bytesToRead.LowPart, &bytesRead, NULL))
+    if (fileDescriptor != -1)
+    {
+	struct stat fileInfo = {};
+	if (fstat(fileDescriptor, &fileInfo) == 0 && fileInfo.st_size > 0)
 	{
-	    assert(bytesToRead.LowPart == bytesRead);
+	    void *mapped = mmap(0, fileInfo.st_size, PROT_READ, MAP_PRIVATE,
+				fileDescriptor, 0);
+	    if (mapped != MAP_FAILED)
+	    {
+		result = mapped;
+		*fileSize = fileInfo.st_size;
+	    }
+	}
 
-	    MapFileHeader *fileHeader = (MapFileHeader*)buffer;
-	    tileMapWidth = fileHeader->tileMapWidth;
-	    tileMapHeight = fileHeader->tileMapHeight;
-	    tileSize = fileHeader->tileSize;
-	    tileSheetFileName = duplicateString(fileHeader->tileSheetFileName);
-	    tileMapName = duplicateString(fileHeader->tileMapName);
-	    
-	    uint32 mapSizeInBytes = tileMapWidth*tileMapHeight*sizeof(LoadedTile);
-	    tiles = (LoadedTile*)HEAP_ALLOC(mapSizeInBytes);
+	close(fileDescriptor);
+    }
+#endif
+
+    return result;
+}
+
+static void unmapEntireFile(void *memory, uint64 size)
+{
+    if (memory)
+    {
+#if defined(_WIN32)
+	UnmapViewOfFile(memory);
+#else
+	munmap(memory, size);
+#endif
+    }
+}
+
+//NOTE(denis): the block codec is a plain LZ77 in the style of LZ4, a sequence is
+// a token byte (literal count in the top 4 bits, match length - 4 in the bottom
+// 4 bits), extra length bytes if a count is 15 or more, the literals, and then a
+// 2 byte offset back to the match. The last sequence is only literals.
+// Floods of one tile turn into a single match that overlaps itself.
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 0xFFFF
+#define LZ_HASH_BITS 12
+
+static inline uint32 readUint32(uint8 *data)
+{
+    return (uint32)data[0] | ((uint32)data[1] << 8) |
+	((uint32)data[2] << 16) | ((uint32)data[3] << 24);
+}
+
+static inline uint32 hashSequence(uint32 sequence)
+{
+    return (sequence*2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static inline uint32 clampToNibble(uint32 value)
+{
+    return value < 15 ? value : 15;
+}
+
+static bool writeLength(uint8 *dest, uint32 destSize, uint32 *destPos, uint32 length)
+{
+    while (length >= 255)
+    {
+	if (*destPos >= destSize)
+	    return false;
+	dest[(*destPos)++] = 255;
+	length -= 255;
+    }
+
+    if (*destPos >= destSize)
+	return false;
+    dest[(*destPos)++] = (uint8)length;
+    
+    return true;
+}
+
+static bool writeSequence(uint8 *dest, uint32 destSize, uint32 *destPos,
+			  uint8 *literals, uint32 numLiterals,
+			  uint32 offset, uint32 matchLength)
+{
+    uint32 matchCode = matchLength ? matchLength - LZ_MIN_MATCH : 0;
+    
+    if (*destPos >= destSize)
+	return false;
+    dest[(*destPos)++] = (uint8)((clampToNibble(numLiterals) << 4) | clampToNibble(matchCode));
+
+    if (numLiterals >= 15 && !writeLength(dest, destSize, destPos, numLiterals - 15))
+	return false;
+
+    if (destSize - *destPos < numLiterals)
+	return false;
+    for (uint32 i = 0; i < numLiterals; ++i)
+    {
+	dest[*destPos + i] = literals[i];
+    }
+    *destPos += numLiterals;
+
+    if (matchLength)
+    {
+	if (destSize - *destPos < 2)
+	    return false;
+	dest[(*destPos)++] = (uint8)(offset & 0xFF);
+	dest[(*destPos)++] = (uint8)(offset >> 8);
+
+	if (matchCode >= 15 && !writeLength(dest, destSize, destPos, matchCode - 15))
+	    return false;
+    }
 
-	    uint8 *bufferTiles = (uint8*)buffer + sizeof(MapFileHeader);
-	    for (uint32 i = 0; i < mapSizeInBytes; ++i)
+    return true;
+}
+
+uint32 compressTileMapBlock(uint8 *source, uint32 sourceSize, uint8 *dest, uint32 destSize)
+{
+    //NOTE(denis): positions are stored + 1 so that 0 means empty
+    uint32 hashTable[1 << LZ_HASH_BITS] = {};
+
+    uint32 sourcePos = 0;
+    uint32 literalStart = 0;
+    uint32 destPos = 0;
+
+    while (sourcePos + LZ_MIN_MATCH <= sourceSize)
+    {
+	uint32 sequence = readUint32(source + sourcePos);
+	uint32 hash = hashSequence(sequence);
+	uint32 candidate = hashTable[hash];
+	hashTable[hash] = sourcePos + 1;
+
+	if (candidate && sourcePos - (candidate-1) <= LZ_MAX_OFFSET &&
+	    readUint32(source + candidate-1) == sequence)
+	{
+	    uint32 matchPos = candidate-1;
+	    uint32 matchLength = LZ_MIN_MATCH;
+	    while (sourcePos + matchLength < sourceSize &&
+		   source[matchPos + matchLength] == source[sourcePos + matchLength])
+	    {
+		++matchLength;
+	    }
+
+	    if (!writeSequence(dest, destSize, &destPos, source + literalStart,
+			       sourcePos - literalStart, sourcePos - matchPos, matchLength))
 	    {
-		*((uint8*)tiles + i) = *(bufferTiles + i);
+		return 0;
 	    }
+
+	    sourcePos += matchLength;
+	    literalStart = sourcePos;
+	}
+	else
+	{
+	    //NOTE(denis): skip ahead faster the longer nothing has matched so
+	    // data that doesn't compress doesn't take forever
+	    sourcePos += 1 + ((sourcePos - literalStart) >> 6);
+	}
+    }
+
+    if (!writeSequence(dest, destSize, &destPos, source + literalStart,
+		       sourceSize - literalStart, 0, 0))
+    {
+	return 0;
+    }
+
+    return destPos;
+}
+
+static bool readLength(uint8 *source, uint32 sourceSize, uint32 *sourcePos, uint32 *length)
+{
+    uint8 next = 255;
+    while (next == 255)
+    {
+	if (*sourcePos >= sourceSize)
+	    return false;
+	next = source[(*sourcePos)++];
+	*length += next;
+    }
+
+    return true;
+}
+
+bool decompressTileMapBlock(uint8 *source, uint32 sourceSize, uint8 *dest, uint32 destSize)
+{
+    uint32 sourcePos = 0;
+    uint32 destPos = 0;
+
+    while (sourcePos < sourceSize)
+    {
+	uint8 token = source[sourcePos++];
+
+	uint32 numLiterals = token >> 4;
+	if (numLiterals == 15 && !readLength(source, sourceSize, &sourcePos, &numLiterals))
+	    return false;
+
+	if (sourceSize - sourcePos < numLiterals || destSize - destPos < numLiterals)
+	    return false;
+	for (uint32 i = 0; i < numLiterals; ++i)
+	{
+	    dest[destPos + i] = source[sourcePos + i];
+	}
+	sourcePos += numLiterals;
+	destPos += numLiterals;
+
+	if (sourcePos == sourceSize)
+	    break;
+
+	if (sourceSize - sourcePos < 2)
+	    return false;
+	uint32 offset = source[sourcePos] | (source[sourcePos+1] << 8);
+	sourcePos += 2;
+
+	uint32 matchLength = token & 0xF;
+	if (matchLength == 15 && !readLength(source, sourceSize, &sourcePos, &matchLength))
+	    return false;
+	matchLength += LZ_MIN_MATCH;
+
+	if (offset == 0 || offset > destPos || destSize - destPos < matchLength)
+	    return false;
+
+	//NOTE(denis): byte by byte on purpose, the match can overlap what it writes
+	uint8 *match = dest + destPos - offset;
+	for (uint32 i = 0; i < matchLength; ++i)
+	{
+	    dest[destPos + i] = match[i];
+	}
+	destPos += matchLength;
+    }
+
+    return destPos == destSize;
+}
+
+//NOTE(denis): the view's names point straight into the header, so a field
+// that runs to its end with no terminator would be read past it
+static bool fieldIsTerminated(char *field, uint32 fieldSize)
+{
+    bool result = false;
+
+    for (uint32 i = 0; i < fieldSize && !result; ++i)
+    {
+	result = field[i] == 0;
+    }
+
+    return result;
+}
+
+static bool parseVersion1File(TileMapView *view, void *fileMemory, uint64 fileSize)
+{
+    bool result = false;
+    
+    if (fileSize >= sizeof(MapFileHeader))
+    {
+	MapFileHeader *fileHeader = (MapFileHeader*)fileMemory;
+
+	uint64 mapSizeInBytes = (uint64)fileHeader->tileMapWidth*
+	    (uint64)fileHeader->tileMapHeight*sizeof(LoadedTile);
+
+	if (mapSizeInBytes != 0 && sizeof(MapFileHeader) + mapSizeInBytes <= fileSize &&
+	    fieldIsTerminated(fileHeader->tileMapName, (uint32)sizeof(fileHeader->tileMapName)) &&
+	    fieldIsTerminated(fileHeader->tileSheetFileName, (uint32)sizeof(fileHeader->tileSheetFileName)))
+	{
+	    view->version = 1;
+	    view->tileMapName = fileHeader->tileMapName;
+	    view->tileMapWidth = fileHeader->tileMapWidth;
+	    view->tileMapHeight = fileHeader->tileMapHeight;
+	    view->tileSize = fileHeader->tileSize;
+	    view->tileSheetFileName = fileHeader->tileSheetFileName;
+	    view->tiles = (LoadedTile*)((uint8*)fileMemory + sizeof(MapFileHeader));
+
+	    result = true;
+	}
+    }
+
+    return result;
+}
+
+static bool parseVersion2File(TileMapView *view, void *fileMemory, uint64 fileSize)
+{
+    bool result = false;
+    
+    if (fileSize >= sizeof(MapFileHeaderV2))
+    {
+	MapFileHeaderV2 *fileHeader = (MapFileHeaderV2*)fileMemory;
+
+	uint64 paletteSizeInBytes = (uint64)fileHeader->paletteSize*sizeof(Point2);
+	uint64 mapSizeInBytes = (uint64)fileHeader->tileMapWidth*
+	    (uint64)fileHeader->tileMapHeight*fileHeader->indexSize;
+
+	if (fileHeader->version == MAP_FILE_VERSION &&
+	    (fileHeader->indexSize == 2 || fileHeader->indexSize == 4) &&
+	    fileHeader->paletteSize != 0 && mapSizeInBytes != 0 &&
+	    sizeof(MapFileHeaderV2) + paletteSizeInBytes + mapSizeInBytes <= fileSize &&
+	    fieldIsTerminated(fileHeader->tileMapName, (uint32)sizeof(fileHeader->tileMapName)) &&
+	    fieldIsTerminated(fileHeader->tileSheetFileName, (uint32)sizeof(fileHeader->tileSheetFileName)))
+	{
+	    uint8 *palette = (uint8*)fileMemory + sizeof(MapFileHeaderV2);
+	    
+	    view->version = fileHeader->version;
+	    view->tileMapName = fileHeader->tileMapName;
+	    view->tileMapWidth = fileHeader->tileMapWidth;
+	    view->tileMapHeight = fileHeader->tileMapHeight;
+	    view->tileSize = fileHeader->tileSize;
+	    view->tileSheetFileName = fileHeader->tileSheetFileName;
+	    view->palette = (Point2*)palette;
+	    view->paletteSize = fileHeader->paletteSize;
+	    view->indices = palette + paletteSizeInBytes;
+	    view->indexSize = fileHeader->indexSize;
+
+	    result = true;
+	}
+    }
+
+    return result;
+}
+
+static bool parseVersion3File(TileMapView *view, void *fileMemory, uint64 fileSize)
+{
+    bool result = false;
+    
+    if (fileSize >= sizeof(MapFileHeaderV3))
+    {
+	MapFileHeaderV3 *fileHeader = (MapFileHeaderV3*)fileMemory;
+
+	uint64 paletteSizeInBytes = (uint64)fileHeader->paletteSize*sizeof(Point2);
+	uint64 blocksSizeInBytes = (uint64)fileHeader->numBlocks*sizeof(MapFileBlock);
+	uint64 rowSizeInBytes = (uint64)fileHeader->tileMapWidth*fileHeader->indexSize;
+	uint64 mapSizeInBytes = rowSizeInBytes*fileHeader->tileMapHeight;
+
+	bool valid = (fileHeader->indexSize == 2 || fileHeader->indexSize == 4) &&
+	    fileHeader->paletteSize != 0 && mapSizeInBytes != 0 &&
+	    fileHeader->rowsPerBlock != 0 &&
+	    fileHeader->numBlocks == (fileHeader->tileMapHeight + fileHeader->rowsPerBlock-1)/
+	    fileHeader->rowsPerBlock &&
+	    sizeof(MapFileHeaderV3) + paletteSizeInBytes + blocksSizeInBytes <= fileSize &&
+	    fieldIsTerminated(fileHeader->tileMapName, (uint32)sizeof(fileHeader->tileMapName)) &&
+	    fieldIsTerminated(fileHeader->tileSheetFileName, (uint32)sizeof(fileHeader->tileSheetFileName));
+
+	uint8 *palette = (uint8*)fileMemory + sizeof(MapFileHeaderV3);
+	MapFileBlock *blocks = (MapFileBlock*)(palette + paletteSizeInBytes);
+
+	for (uint32 i = 0; i < fileHeader->numBlocks && valid; ++i)
+	{
+	    uint32 numBlockRows = fileHeader->tileMapHeight - i*fileHeader->rowsPerBlock;
+	    if (numBlockRows > fileHeader->rowsPerBlock)
+		numBlockRows = fileHeader->rowsPerBlock;
+
+	    valid = blocks[i].uncompressedSize == numBlockRows*rowSizeInBytes &&
+		blocks[i].compressedSize <= blocks[i].uncompressedSize &&
+		blocks[i].offset <= fileSize &&
+		blocks[i].compressedSize <= fileSize - blocks[i].offset;
+	}
+
+	if (valid)
+	{
+	    view->decodedIndices = (uint8*)HEAP_ALLOC(mapSizeInBytes);
+	    view->blockStates = (volatile int32*)HEAP_ALLOC(fileHeader->numBlocks*sizeof(int32));
 	}
 	
-	HEAP_FREE(buffer);
-	CloseHandle(fileHandle);
+	if (valid && view->decodedIndices && view->blockStates)
+	{
+	    view->version = fileHeader->version;
+	    view->tileMapName = fileHeader->tileMapName;
+	    view->tileMapWidth = fileHeader->tileMapWidth;
+	    view->tileMapHeight = fileHeader->tileMapHeight;
+	    view->tileSize = fileHeader->tileSize;
+	    view->tileSheetFileName = fileHeader->tileSheetFileName;
+	    view->palette = (Point2*)palette;
+	    view->paletteSize = fileHeader->paletteSize;
+	    view->indices = view->decodedIndices;
+	    view->indexSize = fileHeader->indexSize;
+	    view->blocks = blocks;
+	    view->numBlocks = fileHeader->numBlocks;
+	    view->rowsPerBlock = fileHeader->rowsPerBlock;
+
+	    result = true;
+	}
+	else if (valid)
+	{
+	    if (view->decodedIndices)
+		HEAP_FREE(view->decodedIndices);
+	    if (view->blockStates)
+		HEAP_FREE((void*)view->blockStates);
+	}
     }
 
+    return result;
+}
+
+enum ViewBlockState
+{
+    VIEW_BLOCK_ENCODED,
+    VIEW_BLOCK_DECODING,
+    VIEW_BLOCK_DECODED
+};
+
+#if defined(_WIN32)
+static inline int32 compareAndSwap(volatile int32 *value, int32 oldValue, int32 newValue)
+{
+    return (int32)InterlockedCompareExchange((volatile LONG*)value, newValue, oldValue);
+}
+
+static inline int32 loadAcquire(volatile int32 *value)
+{
+    //NOTE(denis): volatile reads are acquires with msvc on x86 and x64
+    return *value;
+}
+
+static inline int32 fetchAndAdd(volatile int32 *value, int32 amount)
+{
+    return (int32)InterlockedExchangeAdd((volatile LONG*)value, amount);
+}
+
+static inline void yieldThread()
+{
+    Sleep(0);
+}
+#else
+static inline int32 compareAndSwap(volatile int32 *value, int32 oldValue, int32 newValue)
+{
+    return __sync_val_compare_and_swap(value, oldValue, newValue);
+}
+
+static inline int32 loadAcquire(volatile int32 *value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline int32 fetchAndAdd(volatile int32 *value, int32 amount)
+{
+    return __sync_fetch_and_add(value, amount);
+}
+
+static inline void yieldThread()
+{
+    sched_yield();
+}
+#endif
+
+//NOTE(denis): a block that fails to decompress is left as zeroes, which just
+// makes it the first tile in the palette
+static void decodeTileMapBlock(TileMapView *view, uint32 block)
+{
+    const MapFileBlock *fileBlock = view->blocks + block;
+    uint8 *source = (uint8*)view->mappedMemory + fileBlock->offset;
+    uint8 *dest = view->decodedIndices +
+	(uint64)block*view->rowsPerBlock*view->tileMapWidth*view->indexSize;
+
+    if (fileBlock->compressedSize == fileBlock->uncompressedSize)
+    {
+	for (uint32 i = 0; i < fileBlock->uncompressedSize; ++i)
+	{
+	    dest[i] = source[i];
+	}
+    }
+    else if (!decompressTileMapBlock(source, fileBlock->compressedSize,
+				     dest, fileBlock->uncompressedSize))
+    {
+	for (uint32 i = 0; i < fileBlock->uncompressedSize; ++i)
+	{
+	    dest[i] = 0;
+	}
+    }
+
+    compareAndSwap(view->blockStates + block, VIEW_BLOCK_DECODING, VIEW_BLOCK_DECODED);
+}
+
+//NOTE(denis): the save thread and the editor can both be reading the view, only
+// one of them decodes a block and the other waits for it to be done
+static void makeSureBlockIsDecoded(TileMapView *view, uint32 block)
+{
+    volatile int32 *state = view->blockStates + block;
+
+    while (loadAcquire(state) != VIEW_BLOCK_DECODED)
+    {
+	if (compareAndSwap(state, VIEW_BLOCK_ENCODED, VIEW_BLOCK_DECODING) == VIEW_BLOCK_ENCODED)
+	    decodeTileMapBlock(view, block);
+	else
+	    yieldThread();
+    }
+}
+
+TileMapView openTileMapView(char *fileName)
+{
+    TileMapView result = {};
+
+    uint64 fileSize = 0;
+    void *fileMemory = 0;
+    if (fileName)
+	fileMemory = mapEntireFile(fileName, &fileSize);
+
+    if (fileMemory)
+    {
+	bool valid = false;
+	
+	if (fileSize >= 2*sizeof(uint32) && *(uint32*)fileMemory == MAP_FILE_MAGIC)
+	{
+	    uint32 version = ((uint32*)fileMemory)[1];
+	    if (version == MAP_FILE_VERSION_COMPRESSED)
+		valid = parseVersion3File(&result, fileMemory, fileSize);
+	    else
+		valid = parseVersion2File(&result, fileMemory, fileSize);
+	}
+	else
+	{
+	    valid = parseVersion1File(&result, fileMemory, fileSize);
+	}
+
+	if (valid)
+	{
+	    result.mappedMemory = fileMemory;
+	    result.mappedSize = fileSize;
+	    result.fileName = duplicateString(fileName);
+	}
+	else
+	{
+	    result = {};
+	    unmapEntireFile(fileMemory, fileSize);
+	}
+    }
+
+    return result;
+}
+
+void closeTileMapView(TileMapView *view)
+{
+    if (view)
+    {
+	unmapEntireFile(view->mappedMemory, view->mappedSize);
+	if (view->decodedIndices)
+	    HEAP_FREE(view->decodedIndices);
+	if (view->blockStates)
+	    HEAP_FREE((void*)view->blockStates);
+	if (view->fileName)
+	    HEAP_FREE(view->fileName);
+	
+	*view = {};
+    }
+}
+
+uint32 tileMapViewGetPaletteIndex(TileMapView *view, uint32 x, uint32 y)
+{
+    uint64 index = (uint64)y*view->tileMapWidth + x;
+
+    if (view->version == MAP_FILE_VERSION_COMPRESSED)
+    {
+	makeSureBlockIsDecoded(view, y/view->rowsPerBlock);
+    }
+	
+    uint32 result = 0;
+    if (view->indexSize == 2)
+	result = ((uint16*)view->indices)[index];
+    else
+	result = ((uint32*)view->indices)[index];
+
+    //NOTE(denis): a bad index in a corrupted file just becomes the first tile
+    if (result >= view->paletteSize)
+	result = 0;
+
+    return result;
+}
+
+LoadedTile tileMapViewGetTile(TileMapView *view, uint32 x, uint32 y)
+{
+    LoadedTile result = {};
+    
+    if (view->version == 1)
+    {
+	result = view->tiles[(uint64)y*view->tileMapWidth + x];
+    }
+    else
+    {
+	result.size = view->tileSize;
+	result.sheetPos = view->palette[tileMapViewGetPaletteIndex(view, x, y)];
+    }
+
+    result.pos.x = x*view->tileSize;
+    result.pos.y = y*view->tileSize;
+    
+    return result;
+}
+
+struct RowJobs
+{
+    RowJob *doRows;
+    void *data;
+
+    uint32 numRows;
+    uint32 rowsPerJob;
+    uint32 numJobs;
+    volatile int32 nextJob;
+};
+
+#if defined(_WIN32)
+static DWORD WINAPI rowJobThreadProc(LPVOID data)
+#else
+static void* rowJobThreadProc(void *data)
+#endif
+{
+    RowJobs *jobs = (RowJobs*)data;
+
+    uint32 job = (uint32)fetchAndAdd(&jobs->nextJob, 1);
+    while (job < jobs->numJobs)
+    {
+	uint32 firstRow = job*jobs->rowsPerJob;
+	uint32 lastRow = firstRow + jobs->rowsPerJob;
+	if (lastRow > jobs->numRows)
+	    lastRow = jobs->numRows;
+
+	jobs->doRows(jobs->data, firstRow, lastRow);
+
+	job = (uint32)fetchAndAdd(&jobs->nextJob, 1);
+    }
+
+    return 0;
+}
+
+static uint32 getNumProcessors()
+{
+#if defined(_WIN32)
+    SYSTEM_INFO systemInfo = {};
+    GetSystemInfo(&systemInfo);
+    uint32 result = systemInfo.dwNumberOfProcessors;
+#else
+    long numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32 result = numProcessors > 0 ? (uint32)numProcessors : 1;
+#endif
+
+    return result > 0 ? result : 1;
+}
+
+void runRowJobs(RowJob *doRows, void *data, uint32 numRows, uint32 rowsPerJob,
+		uint32 maxThreads)
+{
+    RowJobs jobs = {};
+    jobs.doRows = doRows;
+    jobs.data = data;
+    jobs.numRows = numRows;
+    jobs.rowsPerJob = rowsPerJob;
+    jobs.numJobs = (numRows + rowsPerJob-1)/rowsPerJob;
+
+    uint32 numThreads = getNumProcessors();
+    if (numThreads > maxThreads)
+	numThreads = maxThreads;
+    if (numThreads > MAX_ROW_JOB_THREADS)
+	numThreads = MAX_ROW_JOB_THREADS;
+    if (numThreads > jobs.numJobs)
+	numThreads = jobs.numJobs;
+
+#if defined(_WIN32)
+    HANDLE threads[MAX_ROW_JOB_THREADS] = {};
+#else
+    pthread_t threads[MAX_ROW_JOB_THREADS];
+    bool threadStarted[MAX_ROW_JOB_THREADS] = {};
+#endif
+
+    //NOTE(denis): this thread takes jobs too, so if no threads can be made it
+    // just does all of them itself
+    for (uint32 i = 1; i < numThreads; ++i)
+    {
+#if defined(_WIN32)
+	threads[i] = CreateThread(NULL, 0, rowJobThreadProc, &jobs, 0, NULL);
+#else
+	threadStarted[i] = pthread_create(threads + i, 0, rowJobThreadProc, &jobs) == 0;
+#endif
+    }
+
+    rowJobThreadProc(&jobs);
+
+    for (uint32 i = 1; i < numThreads; ++i)
+    {
+#if defined(_WIN32)
+	if (threads[i])
+	{
+	    WaitForSingleObject(threads[i], INFINITE);
+	    CloseHandle(threads[i]);
+	}
+#else
+	if (threadStarted[i])
+	    pthread_join(threads[i], 0);
+#endif
+    }
+}
+
+#define LOAD_ROWS_PER_JOB 64
+
+struct DecodeRowsWork
+{
+    TileMapView *view;
+    LoadedTile *tiles;
+};
+
+//NOTE(denis): for compressed files a job is exactly one block so no two threads
+// ever decode the same block
+static void decodeRows(void *data, uint32 firstRow, uint32 lastRow)
+{
+    DecodeRowsWork *work = (DecodeRowsWork*)data;
+    TileMapView *view = work->view;
+
+    if (view->version == MAP_FILE_VERSION_COMPRESSED)
+	makeSureBlockIsDecoded(view, firstRow/view->rowsPerBlock);
+
+    if (work->tiles)
+    {
+	for (uint32 i = firstRow; i < lastRow; ++i)
+	{
+	    LoadedTile *row = work->tiles + (uint64)i*view->tileMapWidth;
+	    for (uint32 j = 0; j < view->tileMapWidth; ++j)
+	    {
+		row[j] = tileMapViewGetTile(view, j, i);
+	    }
+	}
+    }
+}
+
+//NOTE(denis): decompresses any blocks that aren't yet and, if tiles isn't 0,
+// fills it with every tile of the map, all spread across the cores
+static void decodeInParallel(TileMapView *view, LoadedTile *tiles)
+{
+    uint32 rowsPerJob = LOAD_ROWS_PER_JOB;
+    if (view->version == MAP_FILE_VERSION_COMPRESSED)
+	rowsPerJob = view->rowsPerBlock;
+
+    DecodeRowsWork work = {};
+    work.view = view;
+    work.tiles = tiles;
+    runRowJobs(decodeRows, &work, view->tileMapHeight, rowsPerJob, MAX_ROW_JOB_THREADS);
+}
+
+void decodeAllTileMapBlocks(TileMapView *view)
+{
+    if (view->version == MAP_FILE_VERSION_COMPRESSED)
+	decodeInParallel(view, 0);
+}
+
+LoadTileMapResult loadTileMap(char *fileName)
+{
     LoadTileMapResult result = {};
-    result.tileMapName = tileMapName;
-    result.tileMapWidth = tileMapWidth;
-    result.tileMapHeight = tileMapHeight;
-    result.tileSize = tileSize;
-    result.tileSheetFileName = tileSheetFileName;
-    result.tiles = tiles;
+
+    TileMapView view = openTileMapView(fileName);
+
+    if (view.mappedMemory)
+    {
+	uint64 numTiles = (uint64)view.tileMapWidth*(uint64)view.tileMapHeight;
+	LoadedTile *tiles = (LoadedTile*)HEAP_ALLOC(numTiles*sizeof(LoadedTile));
+
+	if (tiles)
+	{
+	    decodeInParallel(&view, tiles);
+
+	    result.tileMapName = duplicateString(view.tileMapName);
+	    result.tileMapWidth = view.tileMapWidth;
+	    result.tileMapHeight = view.tileMapHeight;
+	    result.tileSize = view.tileSize;
+	    result.tileSheetFileName = duplicateString(view.tileSheetFileName);
+	    result.tiles = tiles;
+	}
+
+	closeTileMapView(&view);
+    }
+
+    return result;
+}
+
+static char* appendString(char *a, const char *b)
+{
+    uint32 sizeOfA = 0;
+    uint32 sizeOfB = 0;
+    for (uint32 i = 0; a[i] != 0; ++i)
+	++sizeOfA;
+    for (uint32 i = 0; b[i] != 0; ++i)
+	++sizeOfB;
+
+    char *result = (char*)HEAP_ALLOC(sizeOfA+sizeOfB+1);
+
+    if (result)
+    {
+	for (uint32 i = 0; i < sizeOfA; ++i)
+	    result[i] = a[i];
+	for (uint32 i = 0; i < sizeOfB; ++i)
+	    result[sizeOfA+i] = b[i];
+    }
+
+    return result;
+}
+
+static void flushTileMapFile(TileMapFileWriter *writer)
+{
+    if (writer->bufferUsed > 0 && !writer->failed)
+    {
+#if defined(_WIN32)
+	DWORD written = 0;
+	if (!WriteFile(writer->fileHandle, writer->buffer, writer->bufferUsed, &written, NULL) ||
+	    written != writer->bufferUsed)
+	{
+	    writer->failed = true;
+	}
+#else
+	uint8 *data = writer->buffer;
+	uint32 remaining = writer->bufferUsed;
+	while (remaining > 0 && !writer->failed)
+	{
+	    ssize_t written = write(writer->fileDescriptor, data, remaining);
+	    if (written <= 0)
+	    {
+		writer->failed = true;
+	    }
+	    else
+	    {
+		data += written;
+		remaining -= (uint32)written;
+	    }
+	}
+#endif
+
+	writer->bytesWritten += writer->bufferUsed;
+    }
+
+    writer->bufferUsed = 0;
+}
+
+bool beginTileMapFile(TileMapFileWriter *writer, char *fileName)
+{
+    *writer = {};
+    
+    writer->fileName = duplicateString(fileName);
+    writer->tempFileName = appendString(fileName, ".tmp");
+    writer->buffer = (uint8*)HEAP_ALLOC(TILE_MAP_WRITE_BUFFER_SIZE);
+
+#if defined(_WIN32)
+    writer->fileHandle = CreateFile(writer->tempFileName, GENERIC_WRITE, 0, NULL,
+				    CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    bool opened = writer->fileHandle != INVALID_HANDLE_VALUE;
+#else
+    writer->fileDescriptor = open(writer->tempFileName, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool opened = writer->fileDescriptor != -1;
+#endif
+
+    writer->failed = !opened || !writer->buffer;
+
+    return !writer->failed;
+}
+
+void writeToTileMapFile(TileMapFileWriter *writer, void *data, uint32 size)
+{
+    uint8 *source = (uint8*)data;
+
+    while (size > 0 && !writer->failed)
+    {
+	uint32 spaceLeft = TILE_MAP_WRITE_BUFFER_SIZE - writer->bufferUsed;
+	uint32 bytesToCopy = size < spaceLeft ? size : spaceLeft;
+
+	uint8 *destination = writer->buffer + writer->bufferUsed;
+	for (uint32 i = 0; i < bytesToCopy; ++i)
+	{
+	    destination[i] = source[i];
+	}
+
+	writer->bufferUsed += bytesToCopy;
+	source += bytesToCopy;
+	size -= bytesToCopy;
+	
+	if (writer->bufferUsed == TILE_MAP_WRITE_BUFFER_SIZE)
+	    flushTileMapFile(writer);
+    }
+}
+
+void rewriteTileMapFile(TileMapFileWriter *writer, uint64 offset, void *data, uint32 size)
+{
+    flushTileMapFile(writer);
+
+    if (writer->failed)
+	return;
+    
+    if (offset + size > writer->bytesWritten)
+    {
+	writer->failed = true;
+	return;
+    }
+
+#if defined(_WIN32)
+    LARGE_INTEGER position = {};
+    position.QuadPart = offset;
+    LARGE_INTEGER end = {};
+    end.QuadPart = writer->bytesWritten;
+
+    DWORD written = 0;
+    if (!SetFilePointerEx(writer->fileHandle, position, NULL, FILE_BEGIN) ||
+	!WriteFile(writer->fileHandle, data, size, &written, NULL) || written != size ||
+	!SetFilePointerEx(writer->fileHandle, end, NULL, FILE_BEGIN))
+    {
+	writer->failed = true;
+    }
+#else
+    uint8 *source = (uint8*)data;
+    while (size > 0 && !writer->failed)
+    {
+	ssize_t written = pwrite(writer->fileDescriptor, source, size, offset);
+	if (written <= 0)
+	{
+	    writer->failed = true;
+	}
+	else
+	{
+	    source += written;
+	    offset += written;
+	    size -= (uint32)written;
+	}
+    }
+#endif
+}
+
+//NOTE(denis): everything is on the disk once this returns true
+static bool closeTempFile(TileMapFileWriter *writer)
+{
+    flushTileMapFile(writer);
+
+#if defined(_WIN32)
+    if (writer->fileHandle != INVALID_HANDLE_VALUE)
+    {
+	if (!writer->failed && !FlushFileBuffers(writer->fileHandle))
+	    writer->failed = true;
+	
+	CloseHandle(writer->fileHandle);
+    }
+
+    if (writer->failed)
+	DeleteFile(writer->tempFileName);
+#else
+    if (writer->fileDescriptor != -1)
+    {
+	if (!writer->failed && fsync(writer->fileDescriptor) != 0)
+	    writer->failed = true;
+
+	close(writer->fileDescriptor);
+    }
+
+    if (writer->failed)
+	unlink(writer->tempFileName);
+#endif
+
+    return !writer->failed;
+}
+
+bool replaceTileMapFile(char *tempFileName, char *fileName)
+{
+#if defined(_WIN32)
+    bool result = MoveFileEx(tempFileName, fileName,
+			     MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+    if (!result)
+	DeleteFile(tempFileName);
+#else
+    bool result = rename(tempFileName, fileName) == 0;
+    if (!result)
+	unlink(tempFileName);
+#endif
 
     return result;
 }
+
+bool endTileMapFile(TileMapFileWriter *writer)
+{
+    bool result = closeTempFile(writer) &&
+	replaceTileMapFile(writer->tempFileName, writer->fileName);
+
+    HEAP_FREE(writer->fileName);
+    HEAP_FREE(writer->tempFileName);
+    if (writer->buffer)
+	HEAP_FREE(writer->buffer);
+
+    *writer = {};
+    
+    return result;
+}
+
+bool endTileMapFileInTemp(TileMapFileWriter *writer, char **tempFileName)
+{
+    bool result = closeTempFile(writer);
+
+    *tempFileName = 0;
+    if (result)
+	*tempFileName = writer->tempFileName;
+    else
+	HEAP_FREE(writer->tempFileName);
+    
+    HEAP_FREE(writer->fileName);
+    if (writer->buffer)
+	HEAP_FREE(writer->buffer);
+
+    *writer = {};
+    
+    return result;
+}
+
+bool openTileMapScratchFile(TileMapScratchFile *file)
+{
+    *file = {};
+
+#if defined(_WIN32)
+    char folder[MAX_PATH+1];
+    char fileName[MAX_PATH+1];
+    
+    DWORD folderLength = GetTempPath(sizeof(folder), folder);
+    if (folderLength > 0 && folderLength < sizeof(folder) &&
+	GetTempFileName(folder, "map", 0, fileName) != 0)
+    {
+	file->fileHandle = CreateFile(fileName, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+				      CREATE_ALWAYS,
+				      FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE,
+				      NULL);
+	file->opened = file->fileHandle != INVALID_HANDLE_VALUE;
+
+	if (!file->opened)
+	    DeleteFile(fileName);
+    }
+#else
+    char fileName[] = "/tmp/mapXXXXXX";
+    
+    file->fileDescriptor = mkstemp(fileName);
+    file->opened = file->fileDescriptor != -1;
+
+    //NOTE(denis): the file stays around until the descriptor is closed
+    if (file->opened)
+	unlink(fileName);
+#endif
+
+    return file->opened;
+}
+
+bool readTileMapScratchFile(TileMapScratchFile *file, uint64 offset, void *data, uint32 size)
+{
+    bool result = file->opened;
+    
+#if defined(_WIN32)
+    OVERLAPPED position = {};
+    position.Offset = (DWORD)offset;
+    position.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD read = 0;
+    result = result && ReadFile(file->fileHandle, data, size, &read, &position) &&
+	read == size;
+#else
+    uint8 *dest = (uint8*)data;
+    while (size > 0 && result)
+    {
+	ssize_t read = pread(file->fileDescriptor, dest, size, offset);
+	if (read <= 0)
+	{
+	    result = false;
+	}
+	else
+	{
+	    dest += read;
+	    offset += read;
+	    size -= (uint32)read;
+	}
+    }
+#endif
+
+    return result;
+}
+
+bool writeTileMapScratchFile(TileMapScratchFile *file, uint64 offset, void *data, uint32 size)
+{
+    bool result = file->opened;
+    
+#if defined(_WIN32)
+    OVERLAPPED position = {};
+    position.Offset = (DWORD)offset;
+    position.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD written = 0;
+    result = result && WriteFile(file->fileHandle, data, size, &written, &position) &&
+	written == size;
+#else
+    uint8 *source = (uint8*)data;
+    while (size > 0 && result)
+    {
+	ssize_t written = pwrite(file->fileDescriptor, source, size, offset);
+	if (written <= 0)
+	{
+	    result = false;
+	}
+	else
+	{
+	    source += written;
+	    offset += written;
+	    size -= (uint32)written;
+	}
+    }
+#endif
+
+    return result;
+}
+
+void closeTileMapScratchFile(TileMapScratchFile *file)
+{
+    if (file->opened)
+    {
+#if defined(_WIN32)
+	CloseHandle(file->fileHandle);
+#else
+	close(file->fileDescriptor);
+#endif
+    }
+
+    *file = {};
+}
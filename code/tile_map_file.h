@@ -6,8 +6,10 @@
 #include "stdint.h"
 
 typedef uint8_t uint8;
+typedef uint16_t uint16;
 typedef int32_t int32;
 typedef uint32_t uint32;
+typedef uint64_t uint64;
 
 struct Point2
 {
@@ -38,6 +40,70 @@ struct MapFileHeader
     char tileSheetFileName[256];
 };
 
+//NOTE(denis): version 1 files have no magic and start straight away with the
+// tile map name, since a map can't have an empty name a version 2 file is
+// recognized by the null byte at the start of "\0MAP"
+#define MAP_FILE_MAGIC 0x50414D00
+#define MAP_FILE_VERSION 2
+
+//NOTE(denis): a version 2 file is this header, then paletteSize Point2s which
+// are the sheet positions of the tiles used, then one index into the palette
+// for every tile in the map, each indexSize bytes (2 or 4) big
+struct MapFileHeaderV2
+{
+    uint32 magic;
+    uint32 version;
+
+    char tileMapName[256];
+
+    uint32 tileMapWidth;
+    uint32 tileMapHeight;
+    uint32 tileSize;
+
+    char tileSheetFileName[256];
+
+    uint32 paletteSize;
+    uint32 indexSize;
+};
+
+#define MAP_FILE_VERSION_COMPRESSED 3
+#define MAP_FILE_ROWS_PER_BLOCK 64
+
+//NOTE(denis): a version 3 file is the same as version 2 except the indices are
+// split into blocks of rowsPerBlock rows that are each compressed on their own,
+// after the palette comes a MapFileBlock for every block and then the blocks
+struct MapFileHeaderV3
+{
+    uint32 magic;
+    uint32 version;
+
+    char tileMapName[256];
+
+    uint32 tileMapWidth;
+    uint32 tileMapHeight;
+    uint32 tileSize;
+
+    char tileSheetFileName[256];
+
+    uint32 paletteSize;
+    uint32 indexSize;
+
+    uint32 rowsPerBlock;
+    uint32 numBlocks;
+
+    //NOTE(denis): keeps the block index after the palette 8 byte aligned
+    uint32 padding;
+};
+
+//NOTE(denis): offset is from the start of the file, a block that didn't get any
+// smaller is stored as is, which is the case when both sizes are the same
+struct MapFileBlock
+{
+    uint64 offset;
+    uint32 compressedSize;
+    uint32 uncompressedSize;
+};
+
 struct LoadTileMapResult
 {
     char *tileMapName;
@@ -50,7 +116,139 @@ struct LoadTileMapResult
     LoadedTile *tiles;
 };
 
+//NOTE(denis): a read-only view of a tile map file that is memory mapped,
+// nothing is copied so the strings, tiles, palette and indices all point
+// straight into the mapped file and are only valid until the view is closed
+struct TileMapView
+{
+    uint32 version;
+    
+    char *tileMapName;
+    uint32 tileMapWidth;
+    uint32 tileMapHeight;
+    uint32 tileSize;
+
+    char *tileSheetFileName;
+
+    //NOTE(denis): only used by version 1 files
+    const LoadedTile *tiles;
+
+    //NOTE(denis): only used by version 2 and 3 files
+    const Point2 *palette;
+    uint32 paletteSize;
+    const void *indices;
+    uint32 indexSize;
+
+    //NOTE(denis): only used by version 3 files, indices points at decodedIndices
+    // and a block is decompressed into it the first time one of its tiles is
+    // needed, by whichever thread gets there first
+    const MapFileBlock *blocks;
+    uint32 numBlocks;
+    uint32 rowsPerBlock;
+    uint8 *decodedIndices;
+    volatile int32 *blockStates;
+
+    void *mappedMemory;
+    uint64 mappedSize;
+    //NOTE(denis): the path the view was opened with
+    char *fileName;
+};
+
 //NOTE(denis): you want to call this function with the full path name
 LoadTileMapResult loadTileMap(char *fileName);
 
+//NOTE(denis): returns a view with mappedMemory == 0 if the file couldn't be
+// mapped or isn't a valid tile map file, works for every file version
+TileMapView openTileMapView(char *fileName);
+void closeTileMapView(TileMapView *view);
+
+//NOTE(denis): decompresses every block of a version 3 file up front using all
+// the cores, does nothing for the other versions
+void decodeAllTileMapBlocks(TileMapView *view);
+
+#define MAX_ROW_JOB_THREADS 16
+
+//NOTE(denis): doRows is given [firstRow, lastRow) of one job
+typedef void RowJob(void *data, uint32 firstRow, uint32 lastRow);
+
+//NOTE(denis): splits numRows rows into jobs of rowsPerJob rows and runs them on
+// up to maxThreads threads, one per core, returning once they're all done.
+// the calling thread is one of them
+void runRowJobs(RowJob *doRows, void *data, uint32 numRows, uint32 rowsPerJob,
+		uint32 maxThreads);
+
+//NOTE(denis): pos of the returned tile is relative to the top left of the map
+LoadedTile tileMapViewGetTile(TileMapView *view, uint32 x, uint32 y);
+//NOTE(denis): only for version 2 and 3 files, always less than paletteSize
+uint32 tileMapViewGetPaletteIndex(TileMapView *view, uint32 x, uint32 y);
+
+#define TILE_MAP_WRITE_BUFFER_SIZE (64*1024)
+
+//NOTE(denis): writes a file through a small reusable buffer, everything goes
+// into a temporary file next to the real one which only replaces it once the
+// whole file has been written, so a failed save never clobbers the old file
+struct TileMapFileWriter
+{
+#if defined(_WIN32)
+    void *fileHandle;
+#else
+    int fileDescriptor;
+#endif
+    
+    char *fileName;
+    char *tempFileName;
+
+    uint8 *buffer;
+    uint32 bufferUsed;
+
+    uint64 bytesWritten;
+    bool failed;
+};
+
+bool beginTileMapFile(TileMapFileWriter *writer, char *fileName);
+void writeToTileMapFile(TileMapFileWriter *writer, void *data, uint32 size);
+//NOTE(denis): returns false and leaves the old file alone if anything failed
+bool endTileMapFile(TileMapFileWriter *writer);
+//NOTE(denis): for when the old file can't be replaced yet, like while it's still
+// mapped. on success the finished temporary file is left where it is and its
+// name is handed back, it has to be freed with HEAP_FREE after it has been
+// given to replaceTileMapFile
+bool endTileMapFileInTemp(TileMapFileWriter *writer, char **tempFileName);
+//NOTE(denis): the temporary file is deleted if it can't be moved over fileName
+bool replaceTileMapFile(char *tempFileName, char *fileName);
+
+//NOTE(denis): where the next write will go in the file
+inline uint64 getTileMapFilePosition(TileMapFileWriter *writer)
+{
+    return writer->bytesWritten + writer->bufferUsed;
+}
+
+//NOTE(denis): overwrites bytes that were already written, used to fill in
+// the block index once the blocks are done
+void rewriteTileMapFile(TileMapFileWriter *writer, uint64 offset, void *data, uint32 size);
+
+//NOTE(denis): a temporary file for reading and writing fixed size records at
+// any offset, it is deleted when it is closed (or when the program dies). reads
+// and writes don't share a file position so they can come from any thread
+struct TileMapScratchFile
+{
+#if defined(_WIN32)
+    void *fileHandle;
+#else
+    int fileDescriptor;
+#endif
+
+    bool opened;
+};
+
+bool openTileMapScratchFile(TileMapScratchFile *file);
+bool readTileMapScratchFile(TileMapScratchFile *file, uint64 offset, void *data, uint32 size);
+bool writeTileMapScratchFile(TileMapScratchFile *file, uint64 offset, void *data, uint32 size);
+void closeTileMapScratchFile(TileMapScratchFile *file);
+
+//NOTE(denis): the codec used for the blocks of version 3 files, compressing
+// returns 0 if the result wouldn't fit in destSize bytes
+uint32 compressTileMapBlock(uint8 *source, uint32 sourceSize, uint8 *dest, uint32 destSize);
+bool decompressTileMapBlock(uint8 *source, uint32 sourceSize, uint8 *dest, uint32 destSize);
+
 #endif
@@ -0,0 +1,609 @@
+#include "ui_elements.h"
+#include "tile_map_history.h"
+#include "tile_map_panel.h"
+#include "file_saving_loading.h"
+
+#define NO_RECORD 0xFFFFFFFF
+#define INITIAL_EDIT_RECTS 64
+#define INITIAL_EDIT_RUNS 256
+#define INITIAL_EDIT_SPANS 256
+
+//NOTE(denis): followed by numRects HistoryRects, then numRuns HistoryRuns and
+// then numSpans TileMapEditSpans
+struct HistoryRecord
+{
+    uint32 size;
+    uint32 previous;
+    uint32 next;
+
+    uint32 numRects;
+    uint32 numRuns;
+    uint32 numSpans;
+};
+
+static inline HistoryRecord* getRecord(TileMapHistory *history, uint32 offset)
+{
+    return (HistoryRecord*)(history->buffer + offset);
+}
+
+static inline HistoryRect* getRecordRects(HistoryRecord *record)
+{
+    return (HistoryRect*)(record + 1);
+}
+
+static inline HistoryRun* getRecordRuns(HistoryRecord *record)
+{
+    return (HistoryRun*)(getRecordRects(record) + record->numRects);
+}
+
+static inline TileMapEditSpan* getRecordSpans(HistoryRecord *record)
+{
+    return (TileMapEditSpan*)(getRecordRuns(record) + record->numRuns);
+}
+
+//NOTE(denis): the edit arrays only ever grow, they're kept for the next edit
+static bool growHistoryArray(void **array, uint32 *maxCount, uint32 initialCount, uint32 elementSize)
+{
+    uint64 newMaxCount = *maxCount != 0 ? (uint64)*maxCount*2 : initialCount;
+    if (newMaxCount > 0xFFFFFFFF)
+	return false;
+
+    void *newArray = HEAP_ALLOC(newMaxCount*elementSize);
+    if (!newArray)
+	return false;
+
+    if (*array)
+    {
+	uint8 *source = (uint8*)*array;
+	uint8 *dest = (uint8*)newArray;
+	for (uint64 i = 0; i < (uint64)*maxCount*elementSize; ++i)
+	{
+	    dest[i] = source[i];
+	}
+
+	HEAP_FREE(*array);
+    }
+
+    *array = newArray;
+    *maxCount = (uint32)newMaxCount;
+
+    return true;
+}
+
+//NOTE(denis): runs don't carry on from one rectangle into the next
+static inline void addRun(TileMapHistory *history, uint32 firstRun, uint32 value,
+			  uint32 length = 1)
+{
+    if (history->numRuns > firstRun && history->runs[history->numRuns-1].value == value)
+    {
+	history->runs[history->numRuns-1].length += length;
+    }
+    else if (history->numRuns < history->maxRuns ||
+	     growHistoryArray((void**)&history->runs, &history->maxRuns, INITIAL_EDIT_RUNS,
+			      sizeof(HistoryRun)))
+    {
+	HistoryRun *run = history->runs + history->numRuns++;
+	run->length = length;
+	run->value = value;
+    }
+    else
+    {
+	history->editFailed = true;
+    }
+}
+
+void createTileMapHistory(TileMapHistory *history, uint32 maxSize)
+{
+    *history = {};
+    history->maxSize = maxSize;
+    history->oldest = NO_RECORD;
+    history->newest = NO_RECORD;
+    history->current = NO_RECORD;
+}
+
+void freeTileMapHistory(TileMapHistory *history)
+{
+    if (history->buffer)
+	HEAP_FREE(history->buffer);
+    if (history->rects)
+	HEAP_FREE(history->rects);
+    if (history->runs)
+	HEAP_FREE(history->runs);
+    if (history->spans)
+	HEAP_FREE(history->spans);
+
+    createTileMapHistory(history, history->maxSize);
+}
+
+void clearTileMapHistory(TileMapHistory *history)
+{
+    history->oldest = NO_RECORD;
+    history->newest = NO_RECORD;
+    history->current = NO_RECORD;
+
+    history->editing = false;
+    history->numRects = 0;
+    history->numRuns = 0;
+    history->numSpans = 0;
+}
+
+static void dropOldestRecord(TileMapHistory *history)
+{
+    if (history->oldest == history->newest)
+    {
+	history->oldest = NO_RECORD;
+	history->newest = NO_RECORD;
+	history->current = NO_RECORD;
+    }
+    else
+    {
+	if (history->current == history->oldest)
+	    history->current = NO_RECORD;
+
+	history->oldest = getRecord(history, history->oldest)->next;
+	getRecord(history, history->oldest)->previous = NO_RECORD;
+    }
+}
+
+//NOTE(denis): once something new is done the undone edits can't be redone
+static void dropUndoneRecords(TileMapHistory *history)
+{
+    if (history->current == NO_RECORD)
+    {
+	history->oldest = NO_RECORD;
+	history->newest = NO_RECORD;
+    }
+    else
+    {
+	history->newest = history->current;
+	getRecord(history, history->current)->next = NO_RECORD;
+    }
+}
+
+//NOTE(denis): records go one after another and wrap back to the start when
+// there's no room left at the end, whatever they land on is always the oldest
+static void addRecord(TileMapHistory *history)
+{
+    uint64 size = sizeof(HistoryRecord) + (uint64)history->numRects*sizeof(HistoryRect) +
+	(uint64)history->numRuns*sizeof(HistoryRun) +
+	(uint64)history->numSpans*sizeof(TileMapEditSpan);
+
+    dropUndoneRecords(history);
+
+    if (!history->buffer && size <= history->maxSize)
+	history->buffer = (uint8*)HEAP_ALLOC(history->maxSize);
+
+    //NOTE(denis): an edit that can't be undone means none of the ones before
+    // it can be either
+    if (!history->buffer || size > history->maxSize || history->editFailed)
+    {
+	clearTileMapHistory(history);
+	return;
+    }
+
+    uint32 newestEnd = 0;
+    if (history->newest != NO_RECORD)
+	newestEnd = history->newest + getRecord(history, history->newest)->size;
+
+    //NOTE(denis): when it wraps, the records between the newest one and the
+    // end of the buffer are skipped over so they go too
+    bool wraps = newestEnd + size > history->maxSize;
+    uint32 offset = wraps ? 0 : newestEnd;
+
+    while (history->oldest != NO_RECORD &&
+	   ((wraps && history->oldest >= newestEnd) ||
+	    (history->oldest < offset + size &&
+	     history->oldest + getRecord(history, history->oldest)->size > offset)))
+    {
+	dropOldestRecord(history);
+    }
+
+    HistoryRecord *record = getRecord(history, offset);
+    record->size = (uint32)size;
+    record->previous = history->newest;
+    record->next = NO_RECORD;
+    record->numRects = history->numRects;
+    record->numRuns = history->numRuns;
+    record->numSpans = history->numSpans;
+
+    HistoryRect *rects = getRecordRects(record);
+    for (uint32 i = 0; i < history->numRects; ++i)
+    {
+	rects[i] = history->rects[i];
+    }
+
+    HistoryRun *runs = getRecordRuns(record);
+    for (uint32 i = 0; i < history->numRuns; ++i)
+    {
+	runs[i] = history->runs[i];
+    }
+
+    TileMapEditSpan *spans = getRecordSpans(record);
+    for (uint32 i = 0; i < history->numSpans; ++i)
+    {
+	spans[i] = history->spans[i];
+    }
+
+    if (history->newest != NO_RECORD)
+	getRecord(history, history->newest)->next = offset;
+    else
+	history->oldest = offset;
+
+    history->newest = offset;
+    history->current = offset;
+}
+
+void beginTileMapEdit(TileMap *tileMap)
+{
+    TileMapHistory *history = &tileMap->history;
+
+    endTileMapEdit(tileMap);
+
+    history->editing = history->maxSize != 0;
+    history->editFailed = false;
+    history->numRects = 0;
+    history->numRuns = 0;
+    history->numSpans = 0;
+}
+
+void endTileMapEdit(TileMap *tileMap)
+{
+    TileMapHistory *history = &tileMap->history;
+
+    if (history->editing && history->numRects > 0)
+	addRecord(history);
+
+    history->editing = false;
+}
+
+//NOTE(denis): tiles of a mapped file that were never touched are copied out
+// of it first, so undoing can't leave them reading from a file that's gone
+static inline uint32 getTileValue(TileMap *tileMap, TileMapPage **page, int32 x, int32 y)
+{
+    TileMapPages *pages = &tileMap->pages;
+    uint32 result = UNSET_TILE_VALUE;
+
+    TileId id;
+    if (*page && tileIsInitialized(*page, x, y))
+    {
+	result = (*page)->ids[getIndexInPage(x, y)];
+    }
+    else if (tileMap->source.mappedMemory)
+    {
+	if (tileMap->getTileIdAt(x, y, &id))
+	    result = id;
+
+	*page = getTileMapPage(pages, x, y);
+    }
+    else if (pages->hasDefaultTile)
+    {
+	result = pages->defaultTileId;
+    }
+
+    return result;
+}
+
+void recordTileMapEdit(TileMap *tileMap, int32 firstX, int32 firstY,
+		       int32 lastX, int32 lastY, TileId newId)
+{
+    TileMapHistory *history = &tileMap->history;
+
+    if (!history->editing || history->editFailed)
+	return;
+
+    if (history->numRects == history->maxRects &&
+	!growHistoryArray((void**)&history->rects, &history->maxRects, INITIAL_EDIT_RECTS,
+			  sizeof(HistoryRect)))
+    {
+	history->editFailed = true;
+	return;
+    }
+
+    HistoryRect *rect = history->rects + history->numRects;
+    rect->firstX = firstX;
+    rect->firstY = firstY;
+    rect->lastX = lastX;
+    rect->lastY = lastY;
+    rect->newId = newId;
+    rect->firstRun = history->numRuns;
+    rect->oldValue = 0;
+    rect->firstSpan = 0;
+    rect->numSpans = 0;
+
+    for (int32 i = firstY; i <= lastY; ++i)
+    {
+	for (int32 j = firstX; j <= lastX;)
+	{
+	    int32 pageLastX = MIN(j - j%TILE_MAP_PAGE_SIZE + TILE_MAP_PAGE_SIZE-1, lastX);
+	    TileMapPage *page = getTileMapPage(&tileMap->pages, j, i);
+
+	    for (; j <= pageLastX; ++j)
+	    {
+		addRun(history, rect->firstRun, getTileValue(tileMap, &page, j, i));
+	    }
+	}
+    }
+
+    rect->numRuns = history->numRuns - rect->firstRun;
+
+    //NOTE(denis): painting over a tile with itself isn't worth keeping
+    HistoryRun *firstRun = history->runs + rect->firstRun;
+    if (rect->numRuns == 1 && firstRun->value == newId)
+	history->numRuns = rect->firstRun;
+    else
+	++history->numRects;
+}
+
+//NOTE(denis): the spans go on the end of the edit's spans sorted by row and
+// then by x, so undoing goes through the pages in order. it's a radix sort, one
+// counting pass by x and then a stable one by row, so it stays linear however
+// many spans share a row
+static bool addSortedSpans(TileMapHistory *history, TileMapEditSpan *spans, uint32 numSpans,
+			   int32 firstX, int32 firstY, int32 lastX, int32 lastY)
+{
+    while ((uint64)history->numSpans + numSpans > history->maxSpans)
+    {
+	if (!growHistoryArray((void**)&history->spans, &history->maxSpans, INITIAL_EDIT_SPANS,
+			      sizeof(TileMapEditSpan)))
+	{
+	    return false;
+	}
+    }
+
+    uint32 numColumns = lastX - firstX + 1;
+    uint32 numRows = lastY - firstY + 1;
+    uint32 numCounts = MAX(numColumns, numRows) + 1;
+    uint32 *counts = (uint32*)HEAP_ALLOC((uint64)numCounts*sizeof(uint32));
+    TileMapEditSpan *byX = (TileMapEditSpan*)HEAP_ALLOC((uint64)numSpans*sizeof(TileMapEditSpan));
+    if (!counts || !byX)
+    {
+	if (counts)
+	{
+	    HEAP_FREE(counts);
+	}
+	if (byX)
+	{
+	    HEAP_FREE(byX);
+	}
+	return false;
+    }
+
+    for (uint32 i = 0; i < numSpans; ++i)
+    {
+	++counts[spans[i].firstX - firstX + 1];
+    }
+    for (uint32 i = 1; i <= numColumns; ++i)
+    {
+	counts[i] += counts[i-1];
+    }
+    for (uint32 i = 0; i < numSpans; ++i)
+    {
+	byX[counts[spans[i].firstX - firstX]++] = spans[i];
+    }
+
+    for (uint32 i = 0; i < numCounts; ++i)
+    {
+	counts[i] = 0;
+    }
+
+    TileMapEditSpan *sorted = history->spans + history->numSpans;
+    for (uint32 i = 0; i < numSpans; ++i)
+    {
+	++counts[byX[i].y - firstY + 1];
+    }
+    for (uint32 i = 1; i <= numRows; ++i)
+    {
+	counts[i] += counts[i-1];
+    }
+    for (uint32 i = 0; i < numSpans; ++i)
+    {
+	sorted[counts[byX[i].y - firstY]++] = byX[i];
+    }
+
+    history->numSpans += numSpans;
+
+    HEAP_FREE(counts);
+    HEAP_FREE(byX);
+
+    return true;
+}
+
+void recordTileMapEditSpans(TileMap *tileMap, int32 firstX, int32 firstY,
+			    int32 lastX, int32 lastY, TileId newId, uint32 oldValue,
+			    TileMapEditSpan *spans, uint32 numSpans)
+{
+    TileMapHistory *history = &tileMap->history;
+
+    if (!history->editing || history->editFailed || numSpans == 0)
+	return;
+
+    if (history->numRects == history->maxRects &&
+	!growHistoryArray((void**)&history->rects, &history->maxRects, INITIAL_EDIT_RECTS,
+			  sizeof(HistoryRect)))
+    {
+	history->editFailed = true;
+	return;
+    }
+
+    uint32 firstSpan = history->numSpans;
+    if (!addSortedSpans(history, spans, numSpans, firstX, firstY, lastX, lastY))
+    {
+	history->editFailed = true;
+	return;
+    }
+
+    HistoryRect *rect = history->rects + history->numRects++;
+    rect->firstX = firstX;
+    rect->firstY = firstY;
+    rect->lastX = lastX;
+    rect->lastY = lastY;
+    rect->newId = newId;
+    rect->firstRun = 0;
+    rect->numRuns = 0;
+    rect->oldValue = oldValue;
+    rect->firstSpan = firstSpan;
+    rect->numSpans = numSpans;
+}
+
+static void unsetTiles(TileMap *tileMap, int32 firstX, int32 firstY, int32 lastX, int32 lastY)
+{
+    TileMapPages *pages = &tileMap->pages;
+
+    for (int32 i = firstY; i <= lastY; ++i)
+    {
+	tileMapBeforeEdit(tileMap, i);
+
+	for (int32 j = firstX; j <= lastX;)
+	{
+	    int32 pageLastX = MIN(j - j%TILE_MAP_PAGE_SIZE + TILE_MAP_PAGE_SIZE-1, lastX);
+
+	    TileMapPage *page = getTileMapPage(pages, j, i);
+	    if (page)
+		unsetTileRowInPage(pages, page, j, pageLastX, i);
+
+	    j = pageLastX + 1;
+	}
+    }
+
+    tileMap->markTilesChanged(firstX, firstY, lastX, lastY);
+}
+
+//NOTE(denis): a run is put back as at most three rectangles, the end of the row
+// it starts in, all the whole rows after that and the start of the row it ends in
+static void restoreRect(TileMap *tileMap, HistoryRect *rect, HistoryRun *runs,
+			uint32 firstRun, uint32 numRuns)
+{
+    int32 width = rect->lastX - rect->firstX + 1;
+    uint64 position = 0;
+
+    for (uint32 i = 0; i < numRuns; ++i)
+    {
+	HistoryRun *run = runs + firstRun + i;
+	uint64 length = run->length;
+
+	while (length > 0)
+	{
+	    int32 x = rect->firstX + (int32)(position % width);
+	    int32 y = rect->firstY + (int32)(position / width);
+
+	    int32 lastX = rect->lastX;
+	    int32 lastY = y;
+	    uint64 numTiles = 0;
+
+	    if (x == rect->firstX && length >= (uint64)width)
+	    {
+		lastY = y + (int32)(length/width) - 1;
+		numTiles = (uint64)(lastY - y + 1)*width;
+	    }
+	    else
+	    {
+		lastX = (int32)MIN((uint64)x + length - 1, (uint64)rect->lastX);
+		numTiles = lastX - x + 1;
+	    }
+
+	    if (run->value == UNSET_TILE_VALUE)
+		unsetTiles(tileMap, x, y, lastX, lastY);
+	    else
+		tileMap->fillRect(x, y, lastX, lastY, (TileId)run->value);
+
+	    position += numTiles;
+	    length -= numTiles;
+	}
+    }
+}
+
+//NOTE(denis): straight into the pages like the fill that made them, the map
+// only hears about it once for the whole rectangle
+static void restoreSpans(TileMap *tileMap, HistoryRect *rect, TileMapEditSpan *spans,
+			 uint32 value)
+{
+    TileMapPages *pages = &tileMap->pages;
+
+    for (uint32 i = 0; i < rect->numSpans; ++i)
+    {
+	TileMapEditSpan *span = spans + rect->firstSpan + i;
+
+	tileMapBeforeEdit(tileMap, span->y);
+
+	for (int32 x = span->firstX; x <= span->lastX;)
+	{
+	    int32 pageLastX = MIN(x - x%TILE_MAP_PAGE_SIZE + TILE_MAP_PAGE_SIZE-1, span->lastX);
+
+	    if (value == UNSET_TILE_VALUE)
+	    {
+		TileMapPage *page = getTileMapPage(pages, x, span->y);
+		if (page)
+		    unsetTileRowInPage(pages, page, x, pageLastX, span->y);
+	    }
+	    else
+	    {
+		TileMapPage *page = getTileMapPageToEdit(pages, x, span->y);
+		if (page)
+		    setTileRowInPage(pages, page, x, pageLastX, span->y, (TileId)value);
+	    }
+
+	    x = pageLastX + 1;
+	}
+    }
+
+    tileMap->markTilesChanged(rect->firstX, rect->firstY, rect->lastX, rect->lastY);
+}
+
+bool undoTileMapEdit(TileMap *tileMap)
+{
+    TileMapHistory *history = &tileMap->history;
+    endTileMapEdit(tileMap);
+
+    bool result = history->current != NO_RECORD;
+    if (result)
+    {
+	HistoryRecord *record = getRecord(history, history->current);
+	HistoryRect *rects = getRecordRects(record);
+	HistoryRun *runs = getRecordRuns(record);
+	TileMapEditSpan *spans = getRecordSpans(record);
+
+	for (uint32 i = record->numRects; i > 0; --i)
+	{
+	    HistoryRect *rect = rects + i-1;
+	    if (rect->numSpans > 0)
+		restoreSpans(tileMap, rect, spans, rect->oldValue);
+	    else
+		restoreRect(tileMap, rect, runs, rect->firstRun, rect->numRuns);
+	}
+
+	history->current = record->previous;
+    }
+
+    return result;
+}
+
+bool redoTileMapEdit(TileMap *tileMap)
+{
+    TileMapHistory *history = &tileMap->history;
+    endTileMapEdit(tileMap);
+
+    uint32 next = history->oldest;
+    if (history->current != NO_RECORD)
+	next = getRecord(history, history->current)->next;
+
+    bool result = next != NO_RECORD;
+    if (result)
+    {
+	HistoryRecord *record = getRecord(history, next);
+	HistoryRect *rects = getRecordRects(record);
+	TileMapEditSpan *spans = getRecordSpans(record);
+
+	for (uint32 i = 0; i < record->numRects; ++i)
+	{
+	    HistoryRect *rect = rects + i;
+	    if (rect->numSpans > 0)
+		restoreSpans(tileMap, rect, spans, rect->newId);
+	    else
+		tileMap->fillRect(rect->firstX, rect->firstY, rect->lastX, rect->lastY, rect->newId);
+	}
+
+	history->current = next;
+    }
+
+    return result;
+}
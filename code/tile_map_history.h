@@ -0,0 +1,108 @@
+#ifndef TILE_MAP_HISTORY_H_
+#define TILE_MAP_HISTORY_H_
+
+#include "denis_meta.h"
+#include "tile_map_pages.h"
+
+struct TileMap;
+
+#define DEFAULT_UNDO_MEMORY_LIMIT (64*1024*1024)
+
+//NOTE(denis): value is a tile id, or UNSET_TILE_VALUE for tiles that were
+// never set
+#define UNSET_TILE_VALUE 0xFFFFFFFF
+
+struct HistoryRun
+{
+    uint32 length;
+    uint32 value;
+};
+
+//NOTE(denis): tiles firstX to lastX of row y
+struct TileMapEditSpan
+{
+    int32 y;
+    int32 firstX;
+    int32 lastX;
+};
+
+//NOTE(denis): the runs cover the rectangle a row at a time. edits that only
+// set some of the tiles in it have spans instead, the tiles in those were all
+// oldValue before and are all newId after, the rest of the rectangle is left out
+struct HistoryRect
+{
+    int32 firstX;
+    int32 firstY;
+    int32 lastX;
+    int32 lastY;
+    TileId newId;
+
+    uint32 firstRun;
+    uint32 numRuns;
+
+    uint32 oldValue;
+    uint32 firstSpan;
+    uint32 numSpans;
+};
+
+//NOTE(denis): every edit is a list of rectangles that were each set to one
+// tile, along with what was in them before run length encoded, or just the
+// spans of them that were set for fills that didn't cover their rectangle. the
+// records are kept in a ring buffer of maxSize bytes and the oldest ones are
+// dropped to make room for new ones, so undoing a fill only costs as much as
+// the number of runs or spans it has. records are offsets into the buffer
+struct TileMapHistory
+{
+    uint8 *buffer;
+    uint32 maxSize;
+
+    uint32 oldest;
+    uint32 newest;
+    //NOTE(denis): the last record that hasn't been undone, the ones after it
+    // can be redone until the next edit
+    uint32 current;
+
+    //NOTE(denis): the edit being recorded, it only goes in the buffer once it
+    // is finished
+    bool editing;
+    bool editFailed;
+    HistoryRect *rects;
+    uint32 numRects;
+    uint32 maxRects;
+    HistoryRun *runs;
+    uint32 numRuns;
+    uint32 maxRuns;
+    TileMapEditSpan *spans;
+    uint32 numSpans;
+    uint32 maxSpans;
+};
+
+//NOTE(denis): maxSize is in bytes, 0 keeps no history at all
+void createTileMapHistory(TileMapHistory *history, uint32 maxSize);
+void freeTileMapHistory(TileMapHistory *history);
+//NOTE(denis): forgets every edit, for when the tiles are changed in a way that
+// can't be undone
+void clearTileMapHistory(TileMapHistory *history);
+
+//NOTE(denis): everything the map records between these is undone in one go
+void beginTileMapEdit(TileMap *tileMap);
+void endTileMapEdit(TileMap *tileMap);
+//NOTE(denis): has to be called right before every tile in the rectangle is
+// set to newId, does nothing if no edit has been begun
+void recordTileMapEdit(TileMap *tileMap, int32 firstX, int32 firstY,
+		       int32 lastX, int32 lastY, TileId newId);
+
+//NOTE(denis): for edits that only set some of the tiles in the rectangle to
+// newId, can be called before or after they were set since only the spans are
+// kept. the spans are the tiles that were set, in any order, and can't overlap.
+// every one of them is put back to oldValue on undo, so tiles that only looked
+// the same can come back with the same id. does nothing if no edit has been begun
+void recordTileMapEditSpans(TileMap *tileMap, int32 firstX, int32 firstY,
+			    int32 lastX, int32 lastY, TileId newId, uint32 oldValue,
+			    TileMapEditSpan *spans, uint32 numSpans);
+
+//NOTE(denis): return false if there was nothing to undo or redo
+bool undoTileMapEdit(TileMap *tileMap);
+bool redoTileMapEdit(TileMap *tileMap);
+
+#endif
@@ -0,0 +1,556 @@
+#include "tile_map_pages.h"
+#include "file_saving_loading.h"
+#include "SDL_thread.h"
+#include "SDL_mutex.h"
+#include "SDL_atomic.h"
+
+//NOTE(denis): a budget smaller than this would have the pages on screen
+// pushing each other out
+#define MIN_RESIDENT_PAGES 64
+#define MAX_PREFETCH_REQUESTS 64
+
+struct PrefetchRequest
+{
+    TileMapPage **table;
+    TileMapScratchFile file;
+    uint32 index;
+    uint32 fileSlot;
+
+    TileMapPage *page;
+    bool cancelled;
+};
+
+//NOTE(denis): one background thread reads pages for every map, requests are
+// taken oldest first and finished pages wait until the map installs them
+static SDL_Thread *_prefetchThread;
+static SDL_mutex *_prefetchLock;
+static SDL_cond *_prefetchChanged;
+static bool _prefetchQuit;
+
+static PrefetchRequest _requests[MAX_PREFETCH_REQUESTS];
+static uint32 _numRequests;
+static PrefetchRequest _inFlight;
+static bool _hasInFlight;
+static PrefetchRequest _finished[MAX_PREFETCH_REQUESTS];
+static uint32 _numFinished;
+
+static inline uint64 getFileOffset(uint32 fileSlot)
+{
+    return (uint64)(fileSlot-1)*TILE_MAP_PAGE_DATA_SIZE;
+}
+
+static inline uint32 getPageIndex(TileMapPages *pages, int32 x, int32 y)
+{
+    return (y/TILE_MAP_PAGE_SIZE)*pages->widthInPages + x/TILE_MAP_PAGE_SIZE;
+}
+
+//NOTE(denis): returns 0 if there wasn't enough memory or the read failed
+static TileMapPage* readPage(TileMapScratchFile *file, uint32 fileSlot, uint32 index)
+{
+    TileMapPage *result = (TileMapPage*)HEAP_ALLOC(sizeof(TileMapPage));
+
+    if (result && !readTileMapScratchFile(file, getFileOffset(fileSlot), result,
+					  TILE_MAP_PAGE_DATA_SIZE))
+    {
+	HEAP_FREE(result);
+	result = 0;
+    }
+
+    if (result)
+	result->index = index;
+
+    return result;
+}
+
+static int prefetchThreadProc(void *data)
+{
+    SDL_LockMutex(_prefetchLock);
+
+    while (!_prefetchQuit)
+    {
+	while (_numRequests == 0 && !_prefetchQuit)
+	    SDL_CondWait(_prefetchChanged, _prefetchLock);
+
+	if (_prefetchQuit)
+	    break;
+
+	_inFlight = _requests[0];
+	_hasInFlight = true;
+	--_numRequests;
+	for (uint32 i = 0; i < _numRequests; ++i)
+	{
+	    _requests[i] = _requests[i+1];
+	}
+
+	SDL_UnlockMutex(_prefetchLock);
+	TileMapPage *page = readPage(&_inFlight.file, _inFlight.fileSlot, _inFlight.index);
+	SDL_LockMutex(_prefetchLock);
+
+	if (page && !_inFlight.cancelled && _numFinished < MAX_PREFETCH_REQUESTS)
+	{
+	    _inFlight.page = page;
+	    _finished[_numFinished++] = _inFlight;
+	}
+	else if (page)
+	{
+	    HEAP_FREE(page);
+	}
+
+	_hasInFlight = false;
+	SDL_CondBroadcast(_prefetchChanged);
+    }
+
+    SDL_UnlockMutex(_prefetchLock);
+
+    return 0;
+}
+
+static bool startPrefetchThread()
+{
+    if (!_prefetchLock)
+    {
+	_prefetchLock = SDL_CreateMutex();
+	_prefetchChanged = SDL_CreateCond();
+    }
+
+    if (!_prefetchThread && _prefetchLock && _prefetchChanged)
+	_prefetchThread = SDL_CreateThread(prefetchThreadProc, "TileMapPrefetch", 0);
+
+    return _prefetchThread != 0;
+}
+
+void stopTileMapPrefetching()
+{
+    if (!_prefetchLock)
+	return;
+
+    if (_prefetchThread)
+    {
+	SDL_LockMutex(_prefetchLock);
+	_prefetchQuit = true;
+	SDL_CondBroadcast(_prefetchChanged);
+	SDL_UnlockMutex(_prefetchLock);
+
+	SDL_WaitThread(_prefetchThread, 0);
+	_prefetchThread = 0;
+    }
+
+    for (uint32 i = 0; i < _numFinished; ++i)
+    {
+	HEAP_FREE(_finished[i].page);
+    }
+    _numFinished = 0;
+    _numRequests = 0;
+
+    if (_prefetchChanged)
+	SDL_DestroyCond(_prefetchChanged);
+    SDL_DestroyMutex(_prefetchLock);
+    _prefetchChanged = 0;
+    _prefetchLock = 0;
+    _prefetchQuit = false;
+}
+
+static bool prefetchIsPending(TileMapPage **table, uint32 index)
+{
+    bool result = _hasInFlight && _inFlight.table == table && _inFlight.index == index;
+
+    for (uint32 i = 0; i < _numRequests && !result; ++i)
+    {
+	result = _requests[i].table == table && _requests[i].index == index;
+    }
+    for (uint32 i = 0; i < _numFinished && !result; ++i)
+    {
+	result = _finished[i].table == table && _finished[i].index == index;
+    }
+
+    return result;
+}
+
+//NOTE(denis): removes anything for the page, or every page of the map if
+// allPages is set, and waits for the read in flight if it's one of them
+static void cancelPrefetches(TileMapPage **table, uint32 index, bool allPages)
+{
+    if (!_prefetchLock)
+	return;
+
+    SDL_LockMutex(_prefetchLock);
+
+    uint32 numKept = 0;
+    for (uint32 i = 0; i < _numRequests; ++i)
+    {
+	bool matches = _requests[i].table == table && (allPages || _requests[i].index == index);
+	if (!matches)
+	    _requests[numKept++] = _requests[i];
+    }
+    _numRequests = numKept;
+
+    numKept = 0;
+    for (uint32 i = 0; i < _numFinished; ++i)
+    {
+	bool matches = _finished[i].table == table && (allPages || _finished[i].index == index);
+	if (matches)
+	{
+	    HEAP_FREE(_finished[i].page);
+	}
+	else
+	{
+	    _finished[numKept++] = _finished[i];
+	}
+    }
+    _numFinished = numKept;
+
+    if (_hasInFlight && _inFlight.table == table && (allPages || _inFlight.index == index))
+    {
+	_inFlight.cancelled = true;
+
+	//NOTE(denis): the page file is about to be closed
+	while (allPages && _hasInFlight)
+	    SDL_CondWait(_prefetchChanged, _prefetchLock);
+    }
+
+    SDL_UnlockMutex(_prefetchLock);
+}
+
+static void unlinkPage(TileMapPages *pages, TileMapPage *page)
+{
+    if (page->newer)
+	page->newer->older = page->older;
+    else
+	pages->newest = page->older;
+
+    if (page->older)
+	page->older->newer = page->newer;
+    else
+	pages->oldest = page->newer;
+
+    page->newer = 0;
+    page->older = 0;
+}
+
+static void linkPageAsNewest(TileMapPages *pages, TileMapPage *page)
+{
+    page->newer = 0;
+    page->older = pages->newest;
+
+    if (pages->newest)
+	pages->newest->newer = page;
+    else
+	pages->oldest = page;
+
+    pages->newest = page;
+}
+
+static inline void touchPage(TileMapPages *pages, TileMapPage *page)
+{
+    if (page != pages->newest)
+    {
+	unlinkPage(pages, page);
+	linkPageAsNewest(pages, page);
+    }
+}
+
+//NOTE(denis): a page that hasn't changed since it was read in is already in
+// the file, so it can just be dropped
+static bool evictPage(TileMapPages *pages, TileMapPage *page)
+{
+    if (!pages->file.opened && !openTileMapScratchFile(&pages->file))
+	return false;
+
+    uint32 *fileSlot = pages->fileSlots + page->index;
+    bool written = *fileSlot != 0 && !page->dirty;
+
+    if (!written)
+    {
+	if (*fileSlot == 0)
+	    *fileSlot = ++pages->numFileSlots;
+
+	written = writeTileMapScratchFile(&pages->file, getFileOffset(*fileSlot),
+					  page, TILE_MAP_PAGE_DATA_SIZE);
+    }
+
+    if (written)
+    {
+	unlinkPage(pages, page);
+	pages->table[page->index] = 0;
+	--pages->numResident;
+	HEAP_FREE(page);
+    }
+
+    return written;
+}
+
+//NOTE(denis): the save thread reads straight out of the pages, so nothing is
+// written out of a map while it is being saved and it just goes over budget
+// for a bit. the save thread can be reading the table while a page is put in
+// it, so the page goes in with an atomic store after it is filled in
+static void addResidentPage(TileMapPages *pages, TileMapPage *page)
+{
+    if (pages->maxResident != 0 && !tileMapSaveIsReading(pages))
+    {
+	while (pages->numResident >= pages->maxResident && pages->oldest &&
+	       evictPage(pages, pages->oldest))
+	{
+	}
+    }
+
+    linkPageAsNewest(pages, page);
+    ++pages->numResident;
+
+    SDL_AtomicSetPtr((void**)(pages->table + page->index), page);
+}
+
+bool createTileMapPages(TileMapPages *pages, int32 widthInTiles, int32 heightInTiles,
+			uint64 memoryBudget)
+{
+    *pages = {};
+    pages->widthInTiles = widthInTiles;
+    pages->heightInTiles = heightInTiles;
+    pages->widthInPages = (widthInTiles + TILE_MAP_PAGE_SIZE-1)/TILE_MAP_PAGE_SIZE;
+    pages->heightInPages = (heightInTiles + TILE_MAP_PAGE_SIZE-1)/TILE_MAP_PAGE_SIZE;
+
+    if (memoryBudget != 0)
+	pages->maxResident = (uint32)MAX(memoryBudget/sizeof(TileMapPage), MIN_RESIDENT_PAGES);
+
+    uint64 numPages = (uint64)pages->widthInPages*pages->heightInPages;
+    pages->table = (TileMapPage**)HEAP_ALLOC(numPages*sizeof(TileMapPage*));
+    pages->fileSlots = (uint32*)HEAP_ALLOC(numPages*sizeof(uint32));
+
+    bool result = pages->table && pages->fileSlots;
+    if (!result)
+	freeTileMapPages(pages);
+
+    return result;
+}
+
+void freeTileMapPages(TileMapPages *pages)
+{
+    if (pages->table)
+    {
+	cancelPrefetches(pages->table, 0, true);
+
+	uint64 numPages = (uint64)pages->widthInPages*pages->heightInPages;
+	for (uint64 i = 0; i < numPages; ++i)
+	{
+	    if (pages->table[i])
+		HEAP_FREE(pages->table[i]);
+	}
+
+	HEAP_FREE(pages->table);
+    }
+    if (pages->fileSlots)
+	HEAP_FREE(pages->fileSlots);
+
+    closeTileMapScratchFile(&pages->file);
+
+    *pages = {};
+}
+
+TileMapPage* getTileMapPage(TileMapPages *pages, int32 x, int32 y)
+{
+    uint32 index = getPageIndex(pages, x, y);
+    TileMapPage *result = pages->table[index];
+
+    if (result)
+    {
+	touchPage(pages, result);
+    }
+    else if (pages->fileSlots[index] != 0)
+    {
+	//NOTE(denis): a read that is still going could finish after this page
+	// is written out again, so it can't be used
+	cancelPrefetches(pages->table, index, false);
+
+	result = readPage(&pages->file, pages->fileSlots[index], index);
+	if (result)
+	    addResidentPage(pages, result);
+    }
+
+    return result;
+}
+
+TileMapPage* getResidentTileMapPage(TileMapPages *pages, int32 x, int32 y, bool *inPageFile)
+{
+    uint32 index = getPageIndex(pages, x, y);
+    TileMapPage *result = pages->table[index];
+
+    *inPageFile = !result && pages->fileSlots[index] != 0;
+
+    return result;
+}
+
+TileMapPage* getTileMapPageToEdit(TileMapPages *pages, int32 x, int32 y)
+{
+    TileMapPage *result = getTileMapPage(pages, x, y);
+
+    uint32 index = getPageIndex(pages, x, y);
+    if (!result && pages->fileSlots[index] == 0)
+    {
+	result = (TileMapPage*)HEAP_ALLOC(sizeof(TileMapPage));
+
+	if (result)
+	{
+	    if (pages->hasDefaultTile && pages->defaultTileId != 0)
+	    {
+		for (int32 i = 0; i < TILE_MAP_PAGE_SIZE*TILE_MAP_PAGE_SIZE; ++i)
+		{
+		    result->ids[i] = pages->defaultTileId;
+		}
+	    }
+
+	    result->index = index;
+	    addResidentPage(pages, result);
+	}
+    }
+
+    return result;
+}
+
+void prefetchTileMapPages(TileMapPages *pages, int32 firstPageX, int32 firstPageY,
+			  int32 lastPageX, int32 lastPageY)
+{
+    //NOTE(denis): nothing to read back in if nothing was ever written out
+    if (pages->numFileSlots == 0 || !startPrefetchThread())
+	return;
+
+    firstPageX = MAX(firstPageX, 0);
+    firstPageY = MAX(firstPageY, 0);
+    lastPageX = MIN(lastPageX, pages->widthInPages-1);
+    lastPageY = MIN(lastPageY, pages->heightInPages-1);
+
+    SDL_LockMutex(_prefetchLock);
+
+    //NOTE(denis): whatever was asked for last frame is probably off screen by now
+    _numRequests = 0;
+
+    for (int32 i = firstPageY; i <= lastPageY && _numRequests < MAX_PREFETCH_REQUESTS; ++i)
+    {
+	for (int32 j = firstPageX; j <= lastPageX && _numRequests < MAX_PREFETCH_REQUESTS; ++j)
+	{
+	    uint32 index = i*pages->widthInPages + j;
+
+	    if (!pages->table[index] && pages->fileSlots[index] != 0 &&
+		!prefetchIsPending(pages->table, index))
+	    {
+		PrefetchRequest *request = _requests + _numRequests++;
+		*request = {};
+		request->table = pages->table;
+		request->file = pages->file;
+		request->index = index;
+		request->fileSlot = pages->fileSlots[index];
+	    }
+	}
+    }
+
+    if (_numRequests > 0)
+	SDL_CondBroadcast(_prefetchChanged);
+
+    SDL_UnlockMutex(_prefetchLock);
+}
+
+void installPrefetchedTileMapPages(TileMapPages *pages)
+{
+    if (!_prefetchLock)
+	return;
+
+    TileMapPage *installed[MAX_PREFETCH_REQUESTS];
+    uint32 numInstalled = 0;
+
+    SDL_LockMutex(_prefetchLock);
+
+    uint32 numKept = 0;
+    for (uint32 i = 0; i < _numFinished; ++i)
+    {
+	if (_finished[i].table == pages->table)
+	    installed[numInstalled++] = _finished[i].page;
+	else
+	    _finished[numKept++] = _finished[i];
+    }
+    _numFinished = numKept;
+
+    SDL_UnlockMutex(_prefetchLock);
+
+    //NOTE(denis): outside the lock, making room can mean writing pages out
+    for (uint32 i = 0; i < numInstalled; ++i)
+    {
+	TileMapPage *page = installed[i];
+
+	if (!pages->table[page->index])
+	{
+	    addResidentPage(pages, page);
+	}
+	else
+	{
+	    HEAP_FREE(page);
+	}
+    }
+}
+
+void copyTileMapPageRows(TileMapPages *pages, TileMapView *source, TileId *sourceIds,
+			 int32 firstRow, int32 numRows, TileId *ids)
+{
+    int32 widthInTiles = pages->widthInTiles;
+    TileMapPage *filePage = 0;
+
+    int32 lastRow = firstRow + numRows;
+    for (int32 row = firstRow; row < lastRow;)
+    {
+	int32 pageY = row/TILE_MAP_PAGE_SIZE;
+	int32 pageLastRow = MIN((pageY+1)*TILE_MAP_PAGE_SIZE, lastRow);
+
+	for (int32 j = 0; j < pages->widthInPages; ++j)
+	{
+	    uint32 index = pageY*pages->widthInPages + j;
+	    int32 firstColumn = j*TILE_MAP_PAGE_SIZE;
+	    int32 numColumns = MIN(TILE_MAP_PAGE_SIZE, widthInTiles - firstColumn);
+
+	    //NOTE(denis): pages that were written out are read into a page of our
+	    // own instead of going back in the table. the main thread can be
+	    // putting pages in the table while this runs on the save thread
+	    TileMapPage *page = (TileMapPage*)SDL_AtomicGetPtr((void**)(pages->table + index));
+	    if (!page && pages->fileSlots[index] != 0)
+	    {
+		if (!filePage)
+		    filePage = (TileMapPage*)HEAP_ALLOC(sizeof(TileMapPage));
+
+		if (filePage && readTileMapScratchFile(&pages->file,
+						       getFileOffset(pages->fileSlots[index]),
+						       filePage, TILE_MAP_PAGE_DATA_SIZE))
+		{
+		    page = filePage;
+		}
+	    }
+
+	    for (int32 i = row; i < pageLastRow; ++i)
+	    {
+		TileId *dest = ids + (uint64)(i - firstRow)*widthInTiles + firstColumn;
+
+		if (page)
+		{
+		    TileId *pageRow = page->ids + (i%TILE_MAP_PAGE_SIZE)*TILE_MAP_PAGE_SIZE;
+		    for (int32 k = 0; k < numColumns; ++k)
+			dest[k] = pageRow[k];
+		}
+		else
+		{
+		    for (int32 k = 0; k < numColumns; ++k)
+			dest[k] = pages->defaultTileId;
+		}
+
+		if (source)
+		{
+		    uint64 initialized = page ? page->initializedRows[i%TILE_MAP_PAGE_SIZE] : 0;
+		    for (int32 k = 0; k < numColumns; ++k)
+		    {
+			if (!(initialized & (1ull << k)))
+			    dest[k] = sourceIds[tileMapViewGetPaletteIndex(source, firstColumn + k, i)];
+		    }
+		}
+	    }
+	}
+
+	row = pageLastRow;
+    }
+
+    if (filePage)
+	HEAP_FREE(filePage);
+}
@@ -0,0 +1,176 @@
+#ifndef TILE_MAP_PAGES_H_
+#define TILE_MAP_PAGES_H_
+
+#include "denis_meta.h"
+#include "tile_map_file.h"
+
+//NOTE(denis): a tile in a map is just an index into the map's palette of
+// tile sheet positions, the size and screen position of a tile all come from
+// the map and where the tile is in it. 32 bits, a big sheet of small tiles has
+// more than 65536 cells
+typedef uint32 TileId;
+
+//NOTE(denis): tiles are stored in pages of TILE_MAP_PAGE_SIZE by
+// TILE_MAP_PAGE_SIZE tiles that are only allocated the first time a tile in
+// them is set, each row of a page has a bit per tile saying whether it is set
+// so pages can't be more than 64 tiles wide
+#define TILE_MAP_PAGE_SIZE 64
+
+struct TileMapPage
+{
+    TileId ids[TILE_MAP_PAGE_SIZE*TILE_MAP_PAGE_SIZE];
+    uint64 initializedRows[TILE_MAP_PAGE_SIZE];
+
+    //NOTE(denis): everything above here is what gets written to the page file
+    TileMapPage *newer;
+    TileMapPage *older;
+    uint32 index;
+    bool dirty;
+};
+
+#define TILE_MAP_PAGE_DATA_SIZE \
+    (sizeof(TileId)*TILE_MAP_PAGE_SIZE*TILE_MAP_PAGE_SIZE + sizeof(uint64)*TILE_MAP_PAGE_SIZE)
+
+//NOTE(denis): the page table of a map. once more than maxResident pages are
+// in memory the least recently used ones are written out to a scratch file and
+// read back in when they are needed again, pages around the visible part of
+// the map are read back in ahead of time on a background thread
+struct TileMapPages
+{
+    //NOTE(denis): widthInPages by heightInPages, 0 for pages that aren't in memory
+    TileMapPage **table;
+    //NOTE(denis): where each page is in the page file + 1, 0 if it never went there
+    uint32 *fileSlots;
+
+    int32 widthInTiles;
+    int32 heightInTiles;
+    int32 widthInPages;
+    int32 heightInPages;
+
+    //NOTE(denis): the default tile can only be given before any page is made,
+    // after that tiles that aren't set read as it
+    bool hasDefaultTile;
+    TileId defaultTileId;
+    uint64 numInitialized;
+
+    //NOTE(denis): maxResident is 0 if there's no limit
+    uint32 numResident;
+    uint32 maxResident;
+    TileMapPage *newest;
+    TileMapPage *oldest;
+
+    TileMapScratchFile file;
+    uint32 numFileSlots;
+};
+
+//NOTE(denis): only allocates the page table, so it takes the same time
+// however big the map is. memoryBudget is in bytes, 0 for no limit
+bool createTileMapPages(TileMapPages *pages, int32 widthInTiles, int32 heightInTiles,
+			uint64 memoryBudget);
+void freeTileMapPages(TileMapPages *pages);
+
+//NOTE(denis): returns 0 if none of the page's tiles were ever set, pages that
+// were written out to the page file are read back in
+TileMapPage* getTileMapPage(TileMapPages *pages, int32 x, int32 y);
+//NOTE(denis): only looks at what is in memory, nothing is read back in, evicted
+// or marked as used. inPageFile is set if the page exists but is out in the
+// page file, which is when 0 is returned for a page with tiles set
+TileMapPage* getResidentTileMapPage(TileMapPages *pages, int32 x, int32 y, bool *inPageFile);
+//NOTE(denis): makes the page if it doesn't exist, returns 0 if there wasn't
+// enough memory for it
+TileMapPage* getTileMapPageToEdit(TileMapPages *pages, int32 x, int32 y);
+
+//NOTE(denis): the rectangle is in pages, anything in it that is in the page
+// file gets read back in on the background thread. only the latest call
+// counts, anything asked for before that which hasn't started is dropped
+void prefetchTileMapPages(TileMapPages *pages, int32 firstPageX, int32 firstPageY,
+			  int32 lastPageX, int32 lastPageY);
+//NOTE(denis): puts the pages the background thread has finished reading into the map
+void installPrefetchedTileMapPages(TileMapPages *pages);
+//NOTE(denis): stops the background thread and throws away anything it read,
+// a prefetch after this starts it again
+void stopTileMapPrefetching();
+
+//NOTE(denis): safe to call from the save thread while the map is being edited,
+// as long as the rows being copied aren't. tiles that were never set are read
+// from source if there is one, sourceIds turns its palette indices into ids.
+// otherwise they come out as the default tile, or 0 if the map has none
+void copyTileMapPageRows(TileMapPages *pages, TileMapView *source, TileId *sourceIds,
+			 int32 firstRow, int32 numRows, TileId *ids);
+
+inline uint32 getIndexInPage(int32 x, int32 y)
+{
+    return (y%TILE_MAP_PAGE_SIZE)*TILE_MAP_PAGE_SIZE + x%TILE_MAP_PAGE_SIZE;
+}
+
+inline bool tileIsInitialized(TileMapPage *page, int32 x, int32 y)
+{
+    return (page->initializedRows[y%TILE_MAP_PAGE_SIZE] & (1ull << (x%TILE_MAP_PAGE_SIZE))) != 0;
+}
+
+inline void setTileInPage(TileMapPages *pages, TileMapPage *page, int32 x, int32 y, TileId id)
+{
+    uint64 *row = page->initializedRows + y%TILE_MAP_PAGE_SIZE;
+    uint64 bit = 1ull << (x%TILE_MAP_PAGE_SIZE);
+
+    if (!(*row & bit))
+	++pages->numInitialized;
+
+    *row |= bit;
+    page->ids[getIndexInPage(x, y)] = id;
+    page->dirty = true;
+}
+
+inline uint32 countSetBits(uint64 bits)
+{
+    bits = bits - ((bits >> 1) & 0x5555555555555555ull);
+    bits = (bits & 0x3333333333333333ull) + ((bits >> 2) & 0x3333333333333333ull);
+    bits = (bits + (bits >> 4)) & 0x0F0F0F0F0F0F0F0Full;
+    return (uint32)((bits*0x0101010101010101ull) >> 56);
+}
+
+//NOTE(denis): the bits of a page row for tiles firstX to lastX
+inline uint64 getRowBits(int32 firstX, int32 lastX)
+{
+    int32 numTiles = lastX - firstX + 1;
+    uint64 result = numTiles == TILE_MAP_PAGE_SIZE ? ~0ull : ((1ull << numTiles) - 1);
+
+    return result << (firstX%TILE_MAP_PAGE_SIZE);
+}
+
+//NOTE(denis): sets tiles firstX to lastX of row y, they all have to be in the page
+inline void setTileRowInPage(TileMapPages *pages, TileMapPage *page, int32 firstX,
+			     int32 lastX, int32 y, TileId id)
+{
+    int32 numTiles = lastX - firstX + 1;
+    uint64 bits = getRowBits(firstX, lastX);
+
+    uint64 *row = page->initializedRows + y%TILE_MAP_PAGE_SIZE;
+    pages->numInitialized += countSetBits(bits & ~*row);
+    *row |= bits;
+
+    //NOTE(denis): a plain loop over one contiguous row, the compiler turns it
+    // into wide stores
+    TileId *ids = page->ids + getIndexInPage(firstX, y);
+    for (int32 i = 0; i < numTiles; ++i)
+    {
+	ids[i] = id;
+    }
+
+    page->dirty = true;
+}
+
+//NOTE(denis): the tiles go back to never having been set
+inline void unsetTileRowInPage(TileMapPages *pages, TileMapPage *page, int32 firstX,
+			       int32 lastX, int32 y)
+{
+    uint64 bits = getRowBits(firstX, lastX);
+
+    uint64 *row = page->initializedRows + y%TILE_MAP_PAGE_SIZE;
+    pages->numInitialized -= countSetBits(bits & *row);
+    *row &= ~bits;
+
+    page->dirty = true;
+}
+
+#endif
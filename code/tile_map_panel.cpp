@@ -6,6 +6,10 @@
 #include "new_tile_map_panel.h"
 #include "tile_set_panel.h"
 #include "tile_map_panel.h"
+#include "file_saving_loading.h"
+#include "SDL_thread.h"
+#include "SDL_atomic.h"
+#include "SDL_cpuinfo.h"
 
 #define MIN_WIDTH 800
 #define MIN_HEIGHT 670
@@ -18,14 +22,43 @@
 #define SCROLL_BAR_BIG_COLOUR 0xFFFFFFFF
 #define SCROLL_BAR_SMALL_COLOUR 0xFFAAAAAA
 
-static const enum ToolType
+enum ToolType
 {
     PAINT_TOOL,
     FILL_TOOL,
     MOVE_TOOL
 };
 
+//NOTE(denis): the fill tool either fills a rectangle dragged out with the
+// mouse, which is what it always did, or everything joined to the clicked tile
+// that looks the same as it. the corner of the fill tool icon has the key for
+// the mode it is in, r or b, and clicking the icon while the fill tool is
+// already picked switches to the other one
+enum FillMode
+{
+    FILL_RECTANGLE,
+    FILL_CONNECTED,
+    NUM_FILL_MODES
+};
+
 static SDL_Renderer *_renderer;
+static bool _chunksSupported;
+static uint32 _frameNumber;
+static int32 _numChunkTextures;
+
+//NOTE(denis): for tiles that aren't set, or when the tile set has no tile colours
+#define OVERVIEW_EMPTY_COLOUR 0xFF808080
+
+//NOTE(denis): the zoomed out view of the selected map. it is kept along with
+// what it was made from and only made again once one of those changes
+static SDL_Texture *_overview;
+static int32 _overviewWidth;
+static int32 _overviewHeight;
+static TileMap *_overviewMap;
+static Vector2 _overviewDrawOffset;
+static real32 _overviewZoom;
+static uint32 *_overviewColours;
+static bool _overviewDrewTileSet;
 static UIPanel _panel;
 
 static SDL_Rect _tileMapArea;
@@ -33,28 +66,138 @@ static TexturedRect _defaultTile;
 
 static bool _selectionVisible;
 static Vector2 _startSelectPos;
+//NOTE(denis): the corners of the rectangle being filled, in tiles
+static Vector2 _startSelectTile;
+static Vector2 _endSelectTile;
 static TexturedRect _selectionBox;
 
+//NOTE(denis): a paint stroke is one edit from its first painted tile until the
+// mouse button comes back up
+static bool _paintStrokeOpen;
+
 static Button _createNewButton;
 static Button _paintToolIcon;
 static Button _fillToolIcon;
 static Button _moveToolIcon;
 static TexturedRect _selectedToolIcon;
 static TexturedRect _hoveringToolIcon;
+static TexturedRect _fillModeLabels[NUM_FILL_MODES];
 
 static bool _hoverToolIconVisible;
 static Vector2 _lastFramePos;
 
 static ToolType _currentTool;
 static ToolType _previousTool;
+static FillMode _fillMode;
+
+static uint64 _memoryBudget = DEFAULT_TILE_MAP_MEMORY_BUDGET;
+static uint32 _undoMemoryLimit = DEFAULT_UNDO_MEMORY_LIMIT;
+
+//NOTE(denis): the open maps live in a slot map, a handle is a slot plus the
+// generation the slot was on when the map was added. removing a map bumps the
+// generation so old handles stop matching, and free slots are chained through
+// nextFreeSlot so adding and removing never have to search or shift anything
+#define NO_FREE_SLOT 0xFFFFFFFF
+#define INITIAL_TILE_MAP_SLOTS 16
+
+struct TileMapSlot
+{
+    TileMap tileMap;
+    uint32 generation;
+    uint32 nextFreeSlot;
+    bool inUse;
+};
+
+static TileMapSlot *_tileMapSlots;
+static uint32 _numTileMapSlots;
+static uint32 _maxTileMapSlots;
+static uint32 _firstFreeSlot = NO_FREE_SLOT;
+static TileMapHandle _selectedTileMap;
 
-static TileMap _tileMaps[15];
-static uint32 _numTileMaps;
-static uint32 _selectedTileMap;
+//NOTE(denis): what the panel works on while no map is selected
+static TileMap _noTileMap;
 
 static SDL_Cursor *_arrowCursor;
 static SDL_Cursor *_handCursor;
 
+//NOTE(denis): returns a handle that matches no map if there wasn't room for
+// another slot, the map is still the caller's in that case
+static TileMapHandle addTileMapSlot(TileMap tileMap)
+{
+    uint32 slot = _firstFreeSlot;
+
+    if (slot != NO_FREE_SLOT)
+    {
+	_firstFreeSlot = _tileMapSlots[slot].nextFreeSlot;
+    }
+    else
+    {
+	if (_numTileMapSlots == _maxTileMapSlots)
+	{
+	    uint32 newMaxSlots = MAX(_maxTileMapSlots*2, INITIAL_TILE_MAP_SLOTS);
+	    TileMapSlot *newSlots = (TileMapSlot*)growArray(_tileMapSlots, _maxTileMapSlots,
+							    sizeof(TileMapSlot), newMaxSlots);
+	    if (!newSlots)
+	    {
+		TileMapHandle none = {};
+		return none;
+	    }
+
+	    _tileMapSlots = newSlots;
+	    _maxTileMapSlots = newMaxSlots;
+	}
+
+	slot = _numTileMapSlots++;
+	_tileMapSlots[slot].generation = 1;
+    }
+
+    TileMapSlot *newSlot = _tileMapSlots + slot;
+    newSlot->tileMap = tileMap;
+    newSlot->inUse = true;
+
+    TileMapHandle result = {slot, newSlot->generation};
+    return result;
+}
+
+static void freeTileMapSlot(TileMapHandle handle)
+{
+    TileMapSlot *slot = _tileMapSlots + handle.slot;
+
+    slot->tileMap = {};
+    slot->inUse = false;
+    ++slot->generation;
+    slot->nextFreeSlot = _firstFreeSlot;
+    _firstFreeSlot = handle.slot;
+}
+
+//NOTE(denis): returns 0 if the map the handle was for has been removed
+static TileMap* getTileMap(TileMapHandle handle)
+{
+    TileMap *result = 0;
+
+    if (handle.slot < _numTileMapSlots)
+    {
+	TileMapSlot *slot = _tileMapSlots + handle.slot;
+	if (slot->inUse && slot->generation == handle.generation)
+	    result = &slot->tileMap;
+    }
+
+    return result;
+}
+
+static TileMap* getSelectedTileMap()
+{
+    TileMap *result = getTileMap(_selectedTileMap);
+
+    if (!result)
+    {
+	_noTileMap = {};
+	result = &_noTileMap;
+    }
+
+    return result;
+}
+
 static TileMap initializeTileMap(char *name, uint32 width, uint32 height,
 				 uint32 tileSize)
 {
@@ -66,17 +209,41 @@ static TileMap initializeTileMap(char *name, uint32 width, uint32 height,
     result.widthInTiles = width;
     result.heightInTiles = height;
     result.tileSize = tileSize;
+    result.zoom = 1.0f;
+    result.overviewDirty = true;
+
+    createTileMapHistory(&result.history, _undoMemoryLimit);
 
     return result;
 }
 
+static void freeScrollBars(TileMap *tileMap)
+{
+    if (tileMap->horizontalBar.backgroundRect.image)
+    {
+	ui_delete(&tileMap->horizontalBar.backgroundRect);
+	ui_delete(&tileMap->horizontalBar.scrollingRect);
+    }
+    if (tileMap->verticalBar.backgroundRect.image)
+    {
+	ui_delete(&tileMap->verticalBar.backgroundRect);
+	ui_delete(&tileMap->verticalBar.scrollingRect);
+    }
+
+    tileMap->horizontalBar = {};
+    tileMap->verticalBar = {};
+}
+
+//NOTE(denis): has to be called again whenever the zoom changes, the scroll
+// bars are made again for the new size of the map
 static void fitTileMapToPanel(TileMap *tileMap)
 {
     //TODO(denis): centre the tile map on the screen
+
+    freeScrollBars(tileMap);
     
-    uint32 tileSize = tileMap->tileSize;
-    int32 tileMapWidth = tileMap->widthInTiles*tileSize;
-    int32 tileMapHeight = tileMap->heightInTiles*tileSize;
+    int32 tileMapWidth = tileMap->getRect().w;
+    int32 tileMapHeight = tileMap->getRect().h;
     
     tileMap->visibleArea = _tileMapArea;
     tileMap->visibleArea.w = MIN(tileMapWidth, _tileMapArea.w);
@@ -85,7 +252,7 @@ static void fitTileMapToPanel(TileMap *tileMap)
     if (tileMapWidth > _tileMapArea.w)
     {
 	real32 sizeRatio = (real32)_tileMapArea.w/(real32)tileMapWidth;
-	int32 smallBarWidth = (int32)(_tileMapArea.w*sizeRatio);
+	int32 smallBarWidth = MAX((int32)(_tileMapArea.w*sizeRatio), SCROLL_BAR_WIDTH);
 	int32 barX = _tileMapArea.x;
 	int32 barY = tileMap->offset.y + tileMap->visibleArea.h;
 	
@@ -99,7 +266,7 @@ static void fitTileMapToPanel(TileMap *tileMap)
 	real32 sizeRatio = (real32)_tileMapArea.h/(real32)tileMapHeight;
 	int32 barX = tileMap->offset.x + tileMap->visibleArea.w;
 	int32 barY = _tileMapArea.y;
-	int32 smallBarWidth = (int32)(_tileMapArea.h*sizeRatio);
+	int32 smallBarWidth = MAX((int32)(_tileMapArea.h*sizeRatio), SCROLL_BAR_WIDTH);
 	
         tileMap->verticalBar =
 	    ui_createScrollBar(barX, barY, _tileMapArea.h, smallBarWidth,
@@ -108,46 +275,732 @@ static void fitTileMapToPanel(TileMap *tileMap)
     }
 }
 
-static TileMap createNewTileMap(char *name, uint32 width, uint32 height,
-				uint32 tileSize)
+static TileMap createNewTileMap(char *name, uint32 width, uint32 height,
+				uint32 tileSize)
+{
+    TileMap newTileMap = initializeTileMap(name, width, height, tileSize);
+    
+    //NOTE(denis): the map starts out as the selected tile without touching a
+    // single page, so even a huge map is made straight away
+    TileId id;
+    if (newTileMap.createTiles(_memoryBudget) && tileSetPanelGetSelectedTile().size != 0 &&
+	newTileMap.getTileId(tileSetPanelGetSelectedTile().sheetPos, &id))
+    {
+	newTileMap.pages.hasDefaultTile = true;
+	newTileMap.pages.defaultTileId = id;
+    }
+
+    return newTileMap;
+}
+
+#define INITIAL_PALETTE_SIZE 64
+
+static inline uint32 hashSheetPos(Point2 sheetPos)
+{
+    return ((uint32)sheetPos.x*73856093u) ^ ((uint32)sheetPos.y*19349663u);
+}
+
+//NOTE(denis): the first palette entry with a sheet position keeps it, so a
+// source palette with the same position twice still looks up the same way
+static void addToPaletteLookup(TileMap *tileMap, uint32 paletteIndex)
+{
+    Point2 sheetPos = tileMap->palette[paletteIndex];
+    uint32 mask = tileMap->paletteLookupSize-1;
+    
+    uint32 slot = hashSheetPos(sheetPos) & mask;
+    while (tileMap->paletteLookup[slot] != 0)
+    {
+	Point2 existing = tileMap->palette[tileMap->paletteLookup[slot]-1];
+	if (existing.x == sheetPos.x && existing.y == sheetPos.y)
+	    return;
+	
+	slot = (slot + 1) & mask;
+    }
+
+    tileMap->paletteLookup[slot] = paletteIndex + 1;
+}
+
+//NOTE(denis): the lookup is kept at most half full, it is rebuilt whenever
+// the palette grows. it is probed with a mask so its size has to be a power
+// of two, file palettes can be any size
+static bool reservePalette(TileMap *tileMap, uint32 newMaxSize)
+{
+    if (newMaxSize <= tileMap->maxPaletteSize)
+	return true;
+
+    uint32 newLookupSize = 1;
+    while (newLookupSize < newMaxSize*2)
+	newLookupSize *= 2;
+
+    Point2 *newPalette = (Point2*)HEAP_ALLOC(newMaxSize*sizeof(Point2));
+    uint32 *newLookup = (uint32*)HEAP_ALLOC(newLookupSize*sizeof(uint32));
+
+    if (!newPalette || !newLookup)
+    {
+	if (newPalette)
+	    HEAP_FREE(newPalette);
+	if (newLookup)
+	    HEAP_FREE(newLookup);
+	return false;
+    }
+
+    for (uint32 i = 0; i < tileMap->paletteSize; ++i)
+    {
+	newPalette[i] = tileMap->palette[i];
+    }
+
+    if (tileMap->palette)
+	HEAP_FREE(tileMap->palette);
+    if (tileMap->paletteLookup)
+	HEAP_FREE(tileMap->paletteLookup);
+
+    tileMap->palette = newPalette;
+    tileMap->maxPaletteSize = newMaxSize;
+    tileMap->paletteLookup = newLookup;
+    tileMap->paletteLookupSize = newLookupSize;
+
+    for (uint32 i = 0; i < tileMap->paletteSize; ++i)
+    {
+	addToPaletteLookup(tileMap, i);
+    }
+
+    return true;
+}
+
+bool TileMap::createTiles(uint64 memoryBudget)
+{
+    bool result = createTileMapPages(&pages, widthInTiles, heightInTiles, memoryBudget) &&
+	reservePalette(this, INITIAL_PALETTE_SIZE);
+    if (!result)
+	freeTiles();
+
+    return result;
+}
+
+void TileMap::freeTiles()
+{
+    freeTileMapPages(&pages);
+    freeTileMapHistory(&history);
+    
+    if (palette)
+	HEAP_FREE(palette);
+    if (paletteLookup)
+	HEAP_FREE(paletteLookup);
+
+    palette = 0;
+    paletteSize = 0;
+    maxPaletteSize = 0;
+    paletteLookup = 0;
+    paletteLookupSize = 0;
+}
+
+bool TileMap::getTileId(Point2 sheetPos, TileId *id)
+{
+    uint32 mask = paletteLookupSize-1;
+    
+    uint32 slot = hashSheetPos(sheetPos) & mask;
+    while (paletteLookup[slot] != 0)
+    {
+	Point2 existing = palette[paletteLookup[slot]-1];
+	if (existing.x == sheetPos.x && existing.y == sheetPos.y)
+	{
+	    *id = (TileId)(paletteLookup[slot]-1);
+	    return true;
+	}
+	
+	slot = (slot + 1) & mask;
+    }
+
+    if (paletteSize == MAX_TILE_MAP_PALETTE_SIZE)
+	return false;
+
+    if (paletteSize == maxPaletteSize &&
+	!reservePalette(this, MIN(maxPaletteSize*2, MAX_TILE_MAP_PALETTE_SIZE)))
+    {
+	return false;
+    }
+
+    palette[paletteSize] = sheetPos;
+    addToPaletteLookup(this, paletteSize);
+    *id = (TileId)paletteSize++;
+    
+    return true;
+}
+
+//NOTE(denis): returns false if the tile couldn't be given an id, only possible
+// for version 1 files using more than MAX_TILE_MAP_PALETTE_SIZE tiles, or if
+// its page couldn't be allocated
+static bool copyTileFromSource(TileMap *tileMap, int32 x, int32 y)
+{
+    TileId id = 0;
+    bool result = true;
+    
+    if (tileMap->sourceIds)
+	id = tileMap->sourceIds[tileMapViewGetPaletteIndex(&tileMap->source, x, y)];
+    else
+	result = tileMap->getTileId(tileMapViewGetTile(&tileMap->source, x, y).sheetPos, &id);
+
+    //NOTE(denis): the tile doesn't change, but a save reading the row could see
+    // its bit set before its id
+    TileMapPage *page = 0;
+    if (result)
+    {
+	tileMapBeforeEdit(tileMap, y);
+	page = getTileMapPageToEdit(&tileMap->pages, x, y);
+    }
+
+    if (page)
+	setTileInPage(&tileMap->pages, page, x, y, id);
+
+    return page != 0;
+}
+
+bool TileMap::getTileIdAt(int32 x, int32 y, TileId *id)
+{
+    TileMapPage *page = getTileMapPage(&pages, x, y);
+
+    bool result = page && tileIsInitialized(page, x, y);
+    if (!result && source.mappedMemory)
+    {
+	result = copyTileFromSource(this, x, y);
+	page = getTileMapPage(&pages, x, y);
+    }
+
+    if (result)
+	*id = page->ids[getIndexInPage(x, y)];
+    else if (pages.hasDefaultTile)
+	*id = pages.defaultTileId;
+
+    return result || pages.hasDefaultTile;
+}
+
+bool TileMap::getTile(int32 x, int32 y, Point2 *sheetPos)
+{
+    TileId id;
+    bool result = getTileIdAt(x, y, &id);
+    if (result)
+	*sheetPos = palette[id];
+
+    return result;
+}
+
+bool TileMap::peekTile(int32 x, int32 y, Point2 *sheetPos)
+{
+    bool result = true;
+    bool inPageFile;
+    TileMapPage *page = getResidentTileMapPage(&pages, x, y, &inPageFile);
+    
+    if (page && tileIsInitialized(page, x, y))
+	*sheetPos = palette[page->ids[getIndexInPage(x, y)]];
+    else if (inPageFile)
+	result = false;
+    else if (source.mappedMemory)
+	*sheetPos = tileMapViewGetTile(&source, x, y).sheetPos;
+    else if (pages.hasDefaultTile)
+	*sheetPos = palette[pages.defaultTileId];
+    else
+	result = false;
+
+    return result;
+}
+
+bool TileMap::setTile(int32 x, int32 y, Point2 sheetPos)
+{
+    TileId id;
+    bool result = getTileId(sheetPos, &id) && setTileId(x, y, id);
+
+    return result;
+}
+
+bool TileMap::setTileId(int32 x, int32 y, TileId id)
+{
+    TileMapPage *page = getTileMapPageToEdit(&pages, x, y);
+    if (page)
+    {
+	tileMapBeforeEdit(this, y);
+	recordTileMapEdit(this, x, y, x, y, id);
+	
+	setTileInPage(&pages, page, x, y, id);
+	markTileChanged(x, y);
+    }
+
+    return page != 0;
+}
+
+//NOTE(denis): each page's part is recorded once the page is there, so if one
+// can't be had the history only holds the tiles that were really set
+bool TileMap::fillRect(int32 firstX, int32 firstY, int32 lastX, int32 lastY, TileId id)
+{
+    bool result = true;
+
+    for (int32 y = firstY; y <= lastY && result;)
+    {
+	int32 pageLastY = MIN(y - y%TILE_MAP_PAGE_SIZE + TILE_MAP_PAGE_SIZE-1, lastY);
+	bool rowsSaved = false;
+
+	for (int32 x = firstX; x <= lastX && result;)
+	{
+	    int32 pageLastX = MIN(x - x%TILE_MAP_PAGE_SIZE + TILE_MAP_PAGE_SIZE-1, lastX);
+
+	    TileMapPage *page = getTileMapPageToEdit(&pages, x, y);
+	    if (page)
+	    {
+		if (!rowsSaved)
+		{
+		    for (int32 i = y; i <= pageLastY; ++i)
+		    {
+			tileMapBeforeEdit(this, i);
+		    }
+		    rowsSaved = true;
+		}
+
+		recordTileMapEdit(this, x, y, pageLastX, pageLastY, id);
+		
+		for (int32 i = y; i <= pageLastY; ++i)
+		{
+		    setTileRowInPage(&pages, page, x, pageLastX, i, id);
+		}
+	    }
+
+	    result = page != 0;
+	    x = pageLastX + 1;
+	}
+
+	y = pageLastY + 1;
+    }
+
+    markTilesChanged(firstX, firstY, lastX, lastY);
+
+    return result;
+}
+
+//NOTE(denis): the rectangle is joined onto the last one when the two make a
+// rectangle together, so strokes and fills don't use up a rectangle a tile
+static void addChangedTiles(ChangedTiles *changes, int32 firstX, int32 firstY,
+			    int32 lastX, int32 lastY)
+{
+    SDL_Rect rect = {firstX, firstY, lastX - firstX + 1, lastY - firstY + 1};
+    SDL_Rect *last = changes->numRects > 0 ? changes->rects + changes->numRects-1 : 0;
+
+    if (last && rect.x >= last->x && rect.x + rect.w <= last->x + last->w &&
+	rect.y >= last->y && rect.y + rect.h <= last->y + last->h)
+    {
+	//NOTE(denis): already covered
+    }
+    else if (last && rect.y == last->y && rect.h == last->h &&
+	     rect.x <= last->x + last->w && rect.x + rect.w >= last->x)
+    {
+	int32 right = MAX(rect.x + rect.w, last->x + last->w);
+	last->x = MIN(rect.x, last->x);
+	last->w = right - last->x;
+    }
+    else if (last && rect.x == last->x && rect.w == last->w &&
+	     rect.y <= last->y + last->h && rect.y + rect.h >= last->y)
+    {
+	int32 bottom = MAX(rect.y + rect.h, last->y + last->h);
+	last->y = MIN(rect.y, last->y);
+	last->h = bottom - last->y;
+    }
+    else
+    {
+	if (changes->numRects == MAX_CHANGED_TILE_RECTS)
+	{
+	    SDL_Rect bounds = changes->rects[0];
+	    for (uint32 i = 1; i < changes->numRects; ++i)
+	    {
+		SDL_UnionRect(&bounds, changes->rects + i, &bounds);
+	    }
+
+	    changes->rects[0] = bounds;
+	    changes->numRects = 1;
+	}
+
+	changes->rects[changes->numRects++] = rect;
+    }
+}
+
+void TileMap::markTileChanged(int32 x, int32 y)
+{
+    ui_requestRedraw();
+    overviewDirty = true;
+    addChangedTiles(&changedTiles, x, y, x, y);
+    
+    if (chunks)
+    {
+	int32 chunkX = x/chunkSizeInTiles;
+	int32 chunkY = y/chunkSizeInTiles;
+	chunks[chunkX + chunkY*widthInChunks].dirty = true;
+    }
+}
+
+void TileMap::markTilesChanged(int32 firstX, int32 firstY, int32 lastX, int32 lastY)
+{
+    ui_requestRedraw();
+    overviewDirty = true;
+    addChangedTiles(&changedTiles, firstX, firstY, lastX, lastY);
+
+    if (chunks)
+    {
+	for (int32 i = firstY/chunkSizeInTiles; i <= lastY/chunkSizeInTiles; ++i)
+	{
+	    for (int32 j = firstX/chunkSizeInTiles; j <= lastX/chunkSizeInTiles; ++j)
+	    {
+		chunks[j + i*widthInChunks].dirty = true;
+	    }
+	}
+    }
+}
+
+void TileMap::detachSource()
+{
+    if (source.mappedMemory)
+    {
+	//NOTE(denis): every block is about to be used, so they're all
+	// decompressed up front across the cores
+	decodeAllTileMapBlocks(&source);
+
+	for (int32 i = 0; i < heightInTiles; ++i)
+	{
+	    for (int32 j = 0; j < widthInTiles; ++j)
+	    {
+		TileMapPage *page = getTileMapPage(&pages, j, i);
+		if (!page || !tileIsInitialized(page, j, i))
+		    copyTileFromSource(this, j, i);
+	    }
+	}
+
+	closeSource();
+    }
+}
+
+void TileMap::closeSource()
+{
+    closeTileMapView(&source);
+    if (sourceIds)
+    {
+	HEAP_FREE(sourceIds);
+    }
+    sourceIds = 0;
+}
+
+void TileMap::attachSource(TileMapView *view, TileId *ids)
+{
+    closeSource();
+
+    source = *view;
+    sourceIds = ids;
+}
+
+//NOTE(denis): a run of tiles in row y that was just filled, the row dy away
+// from it is the one that still has to be looked at
+struct FillSpan
+{
+    int32 y;
+    int32 firstX;
+    int32 lastX;
+    int32 dy;
+};
+
+#define INITIAL_FILL_STACK_SIZE 256
+
+struct FillState
+{
+    TileMap *tileMap;
+    TileId id;
+
+    //NOTE(denis): whether a tile with that id gets filled, unsetMatches is for
+    // tiles that were never set in a map with no default tile. ids added to
+    // the palette during the fill are never for the tile being filled over
+    uint8 *idMatches;
+    uint32 numIdMatches;
+    bool unsetMatches;
+
+    //NOTE(denis): the page the last tile looked at was in, forgotten after
+    // every edit since making a page can write this one out to the page file
+    TileMapPage *page;
+    int32 pageX;
+    int32 pageY;
+
+    FillSpan *stack;
+    uint32 stackSize;
+    uint32 maxStackSize;
+
+    //NOTE(denis): every run that was filled and the rectangle around them all,
+    // for the history, redrawing and the minimap once the fill is done
+    TileMapEditSpan *filled;
+    uint32 numFilled;
+    uint32 maxFilled;
+    int32 firstX;
+    int32 firstY;
+    int32 lastX;
+    int32 lastY;
+};
+
+static inline void forgetFillPage(FillState *fill)
+{
+    fill->page = 0;
+    fill->pageX = -1;
+    fill->pageY = -1;
+}
+
+static bool tileMatchesFill(FillState *fill, int32 x, int32 y)
+{
+    TileMap *tileMap = fill->tileMap;
+    TileMapPages *pages = &tileMap->pages;
+
+    int32 pageX = x/TILE_MAP_PAGE_SIZE;
+    int32 pageY = y/TILE_MAP_PAGE_SIZE;
+    if (pageX != fill->pageX || pageY != fill->pageY)
+    {
+	fill->page = getTileMapPage(pages, x, y);
+	fill->pageX = pageX;
+	fill->pageY = pageY;
+    }
+
+    bool set = fill->page && tileIsInitialized(fill->page, x, y);
+    if (!set && tileMap->source.mappedMemory)
+    {
+	set = copyTileFromSource(tileMap, x, y);
+	fill->page = getTileMapPage(pages, x, y);
+    }
+
+    bool result;
+    if (set || pages->hasDefaultTile)
+    {
+	TileId id = set ? fill->page->ids[getIndexInPage(x, y)] : pages->defaultTileId;
+	result = id < fill->numIdMatches && fill->idMatches[id] != 0;
+    }
+    else
+    {
+	result = fill->unsetMatches;
+    }
+
+    return result;
+}
+
+//NOTE(denis): the run goes straight into the pages, the rest of the map only
+// hears about the fill once it is done
+static bool fillRow(FillState *fill, int32 firstX, int32 lastX, int32 y)
+{
+    TileMap *tileMap = fill->tileMap;
+    TileMapPages *pages = &tileMap->pages;
+
+    if (fill->numFilled == fill->maxFilled)
+    {
+	uint32 newMaxFilled = MAX(fill->maxFilled*2, INITIAL_FILL_STACK_SIZE);
+	TileMapEditSpan *newFilled =
+	    (TileMapEditSpan*)HEAP_ALLOC(newMaxFilled*sizeof(TileMapEditSpan));
+	if (!newFilled)
+	    return false;
+
+	for (uint32 i = 0; i < fill->numFilled; ++i)
+	{
+	    newFilled[i] = fill->filled[i];
+	}
+	if (fill->filled)
+	{
+	    HEAP_FREE(fill->filled);
+	}
+
+	fill->filled = newFilled;
+	fill->maxFilled = newMaxFilled;
+    }
+
+    TileMapEditSpan *span = fill->filled + fill->numFilled++;
+    span->y = y;
+    span->firstX = firstX;
+    span->lastX = lastX;
+
+    if (fill->numFilled == 1)
+    {
+	fill->firstX = firstX;
+	fill->firstY = y;
+	fill->lastX = lastX;
+	fill->lastY = y;
+    }
+    else
+    {
+	fill->firstX = MIN(fill->firstX, firstX);
+	fill->firstY = MIN(fill->firstY, y);
+	fill->lastX = MAX(fill->lastX, lastX);
+	fill->lastY = MAX(fill->lastY, y);
+    }
+
+    tileMapBeforeEdit(tileMap, y);
+
+    bool result = true;
+    for (int32 x = firstX; x <= lastX && result;)
+    {
+	int32 pageLastX = MIN(x - x%TILE_MAP_PAGE_SIZE + TILE_MAP_PAGE_SIZE-1, lastX);
+
+	TileMapPage *page = getTileMapPageToEdit(pages, x, y);
+	if (page)
+	    setTileRowInPage(pages, page, x, pageLastX, y, fill->id);
+
+	result = page != 0;
+	x = pageLastX + 1;
+    }
+
+    //NOTE(denis): making a page can write the one we had out to the page file
+    forgetFillPage(fill);
+
+    return result;
+}
+
+static bool pushFillSpan(FillState *fill, int32 y, int32 firstX, int32 lastX, int32 dy)
+{
+    if (y < 0 || y >= fill->tileMap->heightInTiles)
+	return true;
+
+    if (fill->stackSize == fill->maxStackSize)
+    {
+	uint32 newMaxSize = MAX(fill->maxStackSize*2, INITIAL_FILL_STACK_SIZE);
+	FillSpan *newStack = (FillSpan*)HEAP_ALLOC(newMaxSize*sizeof(FillSpan));
+	if (!newStack)
+	    return false;
+
+	for (uint32 i = 0; i < fill->stackSize; ++i)
+	{
+	    newStack[i] = fill->stack[i];
+	}
+	if (fill->stack)
+	{
+	    HEAP_FREE(fill->stack);
+	}
+
+	fill->stack = newStack;
+	fill->maxStackSize = newMaxSize;
+    }
+
+    FillSpan *span = fill->stack + fill->stackSize++;
+    span->y = y;
+    span->firstX = firstX;
+    span->lastX = lastX;
+    span->dy = dy;
+
+    return true;
+}
+
+//NOTE(denis): scanline fill, every run of matching tiles is filled in one go
+// and only the runs that touch it in the rows above and below go on the stack.
+// filled tiles never match again, so each tile is filled once and the stack
+// stays around the height of the area rather than its size
+bool TileMap::fillConnected(int32 x, int32 y, TileId id)
 {
-    TileMap newTileMap = initializeTileMap(name, width, height, tileSize);
-    
-    int memorySize = sizeof(TileMapTile) * width * height;
-    newTileMap.tiles = (TileMapTile*) HEAP_ALLOC(memorySize);
-    
-    if (newTileMap.tiles)
-    {	
-	TileMapTile *row = newTileMap.tiles;
-	for (uint32 i = 0; i < height; ++i)
+    FillState fill = {};
+    fill.tileMap = this;
+    fill.id = id;
+    forgetFillPage(&fill);
+
+    fill.numIdMatches = MAX(paletteSize, 1);
+    fill.idMatches = (uint8*)HEAP_ALLOC(fill.numIdMatches);
+    if (!fill.idMatches)
+	return false;
+
+    TileId targetId = 0;
+    bool targetIsSet = getTileIdAt(x, y, &targetId);
+    Point2 target = palette[targetId];
+    Point2 replacement = palette[id];
+
+    bool result = true;
+
+    //NOTE(denis): filling a tile with what it already looks like would change
+    // nothing, and the filled tiles would keep matching so it would never end
+    if (!targetIsSet || target.x != replacement.x || target.y != replacement.y)
+    {
+	if (targetIsSet)
 	{
-	    TileMapTile *element = row;
-	    for (uint32 j = 0; j < width; ++j)
-	    {		
-		element->pos.x = newTileMap.offset.x + j*newTileMap.tileSize;
-		element->pos.y = newTileMap.offset.y + i*newTileMap.tileSize;
-		element->size = newTileMap.tileSize;
-
-		//TODO(denis): probably shouldn't call this function every iteration
-		if (tileSetPanelGetCurrentTileSet()->tiles)
+	    for (uint32 i = 0; i < paletteSize; ++i)
+	    {
+		fill.idMatches[i] = palette[i].x == target.x && palette[i].y == target.y;
+	    }
+	}
+	else
+	{
+	    fill.unsetMatches = true;
+	}
+
+	int32 firstX = x;
+	while (firstX > 0 && tileMatchesFill(&fill, firstX-1, y))
+	    --firstX;
+
+	int32 lastX = x;
+	while (lastX < widthInTiles-1 && tileMatchesFill(&fill, lastX+1, y))
+	    ++lastX;
+
+	result = fillRow(&fill, firstX, lastX, y) &&
+	    pushFillSpan(&fill, y-1, firstX, lastX, -1) &&
+	    pushFillSpan(&fill, y+1, firstX, lastX, 1);
+
+	while (result && fill.stackSize > 0)
+	{
+	    FillSpan span = fill.stack[--fill.stackSize];
+
+	    int32 i = span.firstX;
+	    while (i <= span.lastX && result)
+	    {
+		if (tileMatchesFill(&fill, i, span.y))
 		{
-		    Tile tile = tileSetPanelGetSelectedTile();
-		    element->sheetPos = tile.sheetPos;
-		    element->size = tile.size;
-		    element->initialized = true;
+		    //NOTE(denis): only the first run can reach left past the span,
+		    // the ones after it start right after a tile that didn't match
+		    int32 runFirstX = i;
+		    if (i == span.firstX)
+		    {
+			while (runFirstX > 0 && tileMatchesFill(&fill, runFirstX-1, span.y))
+			    --runFirstX;
+		    }
+
+		    int32 runLastX = i;
+		    while (runLastX < widthInTiles-1 && tileMatchesFill(&fill, runLastX+1, span.y))
+			++runLastX;
+
+		    result = fillRow(&fill, runFirstX, runLastX, span.y) &&
+			pushFillSpan(&fill, span.y + span.dy, runFirstX, runLastX, span.dy);
+
+		    //NOTE(denis): the parts of the run that stick out past the span
+		    // can lead back into the row the span came from
+		    if (result && runFirstX < span.firstX)
+		    {
+			result = pushFillSpan(&fill, span.y - span.dy, runFirstX,
+					      span.firstX-1, -span.dy);
+		    }
+		    if (result && runLastX > span.lastX)
+		    {
+			result = pushFillSpan(&fill, span.y - span.dy, span.lastX+1,
+					      runLastX, -span.dy);
+		    }
+
+		    i = runLastX + 2;
 		}
 		else
 		{
-		    element->size =  newTileMap.tileSize;
+		    ++i;
 		}
-		
-		++element;
 	    }
-	    row += newTileMap.widthInTiles;
 	}
     }
 
-    return newTileMap;
+    //NOTE(denis): one rectangle for the whole fill, every filled tile matched
+    // the target so they all go back to it on undo
+    if (fill.numFilled > 0)
+    {
+	uint32 oldValue = targetIsSet ? targetId : UNSET_TILE_VALUE;
+	recordTileMapEditSpans(this, fill.firstX, fill.firstY, fill.lastX, fill.lastY,
+			       id, oldValue, fill.filled, fill.numFilled);
+	markTilesChanged(fill.firstX, fill.firstY, fill.lastX, fill.lastY);
+    }
+
+    if (fill.stack)
+    {
+	HEAP_FREE(fill.stack);
+    }
+    if (fill.filled)
+    {
+	HEAP_FREE(fill.filled);
+    }
+    HEAP_FREE(fill.idMatches);
+
+    return result;
 }
 
 static void changeCurrentTool(ToolType *currentTool, ToolType newType,
@@ -155,6 +1008,8 @@ static void changeCurrentTool(ToolType *currentTool, ToolType newType,
 			      Button *moveToolIcon, TexturedRect *selectedToolIcon,
 			      bool *selectionVisible)
 {
+    ui_requestRedraw();
+    
     if (newType == PAINT_TOOL)
     {
 	selectedToolIcon->pos.x = paintToolIcon->background.pos.x;
@@ -204,43 +1059,15 @@ static inline void clipSelectionBoxToBoundary(TexturedRect *selectionBox,
     }
 }
 
-static inline Vector2 convertTilePosToScreenPos(uint32 tileSize, Vector2 tileMapOffset,
-						Vector2 scrollOffset, Vector2 tilePos)
-{
-    Vector2 screenPos = tileMapOffset;
-    
-    screenPos.x +=
-	(tilePos.x - scrollOffset.x/tileSize)*tileSize - scrollOffset.x%tileSize;
-    screenPos.y +=
-	(tilePos.y - scrollOffset.y/tileSize)*tileSize - scrollOffset.y%tileSize;
-    
-    return screenPos;
-}
-
-static Vector2 convertScreenPosToTilePos(int32 tileSize, Vector2 tileMapOffset,
+//NOTE(denis): the inverse of TileMap::getViewTileEdge, a pixel is in the
+// tile whose edge is at or before it
+static Vector2 convertScreenPosToTilePos(real32 viewTileSize, Vector2 tileMapOffset,
 					 Vector2 scrollOffset, Vector2 screenPos)
 {
-    Vector2 tilePos = scrollOffset/tileSize;
+    Vector2 tilePos = {};
     
-    int32 firstTileWidth = tileSize - scrollOffset.x%tileSize;
-    if (firstTileWidth < tileSize)
-    {
-        tileMapOffset.x += firstTileWidth;
-
-	if (screenPos.x >= tileMapOffset.x)
-	    ++tilePos.x;
-    }
-    tilePos.x += (screenPos.x - tileMapOffset.x)/tileSize;
-					        
-    int32 firstTileHeight = tileSize - scrollOffset.y%tileSize;
-    if (firstTileHeight < tileSize)
-    {
-	tileMapOffset.y += firstTileHeight;
-
-	if (screenPos.y >= tileMapOffset.y)
-	    ++tilePos.y;
-    }
-    tilePos.y += (screenPos.y - tileMapOffset.y)/tileSize;
+    tilePos.x = (int32)floor((real64)(screenPos.x - tileMapOffset.x + scrollOffset.x)/viewTileSize);
+    tilePos.y = (int32)floor((real64)(screenPos.y - tileMapOffset.y + scrollOffset.y)/viewTileSize);
 
     return tilePos;
 }
@@ -248,52 +1075,80 @@ static Vector2 convertScreenPosToTilePos(int32 tileSize, Vector2 tileMapOffset,
 static void paintSelectedTile(TileMap *tileMap, SDL_Rect tileMapArea,
 			      Vector2 scrollOffset, Vector2 mousePos)
 {
-    int32 tileSize = tileMap->tileSize;
     Vector2 offset = {tileMapArea.x, tileMapArea.y};
-    Vector2 tilePos = convertScreenPosToTilePos(tileSize, offset,
+    Vector2 tilePos = convertScreenPosToTilePos(tileMap->getViewTileSize(), offset,
 						scrollOffset, mousePos);
     
-    TileMapTile *clicked = tileMap->tiles + tilePos.x + tilePos.y*tileMap->widthInTiles;
-
     if (tileSetPanelGetSelectedTile().size != 0)
     {
-	clicked->sheetPos = tileSetPanelGetSelectedTile().sheetPos;
-	clicked->initialized = true;
+	//NOTE(denis): opened here and not on the mouse down, the stroke can
+	// start on a scroll bar or the minimap and be dragged onto the map
+	if (!_paintStrokeOpen)
+	{
+	    beginTileMapEdit(tileMap);
+	    _paintStrokeOpen = true;
+	}
+	
+	tileMap->setTile(tilePos.x, tilePos.y, tileSetPanelGetSelectedTile().sheetPos);
     }
 }
 
-static void moveSelectionInScrolledMap(TexturedRect *selectionBox, SDL_Rect tileMapArea,
-				       Vector2 scrollOffset, Vector2 point, int32 tileSize)
+static void moveSelectionInScrolledMap(TexturedRect *selectionBox, TileMap *tileMap,
+				       Vector2 point)
 {
-    Vector2 offset = {tileMapArea.x, tileMapArea.y};
-    Vector2 selectedTile = point - offset;
+    Vector2 offset = {tileMap->visibleArea.x, tileMap->visibleArea.y};
+    Vector2 selectedTile = convertScreenPosToTilePos(tileMap->getViewTileSize(), offset,
+						     tileMap->drawOffset, point);
+
+    selectionBox->pos = tileMap->getTileRect(selectedTile.x, selectedTile.y);
+    clipSelectionBoxToBoundary(selectionBox, tileMap->visibleArea);
+}
+
+static void clampDrawOffset(TileMap *tileMap)
+{
+    SDL_Rect mapRect = tileMap->getRect();
     
-    int32 firstTileWidth = tileSize - scrollOffset.x%tileSize;
-    if (selectedTile.x > firstTileWidth)
-    {
-	selectedTile.x -= firstTileWidth;
+    tileMap->drawOffset.x = MIN(tileMap->drawOffset.x, mapRect.w - tileMap->visibleArea.w);
+    tileMap->drawOffset.y = MIN(tileMap->drawOffset.y, mapRect.h - tileMap->visibleArea.h);
+    tileMap->drawOffset.x = MAX(tileMap->drawOffset.x, 0);
+    tileMap->drawOffset.y = MAX(tileMap->drawOffset.y, 0);
+}
 
-	selectionBox->pos.x = (selectedTile.x/tileSize)*tileSize + offset.x + firstTileWidth;
-	selectionBox->pos.w = MIN(tileSize, tileMapArea.x + tileMapArea.w - selectionBox->pos.x);
-    }
-    else
-    {
-	selectionBox->pos.w = firstTileWidth;
-	selectionBox->pos.x = offset.x;
-    }
+//NOTE(denis): puts the scroll bars where the map is scrolled to
+static void moveScrollBarsToDrawOffset(TileMap *tileMap)
+{
+    SDL_Rect mapRect = tileMap->getRect();
+    
+    TexturedRect *scrollingBarY = &tileMap->verticalBar.scrollingRect;
+    TexturedRect *backgroundBarY = &tileMap->verticalBar.backgroundRect;
+    TexturedRect *scrollingBarX = &tileMap->horizontalBar.scrollingRect;
+    TexturedRect *backgroundBarX = &tileMap->horizontalBar.backgroundRect;
 
-    int32 firstTileHeight = tileSize - scrollOffset.y%tileSize;
-    if (selectedTile.y > firstTileHeight)
+    if (scrollingBarY->image)
     {
-	selectedTile.y -= firstTileHeight;
+	scrollingBarY->pos.y = (int32)((real32)tileMap->drawOffset.y / (mapRect.h - tileMap->visibleArea.h) * (backgroundBarY->pos.h - scrollingBarY->pos.h) + backgroundBarY->pos.y);
 
-	selectionBox->pos.y = (selectedTile.y/tileSize)*tileSize + offset.y + firstTileHeight;
-	selectionBox->pos.h = MIN(tileSize, tileMapArea.y + tileMapArea.h - selectionBox->pos.y);
+	if (scrollingBarY->pos.y < backgroundBarY->pos.y)
+	{
+	    scrollingBarY->pos.y = backgroundBarY->pos.y;
+	}
+	else if (scrollingBarY->pos.y > backgroundBarY->pos.y + backgroundBarY->pos.h - scrollingBarY->pos.h)
+	{
+	    scrollingBarY->pos.y = backgroundBarY->pos.y + backgroundBarY->pos.h - scrollingBarY->pos.h;
+	}
     }
-    else
+    if (scrollingBarX->image)
     {
-	selectionBox->pos.h = firstTileHeight;
-	selectionBox->pos.y = offset.y;
+	scrollingBarX->pos.x = (int32)((real32)tileMap->drawOffset.x / (mapRect.w - tileMap->visibleArea.w) * (backgroundBarX->pos.w - scrollingBarX->pos.w) + backgroundBarX->pos.x);
+	
+	if (scrollingBarX->pos.x < backgroundBarX->pos.x)
+	{
+	    scrollingBarX->pos.x = backgroundBarX->pos.x;
+	}
+	else if (scrollingBarX->pos.x > backgroundBarX->pos.x + backgroundBarX->pos.w - scrollingBarX->pos.w)
+	{
+	    scrollingBarX->pos.x = backgroundBarX->pos.x + backgroundBarX->pos.w - scrollingBarX->pos.w;
+	}
     }
 }
 
@@ -302,7 +1157,6 @@ static void scrollTileMap(ScrollBar *scrollBar, bool isVertical, Vector2 mousePo
 {
     TexturedRect *smallRect = &scrollBar->scrollingRect;
     TexturedRect *backgroundRect = &scrollBar->backgroundRect;
-    int32 tileSize = currentMap->tileSize;
     
     int32 mouseCoord = 0;
     int32 *drawOffsetCoord = 0;
@@ -318,7 +1172,7 @@ static void scrollTileMap(ScrollBar *scrollBar, bool isVertical, Vector2 mousePo
     {
 	mouseCoord = mousePos.y;
 	drawOffsetCoord = &currentMap->drawOffset.y;
-	tileMapDim = currentMap->heightInTiles;
+	tileMapDim = currentMap->getRect().h;
 	tileMapVisibleDim = currentMap->visibleArea.h;
 	
 	smallRectCoord = &smallRect->pos.y;
@@ -330,7 +1184,7 @@ static void scrollTileMap(ScrollBar *scrollBar, bool isVertical, Vector2 mousePo
     {
 	mouseCoord = mousePos.x;
         drawOffsetCoord = &currentMap->drawOffset.x;
-	tileMapDim = currentMap->widthInTiles;
+	tileMapDim = currentMap->getRect().w;
 	tileMapVisibleDim = currentMap->visibleArea.w;
 	
 	smallRectCoord = &smallRect->pos.x;
@@ -354,7 +1208,7 @@ static void scrollTileMap(ScrollBar *scrollBar, bool isVertical, Vector2 mousePo
 	}
 
 	real32 percentMoved = (real32)(*smallRectCoord - backgroundRectCoord)/(real32)(backgroundRectDim - smallRectDim);
-	*drawOffsetCoord = (int32)((tileMapDim*tileSize - tileMapVisibleDim)*percentMoved);
+	*drawOffsetCoord = (int32)((tileMapDim - tileMapVisibleDim)*percentMoved);
     }
 }
 
@@ -362,6 +1216,7 @@ void tileMapPanelCreateNew(SDL_Renderer *renderer, uint32 x, uint32 y,
 			   uint32 width, uint32 height)
 {
     _renderer = renderer;
+    _chunksSupported = SDL_RenderTargetSupported(_renderer) == SDL_TRUE;
 
     width = MAX(MIN_WIDTH, width);
     height = MAX(MIN_HEIGHT, height);
@@ -385,165 +1240,514 @@ void tileMapPanelCreateNew(SDL_Renderer *renderer, uint32 x, uint32 y,
     _fillToolIcon = ui_createImageButton("paint-can-icon-32.png");
     _moveToolIcon = ui_createImageButton("cursor-icon-32.png");
     
-    _selectedToolIcon = loadImage(renderer, "selected-icon-32.png");
-    _hoveringToolIcon = loadImage(renderer, "hovering-icon-32.png");
-	    
+    _selectedToolIcon = loadImage(renderer, "selected-icon-32.png");
+    _hoveringToolIcon = loadImage(renderer, "hovering-icon-32.png");
+	    
+    {
+	int x = _panel.panel.pos.x + _panel.getWidth() - _paintToolIcon.getWidth() - PADDING;
+	int y = _panel.panel.pos.y + PADDING;
+	_paintToolIcon.setPosition({x, y});
+	_selectedToolIcon.pos.x = x;
+	_selectedToolIcon.pos.y = y;
+		    
+	y += _paintToolIcon.getHeight() + 5;
+	_fillToolIcon.setPosition({x, y});
+
+	//NOTE(denis): the labels sit in the bottom right corner of the fill icon
+	char *fillModeKeys[NUM_FILL_MODES] = {"r", "b"};
+	for (int32 i = 0; i < NUM_FILL_MODES; ++i)
+	{
+	    _fillModeLabels[i] = ui_createTextField(fillModeKeys[i], 0, 0, 0xFF000000);
+	    _fillModeLabels[i].pos.x = x + _fillToolIcon.getWidth() - _fillModeLabels[i].pos.w;
+	    _fillModeLabels[i].pos.y = y + _fillToolIcon.getHeight() - _fillModeLabels[i].pos.h;
+	}
+
+	y += _fillToolIcon.getHeight() + 5;
+	_moveToolIcon.setPosition({x, y});
+
+	_tileMapArea.x = _panel.panel.pos.x + PADDING;
+	_tileMapArea.y = _panel.panel.pos.y + PADDING;
+	_tileMapArea.w = x - _tileMapArea.x - PADDING - SCROLL_BAR_WIDTH - 5;
+	_tileMapArea.h = _panel.panel.pos.h - PADDING - SCROLL_BAR_WIDTH - 5;
+    }
+    ui_addToPanel(&_paintToolIcon, &_panel);
+    ui_addToPanel(&_fillToolIcon, &_panel);
+    ui_addToPanel(&_moveToolIcon, &_panel);
+    ui_addToPanel(&_selectedToolIcon, &_panel);
+
+    _arrowCursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_ARROW);
+    _handCursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_HAND);
+}
+
+//NOTE(denis): the tiles of a map that can be seen along one axis
+struct VisibleTiles
+{
+    int32 first;
+    int32 last;
+};
+
+static VisibleTiles getVisibleTiles(int32 areaSize, int32 drawOffset,
+				    real32 viewTileSize, int32 numTiles)
+{
+    VisibleTiles result = {};
+    
+    result.first = (int32)floor(drawOffset/(real64)viewTileSize);
+    result.last = MIN((int32)floor((areaSize + drawOffset - 1)/(real64)viewTileSize), numTiles-1);
+
+    return result;
+}
+
+//NOTE(denis): the smallest of the tile set's mips that still has a pixel for
+// every pixel a tile takes up on screen
+static uint32 chooseMipLevel(TileSet *tileSet, int32 tileSize, real32 viewTileSize)
+{
+    uint32 result = 0;
+
+    if (tileSet)
+    {
+	while (result+1 < tileSet->numMips &&
+	       getTileMipSize(tileSize, result+1) >= viewTileSize)
+	{
+	    ++result;
+	}
+    }
+
+    return result;
+}
+
+#define MAX_CHUNK_TEXTURE_SIZE 2048
+#define MAX_CHUNK_TEXTURES 256
+
+//NOTE(denis): zoomed out any further than this the map is drawn as an overview
+// instead of from chunks, so there are never more chunks to bake than fit on
+// screen at this size
+#define MIN_CHUNK_VIEW_SIZE 128
+
+static inline int32 getChunkSizeInTiles(int32 tileSize)
+{
+    return MAX(1, MIN(TILE_MAP_CHUNK_SIZE, MAX_CHUNK_TEXTURE_SIZE/tileSize));
+}
+
+static bool createChunks(TileMap *tileMap)
+{
+    int32 chunkSize = getChunkSizeInTiles(tileMap->tileSize);
+    int32 widthInChunks = (tileMap->widthInTiles + chunkSize-1)/chunkSize;
+    int32 heightInChunks = (tileMap->heightInTiles + chunkSize-1)/chunkSize;
+
+    tileMap->chunks = (TileMapChunk*)HEAP_ALLOC(widthInChunks*heightInChunks*sizeof(TileMapChunk));
+
+    if (tileMap->chunks)
+    {
+	tileMap->chunkSizeInTiles = chunkSize;
+	tileMap->widthInChunks = widthInChunks;
+	tileMap->heightInChunks = heightInChunks;
+    }
+
+    return tileMap->chunks != 0;
+}
+
+static void freeChunkTexture(TileMapChunk *chunk)
+{
+    if (chunk->texture)
+    {
+	SDL_DestroyTexture(chunk->texture);
+	chunk->texture = 0;
+	--_numChunkTextures;
+    }
+}
+
+static void freeChunks(TileMap *tileMap)
+{
+    if (tileMap->chunks)
+    {
+	int32 numChunks = tileMap->widthInChunks*tileMap->heightInChunks;
+	for (int32 i = 0; i < numChunks; ++i)
+	{
+	    freeChunkTexture(tileMap->chunks + i);
+	}
+
+	HEAP_FREE(tileMap->chunks);
+	tileMap->chunks = 0;
+    }
+}
+
+static void markAllChunksDirty(TileMap *tileMap)
+{
+    if (tileMap->chunks)
+    {
+	int32 numChunks = tileMap->widthInChunks*tileMap->heightInChunks;
+	for (int32 i = 0; i < numChunks; ++i)
+	{
+	    tileMap->chunks[i].dirty = true;
+	}
+    }
+}
+
+//NOTE(denis): once there are too many chunk textures every one that wasn't
+// drawn last frame gets thrown away, they are baked again if they come back
+static void freeUnusedChunkTextures()
+{
+    for (uint32 i = 0; i < _numTileMapSlots; ++i)
+    {
+	TileMap *tileMap = &_tileMapSlots[i].tileMap;
+	if (_tileMapSlots[i].inUse && tileMap->chunks)
+	{
+	    int32 numChunks = tileMap->widthInChunks*tileMap->heightInChunks;
+	    for (int32 j = 0; j < numChunks; ++j)
+	    {
+		TileMapChunk *chunk = tileMap->chunks + j;
+		if (chunk->texture && chunk->lastDrawnFrame + 1 < _frameNumber)
+		    freeChunkTexture(chunk);
+	    }
+	}
+    }
+}
+
+static void bakeChunk(TileMap *tileMap, TileMapChunk *chunk, int32 chunkX, int32 chunkY,
+		      TileSet *tileSet, bool *drewTileSet)
+{
+    PROFILE_SCOPE(PROFILE_CHUNK_BAKE);
+    
+    int32 tileSize = tileMap->tileSize;
+    int32 mipSize = getTileMipSize(tileSize, chunk->mipLevel);
+    SDL_Texture *tileSetImage = tileSet ? tileSet->mips[chunk->mipLevel] : 0;
+    int32 firstTileX = chunkX*tileMap->chunkSizeInTiles;
+    int32 firstTileY = chunkY*tileMap->chunkSizeInTiles;
+    int32 lastTileX = MIN(firstTileX + tileMap->chunkSizeInTiles, tileMap->widthInTiles);
+    int32 lastTileY = MIN(firstTileY + tileMap->chunkSizeInTiles, tileMap->heightInTiles);
+
+    uint8 r, g, b, a;
+    SDL_GetRenderDrawColor(_renderer, &r, &g, &b, &a);
+    
+    SDL_SetRenderTarget(_renderer, chunk->texture);
+    SDL_SetRenderDrawColor(_renderer, 0, 0, 0, 0);
+    SDL_RenderClear(_renderer);
+
+    for (int32 i = firstTileY; i < lastTileY; ++i)
+    {
+	for (int32 j = firstTileX; j < lastTileX; ++j)
+	{
+	    Point2 sheetPos = {};
+	    bool initialized = tileMap->getTile(j, i, &sheetPos);
+
+	    SDL_Rect drawRectChunk =
+		{(j - firstTileX)*mipSize, (i - firstTileY)*mipSize,
+		 mipSize, mipSize};
+
+	    if (!tileSetImage || !initialized)
+	    {
+		SDL_RenderCopy(_renderer, _defaultTile.image, NULL, &drawRectChunk);
+	    }
+	    else
+	    {
+		SDL_Rect drawRectSheet = getTileMipRect(tileSize, chunk->mipLevel, sheetPos);
+		SDL_RenderCopy(_renderer, tileSetImage, &drawRectSheet, &drawRectChunk);
+		*drewTileSet = true;
+	    }
+	}
+    }
+
+    SDL_SetRenderTarget(_renderer, NULL);
+    SDL_SetRenderDrawColor(_renderer, r, g, b, a);
+
+    chunk->dirty = false;
+}
+
+//NOTE(denis): returns false if the chunk textures couldn't be made, the caller
+// should draw the tiles one by one instead. each chunk is drawn from the mip
+// that fits the zoom and scaled the rest of the way
+static bool drawTileMapChunks(TileMap *tileMap, TileSet *tileSet, bool *drewTileSet)
+{
+    if (!tileMap->chunks && !createChunks(tileMap))
+	return false;
+
+    ++_frameNumber;
+    if (_numChunkTextures > MAX_CHUNK_TEXTURES)
+	freeUnusedChunkTextures();
+
+    SDL_Texture *tileSetImage = tileSet ? tileSet->image : 0;
+    if (tileMap->chunkTileSetImage != tileSetImage)
+    {
+	markAllChunksDirty(tileMap);
+	tileMap->chunkTileSetImage = tileSetImage;
+    }
+
+    real32 viewTileSize = tileMap->getViewTileSize();
+    uint32 mipLevel = chooseMipLevel(tileSet, tileMap->tileSize, viewTileSize);
+    int32 mipSize = getTileMipSize(tileMap->tileSize, mipLevel);
+    int32 chunkSize = tileMap->chunkSizeInTiles;
+    SDL_Rect area = tileMap->visibleArea;
+    Vector2 drawOffset = tileMap->drawOffset;
+
+    VisibleTiles columns = getVisibleTiles(area.w, drawOffset.x, viewTileSize,
+					   tileMap->widthInTiles);
+    VisibleTiles rows = getVisibleTiles(area.h, drawOffset.y, viewTileSize,
+					tileMap->heightInTiles);
+
+    bool result = true;
+
+    for (int32 i = rows.first/chunkSize; i <= rows.last/chunkSize && result; ++i)
+    {
+	for (int32 j = columns.first/chunkSize; j <= columns.last/chunkSize && result; ++j)
+	{
+	    TileMapChunk *chunk = tileMap->chunks + j + i*tileMap->widthInChunks;
+
+	    //NOTE(denis): chunks on the right and bottom edges can be smaller
+	    int32 firstTileX = j*chunkSize;
+	    int32 firstTileY = i*chunkSize;
+	    int32 numTilesX = MIN(chunkSize, tileMap->widthInTiles - firstTileX);
+	    int32 numTilesY = MIN(chunkSize, tileMap->heightInTiles - firstTileY);
+
+	    if (chunk->texture && chunk->mipLevel != mipLevel)
+		freeChunkTexture(chunk);
+
+	    if (!chunk->texture)
+	    {
+		chunk->texture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888,
+						   SDL_TEXTUREACCESS_TARGET,
+						   numTilesX*mipSize, numTilesY*mipSize);
+		if (chunk->texture)
+		{
+		    SDL_SetTextureBlendMode(chunk->texture, SDL_BLENDMODE_BLEND);
+		    chunk->mipLevel = mipLevel;
+		    chunk->dirty = true;
+		    ++_numChunkTextures;
+		}
+		else
+		{
+		    result = false;
+		}
+	    }
+
+	    if (chunk->texture)
+	    {
+		if (chunk->dirty)
+		    bakeChunk(tileMap, chunk, j, i, tileSet, drewTileSet);
+
+		chunk->lastDrawnFrame = _frameNumber;
+
+		//NOTE(denis): the chunks are drawn whole and cut off at the edges
+		// of the visible area by the renderer
+		SDL_RenderSetClipRect(_renderer, &area);
+
+		int32 left = tileMap->getViewTileEdge(firstTileX);
+		int32 top = tileMap->getViewTileEdge(firstTileY);
+		SDL_Rect drawRectScreen = {area.x + left - drawOffset.x, area.y + top - drawOffset.y,
+					   tileMap->getViewTileEdge(firstTileX + numTilesX) - left,
+					   tileMap->getViewTileEdge(firstTileY + numTilesY) - top};
+
+		SDL_RenderCopy(_renderer, chunk->texture, NULL, &drawRectScreen);
+	    }
+	}
+    }
+
+    SDL_RenderSetClipRect(_renderer, NULL);
+
+    return result;
+}
+
+//NOTE(denis): draws every visible tile on its own, only used if the renderer
+// can't draw to textures
+static void drawTileMapTiles(TileMap *tileMap, TileSet *tileSet, bool *drewTileSet)
+{
+    real32 viewTileSize = tileMap->getViewTileSize();
+    uint32 mipLevel = chooseMipLevel(tileSet, tileMap->tileSize, viewTileSize);
+    SDL_Texture *tileSetImage = tileSet ? tileSet->mips[mipLevel] : 0;
+    
+    SDL_Rect area = tileMap->visibleArea;
+    VisibleTiles columns = getVisibleTiles(area.w, tileMap->drawOffset.x, viewTileSize,
+					   tileMap->widthInTiles);
+    VisibleTiles rows = getVisibleTiles(area.h, tileMap->drawOffset.y, viewTileSize,
+					tileMap->heightInTiles);
+
+    SDL_RenderSetClipRect(_renderer, &area);
+
+    for (int32 i = rows.first; i <= rows.last; ++i)
+    {
+	for (int32 j = columns.first; j <= columns.last; ++j)
+	{
+	    Point2 sheetPos = {};
+	    bool initialized = tileMap->getTile(j, i, &sheetPos);
+
+	    SDL_Rect drawRectScreen = tileMap->getTileRect(j, i);
+
+	    if (!tileSetImage || !initialized)
+	    {
+		SDL_RenderCopy(_renderer, _defaultTile.image, NULL, &drawRectScreen);
+	    }
+	    else
+	    {
+		SDL_Rect drawRectSheet = getTileMipRect(tileMap->tileSize, mipLevel, sheetPos);
+		SDL_RenderCopy(_renderer, tileSetImage, &drawRectSheet, &drawRectScreen);
+		*drewTileSet = true;
+	    }
+	}
+    }
+
+    SDL_RenderSetClipRect(_renderer, NULL);
+}
+
+//NOTE(denis): draws the map a screen pixel at a time, every pixel is the
+// average colour of the tile it is in. it costs the same however big the map
+// is and is only made again when the view or the map's tiles change
+static bool drawTileMapOverview(TileMap *tileMap, TileSet *tileSet, bool *drewTileSet)
+{
+    SDL_Rect area = tileMap->visibleArea;
+    uint32 *tileColours = tileSet ? tileSet->tileColours : 0;
+    
+    if (_overview && (_overviewWidth != area.w || _overviewHeight != area.h))
     {
-	int x = _panel.panel.pos.x + _panel.getWidth() - _paintToolIcon.getWidth() - PADDING;
-	int y = _panel.panel.pos.y + PADDING;
-	_paintToolIcon.setPosition({x, y});
-	_selectedToolIcon.pos.x = x;
-	_selectedToolIcon.pos.y = y;
-		    
-	y += _paintToolIcon.getHeight() + 5;
-	_fillToolIcon.setPosition({x, y});
+	SDL_DestroyTexture(_overview);
+	_overview = 0;
+    }
 
-	y += _fillToolIcon.getHeight() + 5;
-	_moveToolIcon.setPosition({x, y});
+    if (!_overview)
+    {
+	_overview = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888,
+				      SDL_TEXTUREACCESS_STREAMING, area.w, area.h);
+	if (!_overview)
+	    return false;
+
+	SDL_SetTextureBlendMode(_overview, SDL_BLENDMODE_BLEND);
+	_overviewWidth = area.w;
+	_overviewHeight = area.h;
+	_overviewMap = 0;
+    }
 
-	_tileMapArea.x = _panel.panel.pos.x + PADDING;
-	_tileMapArea.y = _panel.panel.pos.y + PADDING;
-	_tileMapArea.w = x - _tileMapArea.x - PADDING - SCROLL_BAR_WIDTH - 5;
-	_tileMapArea.h = _panel.panel.pos.h - PADDING - SCROLL_BAR_WIDTH - 5;
+    if (tileMap->overviewDirty || _overviewMap != tileMap ||
+	_overviewDrawOffset != tileMap->drawOffset || _overviewZoom != tileMap->zoom ||
+	_overviewColours != tileColours)
+    {
+	void *pixels;
+	int32 pitch;
+	if (SDL_LockTexture(_overview, NULL, &pixels, &pitch) != 0)
+	    return false;
+
+	real32 viewTileSize = tileMap->getViewTileSize();
+	_overviewDrewTileSet = false;
+	
+	for (int32 i = 0; i < area.h; ++i)
+	{
+	    uint32 *row = (uint32*)((uint8*)pixels + i*pitch);
+	    int32 tileY = (int32)floor((tileMap->drawOffset.y + i)/(real64)viewTileSize);
+	    tileY = MIN(tileY, tileMap->heightInTiles-1);
+
+	    for (int32 j = 0; j < area.w; ++j)
+	    {
+		int32 tileX = (int32)floor((tileMap->drawOffset.x + j)/(real64)viewTileSize);
+		tileX = MIN(tileX, tileMap->widthInTiles-1);
+
+		Point2 sheetPos;
+		uint32 colour = OVERVIEW_EMPTY_COLOUR;
+		if (tileColours && tileMap->peekTile(tileX, tileY, &sheetPos))
+		{
+		    colour = getTileColour(tileSet, sheetPos, OVERVIEW_EMPTY_COLOUR);
+		    _overviewDrewTileSet = true;
+		}
+
+		row[j] = colour;
+	    }
+	}
+
+	SDL_UnlockTexture(_overview);
+
+	tileMap->overviewDirty = false;
+	_overviewMap = tileMap;
+	_overviewDrawOffset = tileMap->drawOffset;
+	_overviewZoom = tileMap->zoom;
+	_overviewColours = tileColours;
     }
-    ui_addToPanel(&_paintToolIcon, &_panel);
-    ui_addToPanel(&_fillToolIcon, &_panel);
-    ui_addToPanel(&_moveToolIcon, &_panel);
-    ui_addToPanel(&_selectedToolIcon, &_panel);
 
-    _arrowCursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_ARROW);
-    _handCursor = SDL_CreateSystemCursor(SDL_SYSTEM_CURSOR_HAND);
+    if (_overviewDrewTileSet)
+	*drewTileSet = true;
+
+    SDL_RenderCopy(_renderer, _overview, NULL, &area);
+
+    return true;
+}
+
+//NOTE(denis): how many pages past the edge of the view get read back in ahead
+// of time, so scrolling doesn't have to wait on the page file
+#define PREFETCH_MARGIN_IN_PAGES 2
+
+static void prefetchAroundView(TileMap *tileMap)
+{
+    installPrefetchedTileMapPages(&tileMap->pages);
+
+    SDL_Rect area = tileMap->visibleArea;
+    VisibleTiles columns = getVisibleTiles(area.w, tileMap->drawOffset.x,
+					   tileMap->getViewTileSize(), tileMap->widthInTiles);
+    VisibleTiles rows = getVisibleTiles(area.h, tileMap->drawOffset.y,
+					tileMap->getViewTileSize(), tileMap->heightInTiles);
+
+    prefetchTileMapPages(&tileMap->pages,
+			 columns.first/TILE_MAP_PAGE_SIZE - PREFETCH_MARGIN_IN_PAGES,
+			 rows.first/TILE_MAP_PAGE_SIZE - PREFETCH_MARGIN_IN_PAGES,
+			 columns.last/TILE_MAP_PAGE_SIZE + PREFETCH_MARGIN_IN_PAGES,
+			 rows.last/TILE_MAP_PAGE_SIZE + PREFETCH_MARGIN_IN_PAGES);
 }
 
 void tileMapPanelDraw()
 {
+    PROFILE_SCOPE(PROFILE_TILE_MAP_DRAW);
+    
     if (_panel.visible)
     {
 	ui_draw(&_panel);
 
-	TileMap *currentMap = &_tileMaps[_selectedTileMap];
-	int32 tileSize = currentMap->tileSize;
+	TileMap *currentMap = getSelectedTileMap();
     
 	if (_hoverToolIconVisible)
 	{
 	    ui_draw(&_hoveringToolIcon);
 	}
+
+	ui_draw(&_fillModeLabels[_fillMode]);
     
-	if (!currentMap->tiles)
+	if (!currentMap->pages.table)
 	{
 	    ui_draw(&_createNewButton);
 	}
 	else
 	{
-	    if (currentMap->tiles && currentMap->widthInTiles != 0 &&
+	    if (currentMap->pages.table && currentMap->widthInTiles != 0 &&
 		currentMap->heightInTiles != 0)
 	    {
-		int32 startTileX = (currentMap->drawOffset.x)/tileSize;
-		int32 startTileY = (currentMap->drawOffset.y)/tileSize;
+		//NOTE(denis): the tile set is the same for every tile so it is only
+		// looked up once a frame
+		TileSet *tileSet = 0;
+		if (currentMap->tileSetName)
+		{
+		    tileSet = tileSetPanelGetTileSetByName(currentMap->tileSetName);
+		}
+		else
+		{
+		    tileSet = tileSetPanelGetCurrentTileSet();
+		}
 
-		int32 endTileX = (currentMap->visibleArea.w + currentMap->drawOffset.x)/tileSize;
-		endTileX = MIN(endTileX, currentMap->widthInTiles-1);
-		
-		int32 endTileY = (currentMap->visibleArea.h + currentMap->drawOffset.y)/tileSize;
-		endTileY = MIN(endTileY, currentMap->heightInTiles-1);
-		
-		for (int32 i = startTileY; i <= endTileY; ++i)
+		if (tileSet && !tileSet->image)
+		    tileSet = 0;
+
+		prefetchAroundView(currentMap);
+
+		bool drewTileSet = false;
+		bool zoomedOut = getChunkSizeInTiles(currentMap->tileSize)*currentMap->getViewTileSize() <
+		    MIN_CHUNK_VIEW_SIZE;
+		if (!zoomedOut || !drawTileMapOverview(currentMap, tileSet, &drewTileSet))
 		{
-		    for (int32 j = startTileX; j <= endTileX; ++j)
+		    if (!_chunksSupported ||
+			!drawTileMapChunks(currentMap, tileSet, &drewTileSet))
 		    {
-			TileMapTile *element = currentMap->tiles + i*currentMap->widthInTiles + j;
-
-			TileSet *tileSet = 0;
-			if (currentMap->tileSetName)
-			{
-			    tileSet = tileSetPanelGetTileSetByName(currentMap->tileSetName);
-			}
-			else
-			{
-			    tileSet = tileSetPanelGetCurrentTileSet();
-			}
-
-			SDL_Texture *tileSetImage = 0;
-			if (tileSet)
-			    tileSetImage = tileSet->image;
-
-			if (!tileSetImage || !element->initialized)
-			{
-			    tileSetImage = _defaultTile.image;
-			}
-			else if (tileSetImage && !currentMap->tileSetName)
-			{
-			    currentMap->tileSetName = tileSet->name;
-			}
-			
-			SDL_Rect drawRectSheet =
-			    {element->sheetPos.x, element->sheetPos.y,
-			     element->size, element->size};
-
-			//TODO(denis): this could be done using currentMap->offset.x + j*element->size
-			// etc.
-			SDL_Rect drawRectScreen =
-			    {element->pos.x, element->pos.y,
-			     element->size, element->size};
-
-			if (drawRectScreen.x - currentMap->drawOffset.x
-			    < currentMap->visibleArea.x)
-			{
-			    drawRectScreen.x = currentMap->visibleArea.x;
-			    drawRectScreen.w -= currentMap->drawOffset.x % tileSize;
-			    drawRectSheet.w = drawRectScreen.w;
-
-			    if (!element->initialized)
-			    {
-				real32 ratio = (real32)_defaultTile.pos.w/(real32)tileSize;
-				drawRectSheet.x += (int32)((currentMap->drawOffset.x % tileSize)*ratio);
-			    }
-			    else
-				drawRectSheet.x += currentMap->drawOffset.x % tileSize;
-			}
-			else
-			{
-			    drawRectScreen.x -= currentMap->drawOffset.x;
-					
-			    if (drawRectScreen.x+drawRectScreen.w >
-				currentMap->visibleArea.x+currentMap->visibleArea.w)
-			    {
-				drawRectSheet.w = currentMap->visibleArea.x+currentMap->visibleArea.w - drawRectScreen.x;
-				drawRectScreen.w = drawRectSheet.w;
-			    }
-			}
-
-			if (drawRectScreen.y - currentMap->drawOffset.y <
-			    currentMap->visibleArea.y)
-			{
-			    drawRectScreen.y = currentMap->visibleArea.y;
-			    drawRectScreen.h -= currentMap->drawOffset.y % tileSize;
-			    drawRectSheet.h = drawRectScreen.h;
-
-			    if (!element->initialized)
-			    {
-				real32 ratio = (real32)_defaultTile.pos.h/(real32)tileSize;
-				drawRectSheet.y += (int32)((currentMap->drawOffset.y % tileSize)*ratio);
-			    }
-			    else
-				drawRectSheet.y += currentMap->drawOffset.y % tileSize;
-			}
-			else
-			{
-			    drawRectScreen.y -= currentMap->drawOffset.y;
-
-			    if (drawRectScreen.y + drawRectScreen.h >
-				currentMap->visibleArea.y + currentMap->visibleArea.h)
-			    {
-				drawRectSheet.h = currentMap->visibleArea.y + currentMap->visibleArea.h - drawRectScreen.y;
-				drawRectScreen.h = drawRectSheet.h;
-			    }
-			}
-			
-			SDL_RenderCopy(_renderer, tileSetImage, &drawRectSheet, &drawRectScreen);
+			drawTileMapTiles(currentMap, tileSet, &drewTileSet);
 		    }
 		}
 
+		//NOTE(denis): the map's own copy, it is freed along with the map
+		if (drewTileSet && !currentMap->tileSetName)
+		{
+		    currentMap->tileSetName = duplicateString(tileSet->name);
+		}
+
 		ui_draw(&currentMap->verticalBar);
 		ui_draw(&currentMap->horizontalBar);
 	    }	
@@ -556,10 +1760,20 @@ void tileMapPanelDraw()
 
 void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
 {
+    PROFILE_SCOPE(PROFILE_TILE_MAP_INPUT);
+    
     SDL_SetCursor(_arrowCursor);
 
-    TileMap *currentMap = &_tileMaps[_selectedTileMap];
-    int32 tileSize = currentMap->tileSize;
+    TileMap *currentMap = getSelectedTileMap();
+    real32 viewTileSize = currentMap->getViewTileSize();
+
+    //NOTE(denis): painting asks for a redraw itself, everything else the mouse
+    // can change is checked at the end
+    SDL_Rect oldSelection = _selectionBox.pos;
+    bool oldSelectionVisible = _selectionVisible;
+    SDL_Rect oldHoverIcon = _hoveringToolIcon.pos;
+    bool oldHoverIconVisible = _hoverToolIconVisible;
+    Vector2 oldDrawOffset = currentMap->drawOffset;
 
     if (currentMap->horizontalBar.scrolling)
     {
@@ -569,7 +1783,7 @@ void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
     {
 	scrollTileMap(&currentMap->verticalBar, true, mousePos, currentMap);
     }
-    else if (_currentTool == PAINT_TOOL && _panel.visible && currentMap->tiles)
+    else if (_currentTool == PAINT_TOOL && _panel.visible && currentMap->pages.table)
     {
 	if (_selectionBox.pos.w != 0 && _selectionBox.pos.h != 0)
 	{
@@ -577,7 +1791,7 @@ void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
 	    {
 		_selectionVisible = true;
 				        
-		moveSelectionInScrolledMap(&_selectionBox, currentMap->visibleArea, currentMap->drawOffset, mousePos, tileSize);
+		moveSelectionInScrolledMap(&_selectionBox, currentMap, mousePos);
 	    }
 	    else
 	    {
@@ -594,19 +1808,18 @@ void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
 	    }
 	}
     }
-    else if (_currentTool == FILL_TOOL && _panel.visible && currentMap->tiles)
+    else if (_currentTool == FILL_TOOL && _panel.visible && currentMap->pages.table)
     {
-	if (leftClickFlag && _startSelectPos != Vector2{0,0})
+	if (leftClickFlag && _startSelectPos != Vector2{0,0} && _fillMode == FILL_RECTANGLE)
 	{
 	    _selectionVisible = true;
 
 	    Vector2 offset = {_tileMapArea.x, _tileMapArea.y};
 
 	    Vector2 tilePos =
-		convertScreenPosToTilePos(tileSize, offset, currentMap->drawOffset, mousePos);
+		convertScreenPosToTilePos(viewTileSize, offset, currentMap->drawOffset, mousePos);
 	    
-	    Vector2 startedTilePos =
-		convertScreenPosToTilePos(tileSize, offset, currentMap->drawOffset, _startSelectPos);
+	    Vector2 startedTilePos = _startSelectTile;
 
 	    //TODO(denis): if the user is holding the mouse
 	    // near an edge that can be scrolled more
@@ -625,31 +1838,17 @@ void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
 		tilePos.y = currentMap->heightInTiles-1;
 	    
 	    
-	    if (startedTilePos.x < tilePos.x)
-	    {
-		_selectionBox.pos.x =
-		    convertTilePosToScreenPos(tileSize, offset, currentMap->drawOffset, startedTilePos).x;
-	    }	
-	    else
-	    {
-		_selectionBox.pos.x =
-		    convertTilePosToScreenPos(tileSize, offset, currentMap->drawOffset, tilePos).x;
-	    }
+	    _endSelectTile = tilePos;
 
-	    _selectionBox.pos.w = tileSize + absValue(tilePos.x - startedTilePos.x)*tileSize;
-	    
-	    if (startedTilePos.y < tilePos.y)
-	    {
-		_selectionBox.pos.y =
-		    convertTilePosToScreenPos(tileSize, offset, currentMap->drawOffset, startedTilePos).y;
-	    }
-	    else
-	    {
-		_selectionBox.pos.y =
-		    convertTilePosToScreenPos(tileSize, offset, currentMap->drawOffset, tilePos).y;
-	    }
-				    
-	    _selectionBox.pos.h = tileSize + absValue(tilePos.y - startedTilePos.y)*tileSize;
+	    SDL_Rect firstTileRect = currentMap->getTileRect(MIN(startedTilePos.x, tilePos.x),
+							      MIN(startedTilePos.y, tilePos.y));
+	    SDL_Rect lastTileRect = currentMap->getTileRect(MAX(startedTilePos.x, tilePos.x),
+							     MAX(startedTilePos.y, tilePos.y));
+
+	    _selectionBox.pos.x = firstTileRect.x;
+	    _selectionBox.pos.y = firstTileRect.y;
+	    _selectionBox.pos.w = lastTileRect.x + lastTileRect.w - firstTileRect.x;
+	    _selectionBox.pos.h = lastTileRect.y + lastTileRect.h - firstTileRect.y;
 
 	    clipSelectionBoxToBoundary(&_selectionBox, currentMap->visibleArea);
 	}
@@ -657,10 +1856,10 @@ void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
 	{
 	    _selectionVisible = pointInRect(mousePos, currentMap->visibleArea);
 	    if (_selectionVisible)
-		moveSelectionInScrolledMap(&_selectionBox, currentMap->visibleArea, currentMap->drawOffset, mousePos, tileSize);
+		moveSelectionInScrolledMap(&_selectionBox, currentMap, mousePos);
 	}
     }
-    else if(_currentTool == MOVE_TOOL && _panel.visible && currentMap->tiles)
+    else if(_currentTool == MOVE_TOOL && _panel.visible && currentMap->pages.table)
     {
 	if (pointInRect(mousePos, currentMap->visibleArea))
 	{
@@ -671,49 +1870,8 @@ void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
 		currentMap->drawOffset.x += _lastFramePos.x - mousePos.x;
 	        currentMap->drawOffset.y += _lastFramePos.y - mousePos.y;
 
-		if (currentMap->drawOffset.x < 0)
-		{
-		    currentMap->drawOffset.x = 0;
-		}
-		else if (currentMap->drawOffset.x > currentMap->widthInTiles*tileSize - currentMap->visibleArea.w)
-		{
-		    currentMap->drawOffset.x = currentMap->widthInTiles*tileSize - currentMap->visibleArea.w;
-		}
-
-		if (currentMap->drawOffset.y < 0)
-		{
-		    currentMap->drawOffset.y = 0;
-		}
-		else if (currentMap->drawOffset.y > currentMap->heightInTiles*tileSize - currentMap->visibleArea.h)
-		{
-		    currentMap->drawOffset.y = currentMap->heightInTiles*tileSize - currentMap->visibleArea.h;
-		}
-
-		TexturedRect *scrollingBarY = &currentMap->verticalBar.scrollingRect;
-		TexturedRect *backgroundBarY = &currentMap->verticalBar.backgroundRect;
-		TexturedRect *scrollingBarX = &currentMap->horizontalBar.scrollingRect;
-		TexturedRect *backgroundBarX = &currentMap->horizontalBar.backgroundRect;
-		
-		scrollingBarY->pos.y = (int32)((real32)currentMap->drawOffset.y / (currentMap->heightInTiles*tileSize - currentMap->visibleArea.h) * (backgroundBarY->pos.h - scrollingBarY->pos.h) + backgroundBarY->pos.y);
-		scrollingBarX->pos.x = (int32)((real32)currentMap->drawOffset.x / (currentMap->widthInTiles*tileSize - currentMap->visibleArea.w) * (backgroundBarX->pos.w - scrollingBarX->pos.w) + backgroundBarX->pos.x);
-					
-		if (scrollingBarX->pos.x < backgroundBarX->pos.x)
-		{
-		    scrollingBarX->pos.x = backgroundBarX->pos.x;
-		}
-		else if (scrollingBarX->pos.x > backgroundBarX->pos.x + backgroundBarX->pos.w - scrollingBarX->pos.w)
-		{
-		    scrollingBarX->pos.x = backgroundBarX->pos.x + backgroundBarX->pos.w - scrollingBarX->pos.w;
-		}
-
-		if (scrollingBarY->pos.y < backgroundBarY->pos.y)
-		{
-		    scrollingBarY->pos.y = backgroundBarY->pos.y;
-		}
-		else if (scrollingBarY->pos.y > backgroundBarY->pos.y + backgroundBarY->pos.h - scrollingBarY->pos.h)
-		{
-		    scrollingBarY->pos.y = backgroundBarY->pos.y + backgroundBarY->pos.h - scrollingBarY->pos.h;
-		}
+		clampDrawOffset(currentMap);
+		moveScrollBarsToDrawOffset(currentMap);
 
 		_lastFramePos = mousePos;
 	    }
@@ -740,12 +1898,22 @@ void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag)
     {
 	_hoverToolIconVisible = false;
     }
+
+    if (!rectsEqual(oldSelection, _selectionBox.pos) ||
+	oldSelectionVisible != _selectionVisible ||
+	!rectsEqual(oldHoverIcon, _hoveringToolIcon.pos) ||
+	oldHoverIconVisible != _hoverToolIconVisible ||
+	oldDrawOffset != currentMap->drawOffset)
+    {
+	ui_requestRedraw();
+    }
 }
 
 void tileMapPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton)
 {
-    TileMap *currentMap = &_tileMaps[_selectedTileMap];
-    int32 tileSize = currentMap->tileSize;
+    PROFILE_SCOPE(PROFILE_TILE_MAP_INPUT);
+    
+    TileMap *currentMap = getSelectedTileMap();
     
     if (pointInRect(mousePos, currentMap->horizontalBar.scrollingRect.pos))
     {
@@ -762,18 +1930,18 @@ void tileMapPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton)
 				    
     _createNewButton.startedClick = pointInRect(mousePos, _createNewButton.background.pos);
 
-    if (_currentTool == PAINT_TOOL && currentMap->tiles)
+    if (_currentTool == PAINT_TOOL && currentMap->pages.table)
     {
 	if (mouseButton == SDL_BUTTON_LEFT)
 	{
 	    if (pointInRect(mousePos, currentMap->visibleArea))
-	    {	
+	    {
 		paintSelectedTile(currentMap, currentMap->visibleArea,
 				  currentMap->drawOffset, mousePos);
 	    }
 	}
     }
-    else if (_currentTool == FILL_TOOL && currentMap->tiles)
+    else if (_currentTool == FILL_TOOL && currentMap->pages.table)
     {
 	if (mouseButton == SDL_BUTTON_LEFT)
 	{
@@ -782,38 +1950,15 @@ void tileMapPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton)
 		Vector2 offset = {currentMap->visibleArea.x,
 				  currentMap->visibleArea.y};
 
-		//TODO(denis): this seems redudant and silly
 		Vector2 tilePos =
-		    convertScreenPosToTilePos(tileSize, offset,
+		    convertScreenPosToTilePos(currentMap->getViewTileSize(), offset,
 					      currentMap->drawOffset, mousePos);
 
-		_startSelectPos =
-		    convertTilePosToScreenPos(tileSize, offset,
-					      currentMap->drawOffset, tilePos);
-
-		if (_startSelectPos.x < offset.x)
-		{
-		    _selectionBox.pos.x = offset.x;
-		    _selectionBox.pos.w = tileSize - currentMap->drawOffset.x%tileSize;
-		}
-		else
-		{
-		    _selectionBox.pos.x = _startSelectPos.x;   
-		    _selectionBox.pos.w = tileSize;
-		}
-
-		if (_startSelectPos.y < offset.y)
-		{
-		    _selectionBox.pos.y = offset.y;
-		    _selectionBox.pos.h = tileSize - currentMap->drawOffset.y%tileSize;
-		}
-		else
-		{
-		    _selectionBox.pos.y = _startSelectPos.y;
-		    _selectionBox.pos.h = tileSize;
-		}
+		_startSelectPos = mousePos;
+		_startSelectTile = tilePos;
+		_endSelectTile = tilePos;
 
-		clipSelectionBoxToBoundary(&_selectionBox, currentMap->visibleArea);
+		moveSelectionInScrolledMap(&_selectionBox, currentMap, mousePos);
 	    }
 	    else
 	    {
@@ -821,7 +1966,7 @@ void tileMapPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton)
 	    }
 	}
     }
-    else if (_currentTool == MOVE_TOOL && currentMap->tiles)
+    else if (_currentTool == MOVE_TOOL && currentMap->pages.table)
     {
 	if ((currentMap->horizontalBar.backgroundRect.image || currentMap->verticalBar.backgroundRect.image) &&
 	    mouseButton == SDL_BUTTON_LEFT)
@@ -836,8 +1981,9 @@ void tileMapPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton)
 
 void tileMapPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
 {
-    TileMap *currentMap = &_tileMaps[_selectedTileMap];
-    int32 tileSize = currentMap->tileSize;
+    PROFILE_SCOPE(PROFILE_TILE_MAP_INPUT);
+    
+    TileMap *currentMap = getSelectedTileMap();
     
     currentMap->verticalBar.scrolling = false;
     currentMap->horizontalBar.scrolling = false;
@@ -852,6 +1998,9 @@ void tileMapPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
     }
     else if (ui_wasClicked(_fillToolIcon, mousePos))
     {
+	if (_currentTool == FILL_TOOL)
+	    _fillMode = _fillMode == FILL_RECTANGLE ? FILL_CONNECTED : FILL_RECTANGLE;
+
 	changeCurrentTool(&_currentTool, FILL_TOOL,
 			  &_paintToolIcon, &_fillToolIcon, &_moveToolIcon,
 			  &_selectedToolIcon, &_selectionVisible);
@@ -863,7 +2012,7 @@ void tileMapPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
 			  &_selectedToolIcon, &_selectionVisible);
     }
 
-    if (!currentMap->tiles)
+    if (!currentMap->pages.table)
     {
 	if (ui_wasClicked(_createNewButton, mousePos))
 	{
@@ -879,57 +2028,158 @@ void tileMapPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
     }
 
     //NOTE(denis): tool behaviour
-    if (currentMap->tiles)
+    if (currentMap->pages.table)
     {
-	if (_currentTool == FILL_TOOL)
+	endTileMapEdit(currentMap);
+	_paintStrokeOpen = false;
+	
+	if (_currentTool == FILL_TOOL && _fillMode == FILL_CONNECTED)
 	{
 	    if (_selectionVisible && _startSelectPos != Vector2{0,0})
 	    {
-		Vector2 topLeft = {_selectionBox.pos.x, _selectionBox.pos.y};
-				    
-		Vector2 botRight = {_selectionBox.pos.x + _selectionBox.pos.w-1,
-				    _selectionBox.pos.y + _selectionBox.pos.h-1};
+		Vector2 tilePos = _startSelectTile;
 
-		Vector2 offset = {currentMap->visibleArea.x, currentMap->visibleArea.y};
-		Vector2 startTile =
-		    convertScreenPosToTilePos(tileSize, offset, currentMap->drawOffset, topLeft);
-		Vector2 endTile =
-		    convertScreenPosToTilePos(tileSize, offset, currentMap->drawOffset, botRight);
+		TileId id;
+		if (tileSetPanelGetSelectedTile().size != 0 &&
+		    tilePos.x < currentMap->widthInTiles && tilePos.y < currentMap->heightInTiles &&
+		    currentMap->getTileId(tileSetPanelGetSelectedTile().sheetPos, &id))
+		{
+		    beginTileMapEdit(currentMap);
+		    currentMap->fillConnected(tilePos.x, tilePos.y, id);
+		    endTileMapEdit(currentMap);
+		}
+	    }
 
-		if (endTile.x > currentMap->widthInTiles)
+	    _selectionVisible = pointInRect(mousePos, currentMap->visibleArea);
+	    if (_selectionVisible)
+	    {
+		moveSelectionInScrolledMap(&_selectionBox, currentMap, mousePos);
+	    }
+	}
+	else if (_currentTool == FILL_TOOL)
+	{
+	    if (_selectionVisible && _startSelectPos != Vector2{0,0})
+	    {
+		//NOTE(denis): the tiles are kept rather than worked out from the
+		// selection box, zoomed out a pixel of the box can be many tiles
+		Vector2 startTile = {MIN(_startSelectTile.x, _endSelectTile.x),
+				     MIN(_startSelectTile.y, _endSelectTile.y)};
+		Vector2 endTile = {MAX(_startSelectTile.x, _endSelectTile.x),
+				   MAX(_startSelectTile.y, _endSelectTile.y)};
+
+		if (endTile.x >= currentMap->widthInTiles)
 		{
-		    endTile.x = currentMap->widthInTiles;
+		    endTile.x = currentMap->widthInTiles-1;
 		}
-		if (endTile.y > currentMap->heightInTiles)
+		if (endTile.y >= currentMap->heightInTiles)
 		{
-		    endTile.y = currentMap->heightInTiles;
+		    endTile.y = currentMap->heightInTiles-1;
 		}
-				    
-		for (int i = startTile.y; i <= endTile.y; ++i)
+
+		Tile selectedTile = tileSetPanelGetSelectedTile();
+		TileId id;
+		if (selectedTile.size != 0 && currentMap->getTileId(selectedTile.sheetPos, &id))
 		{
-		    for (int j = startTile.x; j <= endTile.x; ++j)
-		    {
-			if (tileSetPanelGetSelectedTile().size != 0)
-			{
-			    (currentMap->tiles + i*currentMap->widthInTiles + j)->sheetPos = tileSetPanelGetSelectedTile().sheetPos;
-			    (currentMap->tiles + i*currentMap->widthInTiles + j)->initialized = true;
-			}
-		    }
+		    beginTileMapEdit(currentMap);
+		    currentMap->fillRect(startTile.x, startTile.y, endTile.x, endTile.y, id);
+		    endTileMapEdit(currentMap);
 		}
 	    }
 
 	    _selectionVisible = pointInRect(mousePos, currentMap->visibleArea);
 	    if (_selectionVisible)
 	    {
-		moveSelectionInScrolledMap(&_selectionBox, currentMap->visibleArea, currentMap->drawOffset, mousePos, tileSize);
+		moveSelectionInScrolledMap(&_selectionBox, currentMap, mousePos);
 	    }
 	}
     }
 }
 
+void tileMapPanelForgetFillStart()
+{
+    _startSelectPos = {};
+    _selectionVisible = false;
+}
+
+void tileMapPanelCentreOnTile(int32 x, int32 y)
+{
+    TileMap *currentMap = getSelectedTileMap();
+
+    if (currentMap->pages.table)
+    {
+	Vector2 oldDrawOffset = currentMap->drawOffset;
+	int32 halfTile = (int32)(currentMap->getViewTileSize()/2);
+	
+	currentMap->drawOffset.x = currentMap->getViewTileEdge(x) + halfTile - currentMap->visibleArea.w/2;
+	currentMap->drawOffset.y = currentMap->getViewTileEdge(y) + halfTile - currentMap->visibleArea.h/2;
+	clampDrawOffset(currentMap);
+	moveScrollBarsToDrawOffset(currentMap);
+
+	if (oldDrawOffset != currentMap->drawOffset)
+	    ui_requestRedraw();
+    }
+}
+
+//NOTE(denis): each notch of the wheel zooms by this much
+#define ZOOM_STEP 1.25f
+
+void tileMapPanelOnMouseWheel(Vector2 mousePos, int32 amount)
+{
+    PROFILE_SCOPE(PROFILE_TILE_MAP_INPUT);
+
+    TileMap *currentMap = getSelectedTileMap();
+
+    if (_panel.visible && currentMap->pages.table &&
+	pointInRect(mousePos, currentMap->visibleArea))
+    {
+	real32 oldZoom = currentMap->zoom;
+	real32 newZoom = oldZoom;
+	
+	for (int32 i = 0; i < amount; ++i)
+	    newZoom *= ZOOM_STEP;
+	for (int32 i = 0; i > amount; --i)
+	    newZoom /= ZOOM_STEP;
+
+	//NOTE(denis): it can zoom out until the whole map fits in the panel
+	real32 fitZoom = MIN((real32)_tileMapArea.w/(currentMap->widthInTiles*currentMap->tileSize),
+			     (real32)_tileMapArea.h/(currentMap->heightInTiles*currentMap->tileSize));
+	newZoom = MAX(newZoom, MIN(fitZoom, 1.0f));
+	newZoom = MIN(newZoom, MAX_TILE_MAP_ZOOM);
+
+	//NOTE(denis): so going back and forth always gets back to 1:1
+	if (newZoom > 1.0f/ZOOM_STEP*1.01f && newZoom < ZOOM_STEP*0.99f)
+	    newZoom = 1.0f;
+
+	if (newZoom != oldZoom)
+	{
+	    //NOTE(denis): the part of the map under the mouse stays under it
+	    Vector2 mouseInArea = {mousePos.x - currentMap->visibleArea.x,
+				   mousePos.y - currentMap->visibleArea.y};
+	    real64 scale = (real64)newZoom/oldZoom;
+	    
+	    currentMap->zoom = newZoom;
+	    currentMap->drawOffset.x = (int32)((currentMap->drawOffset.x + mouseInArea.x)*scale) - mouseInArea.x;
+	    currentMap->drawOffset.y = (int32)((currentMap->drawOffset.y + mouseInArea.y)*scale) - mouseInArea.y;
+
+	    fitTileMapToPanel(currentMap);
+	    clampDrawOffset(currentMap);
+	    moveScrollBarsToDrawOffset(currentMap);
+
+	    //NOTE(denis): the tiles under the mouse changed, so the selection has
+	    // to move just like it would if the mouse had
+	    int32 leftClickFlag = SDL_GetMouseState(NULL, NULL) & SDL_BUTTON_LMASK;
+	    tileMapPanelOnMouseMove(mousePos, leftClickFlag);
+	    
+	    ui_requestRedraw();
+	}
+    }
+}
+
 void tileMapPanelOnKeyPressed(SDL_Keycode key)
 {
-    if (_tileMaps[_selectedTileMap].tiles)
+    PROFILE_SCOPE(PROFILE_TILE_MAP_INPUT);
+    
+    if (getSelectedTileMap()->pages.table)
     {
 	if (_currentTool != MOVE_TOOL)
 	    _previousTool = _currentTool;
@@ -942,7 +2192,9 @@ void tileMapPanelOnKeyPressed(SDL_Keycode key)
 
 void tileMapPanelOnKeyReleased(SDL_Keycode key)
 {
-    if (_tileMaps[_selectedTileMap].tiles)
+    PROFILE_SCOPE(PROFILE_TILE_MAP_INPUT);
+    
+    if (getSelectedTileMap()->pages.table)
     {
 	if (key == SDLK_SPACE)
 	{
@@ -962,6 +2214,20 @@ void tileMapPanelOnKeyReleased(SDL_Keycode key)
 			      &_paintToolIcon, &_fillToolIcon, &_moveToolIcon,
 			      &_selectedToolIcon, &_selectionVisible);
 	}
+	else if (key == SDLK_r)
+	{
+	    _fillMode = FILL_RECTANGLE;
+	    changeCurrentTool(&_currentTool, FILL_TOOL,
+			      &_paintToolIcon, &_fillToolIcon, &_moveToolIcon,
+			      &_selectedToolIcon, &_selectionVisible);
+	}
+	else if (key == SDLK_b)
+	{
+	    _fillMode = FILL_CONNECTED;
+	    changeCurrentTool(&_currentTool, FILL_TOOL,
+			      &_paintToolIcon, &_fillToolIcon, &_moveToolIcon,
+			      &_selectedToolIcon, &_selectionVisible);
+	}
 	else if (key == SDLK_p)
 	{
 	    changeCurrentTool(&_currentTool, PAINT_TOOL,
@@ -971,77 +2237,144 @@ void tileMapPanelOnKeyReleased(SDL_Keycode key)
     }
 }
 
-TileMap* tileMapPanelCreateNewTileMap()
+TileMapHandle tileMapPanelCreateNewTileMap()
 {
-    TileMap *result = 0;
-
     NewTileMapPanelData *data = newTileMapPanelGetData();
-    _tileMaps[_numTileMaps] =
-	createNewTileMap(data->tileMapName, data->widthInTiles, data->heightInTiles,
-			 data->tileSize);
+    TileMap newTileMap = createNewTileMap(data->tileMapName, data->widthInTiles,
+					  data->heightInTiles, data->tileSize);
+    TileMapHandle result = addTileMapSlot(newTileMap);
 
-    result = &_tileMaps[_numTileMaps];
+    newTileMapPanelSetVisible(false);
 
-    fitTileMapToPanel(result);
-    
-    _selectedTileMap = _numTileMaps;
-    ++_numTileMaps;
+    TileMap *tileMap = getTileMap(result);
+    if (!tileMap)
+    {
+	newTileMap.freeTiles();
+	HEAP_FREE(data->tileMapName);
+	return result;
+    }
 
-    newTileMapPanelSetVisible(false);
+    fitTileMapToPanel(tileMap);
+    
+    _selectedTileMap = result;
 
     if (_selectionBox.pos.w == 0 && _selectionBox.pos.h == 0)
     {
-	initializeSelectionBox(_renderer, &_selectionBox, result->tileSize);
+	initializeSelectionBox(_renderer, &_selectionBox, tileMap->tileSize);
     }
 
     return result;
 }
 
-TileMap* tileMapPanelAddTileMap(TileMapTile *tiles, char *name,
-				uint32 width, uint32 height, uint32 tileSize,
-				char* tileSetName)
+TileMapHandle tileMapPanelAddTileMap(char *name, uint32 width, uint32 height,
+				     uint32 tileSize, char* tileSetName)
 {
-    TileMap *result = 0;
-    _tileMaps[_numTileMaps] = initializeTileMap(name, width, height, tileSize);
-    result = &_tileMaps[_numTileMaps];
+    TileMapHandle result = {};
+    
+    TileMap newTileMap = initializeTileMap(name, width, height, tileSize);
+    if (!newTileMap.createTiles(_memoryBudget))
+	return result;
+    
+    result = addTileMapSlot(newTileMap);
+    TileMap *tileMap = getTileMap(result);
+    if (!tileMap)
+    {
+	newTileMap.freeTiles();
+	return result;
+    }
 
-    _selectedTileMap = _numTileMaps;
-    ++_numTileMaps;
+    _selectedTileMap = result;
     
-    result->tiles = tiles;
-    result->tileSetName = tileSetName;
+    tileMap->tileSetName = tileSetName;
 
-    fitTileMapToPanel(result);
+    fitTileMapToPanel(tileMap);
 
     if (_selectionBox.pos.w == 0 && _selectionBox.pos.h == 0)
     {
-	initializeSelectionBox(_renderer, &_selectionBox, result->tileSize);
+	initializeSelectionBox(_renderer, &_selectionBox, tileMap->tileSize);
     }
 
     return result;
 }
 
-void tileMapPanelRemoveTileMap(uint32 position)
+TileMapHandle tileMapPanelAddMappedTileMap(TileMapView *view, char *tileSetName)
 {
-    if (position >= 0 && position < _numTileMaps)
+    //NOTE(denis): refused rather than opened with the tiles past the limit lost
+    if (view->version != 1 && view->paletteSize > MAX_TILE_MAP_PALETTE_SIZE)
     {
-	_selectedTileMap = MIN(position-1, 0);
-	
-	HEAP_FREE(_tileMaps[position].tiles);
-	HEAP_FREE(_tileMaps[position].name);
-	HEAP_FREE(_tileMaps[position].tileSetName);
+	TileMapHandle none = {};
+	return none;
+    }
+    
+    //NOTE(denis): none of the tiles are set until getTile copies them out of
+    // the view, the untouched parts of a big map never get a page at all
+    char *name = duplicateString(view->tileMapName);
+    TileMapHandle result = tileMapPanelAddTileMap(name, view->tileMapWidth,
+						  view->tileMapHeight, view->tileSize,
+						  tileSetName);
+
+    TileMap *tileMap = getTileMap(result);
+    if (tileMap)
+    {
+	//NOTE(denis): copied as is, even repeated entries, so the file's palette
+	// indices are the ids without looking anything up
+	TileId *ids = 0;
+	if (view->version != 1 && reservePalette(tileMap, view->paletteSize))
+	{
+	    ids = (TileId*)HEAP_ALLOC(view->paletteSize*sizeof(TileId));
+	}
 
-	for (uint32 i = position+1; i < _numTileMaps; ++i)
+	if (ids)
 	{
-	    _tileMaps[i-1] = _tileMaps[i];
+	    for (uint32 i = 0; i < view->paletteSize; ++i)
+	    {
+		tileMap->palette[i] = view->palette[i];
+		addToPaletteLookup(tileMap, i);
+		ids[i] = (TileId)i;
+	    }
+	    tileMap->paletteSize = view->paletteSize;
 	}
 	
-	--_numTileMaps;
+	tileMap->attachSource(view, ids);
+	*view = {};
+    }
+    else
+    {
+	HEAP_FREE(name);
+    }
+
+    return result;
+}
+
+void tileMapPanelRemoveTileMap(TileMapHandle handle)
+{
+    TileMap *tileMap = getTileMap(handle);
+
+    if (tileMap)
+    {
+	//NOTE(denis): the save thread could still be reading these tiles
+	waitForTileMapSave();
+	
+	tileMap->closeSource();
+	freeChunks(tileMap);
+	freeScrollBars(tileMap);
+	tileMap->freeTiles();
+	HEAP_FREE(tileMap->name);
+	if (tileMap->tileSetName)
+	{
+	    HEAP_FREE(tileMap->tileSetName);
+	}
+
+	freeTileMapSlot(handle);
     }
+}
 
-    if (_numTileMaps == 0)
+void tileMapPanelOnRenderTargetsReset()
+{
+    for (uint32 i = 0; i < _numTileMapSlots; ++i)
     {
-	_tileMaps[0] = {};
+	if (_tileMapSlots[i].inUse)
+	    markAllChunksDirty(&_tileMapSlots[i].tileMap);
     }
 }
 
@@ -1050,6 +2383,43 @@ bool tileMapPanelVisible()
     return _panel.visible;
 }
 
+void tileMapPanelSetMemoryBudget(uint64 bytes)
+{
+    _memoryBudget = bytes;
+}
+
+void tileMapPanelSetUndoMemoryLimit(uint32 bytes)
+{
+    _undoMemoryLimit = bytes;
+}
+
+bool tileMapPanelUndo()
+{
+    bool result = false;
+    
+    TileMap *currentMap = getSelectedTileMap();
+    if (currentMap->pages.table)
+	result = undoTileMapEdit(currentMap);
+
+    return result;
+}
+
+bool tileMapPanelRedo()
+{
+    bool result = false;
+    
+    TileMap *currentMap = getSelectedTileMap();
+    if (currentMap->pages.table)
+	result = redoTileMapEdit(currentMap);
+
+    return result;
+}
+
+SDL_Rect tileMapPanelGetMapArea()
+{
+    return _tileMapArea;
+}
+
 void tileMapPanelSetVisible(bool newValue)
 {
     _panel.visible = newValue;
@@ -1059,25 +2429,17 @@ bool tileMapPanelTileMapIsValid()
 {
     bool result = false;
     
-    TileMap *currentMap = &_tileMaps[_selectedTileMap];
+    TileMap *currentMap = getSelectedTileMap();
 
-    if (currentMap->tiles)
+    if (currentMap->pages.table)
     {
-	bool allInitialized = true;
-	
-	for (int i = 0; i < currentMap->heightInTiles && allInitialized; ++i)
-	{
-	    for (int j = 0; j < currentMap->widthInTiles && allInitialized; ++j)
-	    {
-		TileMapTile *currentTile =
-		    currentMap->tiles + j + i*currentMap->widthInTiles;
-
-		if (!currentTile->initialized)
-		{
-		    allInitialized = false;
-		}
-	    }
-	}
+	//NOTE(denis): every tile in a mapped file or a map with a default tile is
+	// set, otherwise every tile has to have been set. the count is kept as
+	// tiles are set so this doesn't read pages back in from the page file
+	TileMapPages *pages = &currentMap->pages;
+	bool allInitialized = currentMap->source.mappedMemory != 0 ||
+	    pages->hasDefaultTile ||
+	    pages->numInitialized == (uint64)currentMap->widthInTiles*currentMap->heightInTiles;
 
 	result = allInitialized && (currentMap->name != 0);
     }
@@ -1087,17 +2449,36 @@ bool tileMapPanelTileMapIsValid()
 
 TileMap* tileMapPanelGetCurrentTileMap()
 {
-    return &_tileMaps[_selectedTileMap];
+    return getSelectedTileMap();
 }
 
-uint32 tileMapPanelGetCurrentTileMapIndex()
+TileMapHandle tileMapPanelGetCurrentTileMapHandle()
 {
     return _selectedTileMap;
 }
 
-void tileMapPanelSelectTileMap(uint32 newSelection)
+TileMap* tileMapPanelGetTileMap(TileMapHandle handle)
+{
+    return getTileMap(handle);
+}
+
+TileMap* tileMapPanelGetTileMapWithPages(TileMapPages *pages)
+{
+    TileMap *result = 0;
+
+    for (uint32 i = 0; i < _numTileMapSlots && !result; ++i)
+    {
+	TileMapSlot *slot = _tileMapSlots + i;
+	if (slot->inUse && slot->tileMap.pages.table == pages->table)
+	    result = &slot->tileMap;
+    }
+
+    return result;
+}
+
+void tileMapPanelSelectTileMap(TileMapHandle newSelection)
 {
-    if (newSelection < _numTileMaps)
+    if (getTileMap(newSelection))
     {
 	_selectedTileMap = newSelection;
     }
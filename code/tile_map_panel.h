@@ -2,36 +2,65 @@
 #define TILE_MAP_PANEL_H_
 
 #include "denis_meta.h"
+#include "tile_map_file.h"
+#include "tile_map_pages.h"
+#include "tile_map_history.h"
 #include "SDL_keycode.h"
+#include <math.h>
 
-struct TileMapTile
+//NOTE(denis): way past the number of cells on any sheet that fits in a texture
+#define MAX_TILE_MAP_PALETTE_SIZE 0x1000000
+
+//NOTE(denis): maps added after this is changed keep at most this many bytes of
+// pages in memory, the rest go to a scratch file
+#define DEFAULT_TILE_MAP_MEMORY_BUDGET (1024ull*1024*1024)
+
+#define TILE_MAP_CHUNK_SIZE 32
+
+#define MAX_TILE_MAP_ZOOM 8.0f
+
+struct TileMapChunk
 {
-    union
-    {
-	Tile tile;
-	
-	struct
-	{
-	    uint32 size;
-	    
-	    Point2 pos;
-	    Point2 sheetPos;
-	};
-    };
-
-    bool initialized;
+    SDL_Texture *texture;
+    //NOTE(denis): which of the tile set's mips the chunk was drawn from
+    uint32 mipLevel;
+    bool dirty;
+    uint32 lastDrawnFrame;
+};
+
+//NOTE(denis): rectangles of tiles that changed, in tiles. once there are too
+// many of them they are merged into one that covers them all
+#define MAX_CHANGED_TILE_RECTS 64
+
+struct ChangedTiles
+{
+    SDL_Rect rects[MAX_CHANGED_TILE_RECTS];
+    uint32 numRects;
 };
 
 struct TileMap
 {
-    TileMapTile *tiles;
+    TileMapPages pages;
+    TileMapHistory history;
+
+    //NOTE(denis): paletteLookup is a hash table of palette index + 1 by sheet
+    // position, 0 is an empty slot
+    Point2 *palette;
+    uint32 paletteSize;
+    uint32 maxPaletteSize;
+    uint32 *paletteLookup;
+    uint32 paletteLookupSize;
+    
     char *name;
     int tileSize;
     int widthInTiles;
     int heightInTiles;
     
     Vector2 offset;
+    //NOTE(denis): in screen pixels, so it changes with the zoom
     Vector2 drawOffset;
+    //NOTE(denis): how many screen pixels a pixel of a tile takes up
+    real32 zoom;
     
     SDL_Rect visibleArea;
 
@@ -39,6 +68,39 @@ struct TileMap
     ScrollBar verticalBar;
 
     char *tileSetName;
+
+    //NOTE(denis): maps opened from a file keep the file mapped and only copy
+    // a tile into its page the first time it is touched
+    TileMapView source;
+    //NOTE(denis): the id of every entry in the source file's palette, 0 for
+    // version 1 files which have no palette and go through getTileId instead
+    TileId *sourceIds;
+
+    //NOTE(denis): the map is drawn from textures of chunkSizeInTiles by
+    // chunkSizeInTiles tiles that are only redrawn once a tile in them changes,
+    // chunkSizeInTiles is only smaller than TILE_MAP_CHUNK_SIZE for huge tiles
+    TileMapChunk *chunks;
+    int32 chunkSizeInTiles;
+    int32 widthInChunks;
+    int32 heightInChunks;
+    SDL_Texture *chunkTileSetImage;
+    //NOTE(denis): the zoomed out view of the map has to be made again
+    bool overviewDirty;
+    //NOTE(denis): what changed since the minimap last caught up with the map
+    ChangedTiles changedTiles;
+    
+    real32 getViewTileSize()
+    {
+	return tileSize*zoom;
+    }
+
+    //NOTE(denis): how far the start of tile x is from the start of the map on
+    // screen. tiles are rounded up to the next pixel so every pixel on screen
+    // is in exactly one tile, no matter the zoom
+    int32 getViewTileEdge(int32 x)
+    {
+	return (int32)ceil((real64)x*tileSize*zoom);
+    }
     
     SDL_Rect getRect()
     {
@@ -46,11 +108,76 @@ struct TileMap
 	
 	result.x = offset.x;
 	result.y = offset.y;
-	result.w = tileSize*widthInTiles;
-	result.h = tileSize*heightInTiles;
+	result.w = getViewTileEdge(widthInTiles);
+	result.h = getViewTileEdge(heightInTiles);
 	
 	return result;
     }
+
+    //NOTE(denis): where the tile is on screen, with the map scrolled to
+    // drawOffset. zoomed far out tiles can share a pixel, they are still given one
+    SDL_Rect getTileRect(int32 x, int32 y)
+    {
+	SDL_Rect result = {};
+
+	result.x = visibleArea.x + getViewTileEdge(x) - drawOffset.x;
+	result.y = visibleArea.y + getViewTileEdge(y) - drawOffset.y;
+	result.w = MAX(getViewTileEdge(x+1) - getViewTileEdge(x), 1);
+	result.h = MAX(getViewTileEdge(y+1) - getViewTileEdge(y), 1);
+
+	return result;
+    }
+
+    //NOTE(denis): memoryBudget is in bytes, 0 for no limit. returns false if
+    // there wasn't enough memory
+    bool createTiles(uint64 memoryBudget);
+    void freeTiles();
+
+    //NOTE(denis): always get tiles through here, it copies the tile out of the
+    // mapped source file if it hasn't been touched yet. returns false if the
+    // tile hasn't been set
+    bool getTile(int32 x, int32 y, Point2 *sheetPos);
+    //NOTE(denis): same as getTile but gives the tile's palette id
+    bool getTileIdAt(int32 x, int32 y, TileId *id);
+    //NOTE(denis): like getTile but never copies the tile out of the source
+    // file or reads a page back in, for looking at lots of tiles without making
+    // pages for them or going through the page file. tiles in pages that are
+    // out in the page file aren't known, they return false
+    bool peekTile(int32 x, int32 y, Point2 *sheetPos);
+    //NOTE(denis): adds the sheet position to the palette if it isn't in it,
+    // returns false if the palette is already full
+    bool getTileId(Point2 sheetPos, TileId *id);
+    //NOTE(denis): returns false and leaves the tile alone if the palette is
+    // full or the tile's page couldn't be allocated
+    bool setTile(int32 x, int32 y, Point2 sheetPos);
+    //NOTE(denis): for setting lots of tiles to the same thing, get the id once
+    // with getTileId
+    bool setTileId(int32 x, int32 y, TileId id);
+    //NOTE(denis): sets every tile from (firstX, firstY) to (lastX, lastY) a page
+    // at a time, returns false if a page couldn't be allocated
+    bool fillRect(int32 firstX, int32 firstY, int32 lastX, int32 lastY, TileId id);
+    //NOTE(denis): sets every tile joined to (x, y) that looks the same as it,
+    // going up, down, left and right. returns false if a page couldn't be
+    // allocated, whatever was filled by then stays filled
+    bool fillConnected(int32 x, int32 y, TileId id);
+    //NOTE(denis): redraws the chunk the tile is in the next time it is drawn
+    void markTileChanged(int32 x, int32 y);
+    void markTilesChanged(int32 firstX, int32 firstY, int32 lastX, int32 lastY);
+    //NOTE(denis): copies every untouched tile out of the source file and unmaps it
+    void detachSource();
+    //NOTE(denis): unmaps the source file without copying anything, the untouched
+    // tiles are lost unless a new source with the same tiles is attached
+    void closeSource();
+    //NOTE(denis): the map takes the view and ids, the ids can be 0 for version 1
+    void attachSource(TileMapView *view, TileId *ids);
+};
+
+//NOTE(denis): refers to an open tile map, once the map is removed the handle
+// never matches a map again, even if its slot gets reused
+struct TileMapHandle
+{
+    uint32 slot;
+    uint32 generation;
 };
 
 void tileMapPanelCreateNew(SDL_Renderer *renderer, uint32 x, uint32 y,
@@ -61,22 +188,63 @@ void tileMapPanelDraw();
 void tileMapPanelOnMouseMove(Vector2 mousePos, int32 leftClickFlag);
 void tileMapPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton);
 void tileMapPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton);
+//NOTE(denis): for a press the panel never saw, so the next mouse up doesn't
+// fill from wherever the last one started
+void tileMapPanelForgetFillStart();
+//NOTE(denis): zooms the selected map in or out around the mouse, amount is
+// how many notches the wheel moved, positive to zoom in
+void tileMapPanelOnMouseWheel(Vector2 mousePos, int32 amount);
+//NOTE(denis): scrolls the selected map so the tile is in the middle of the
+// view, or as close as it can get
+void tileMapPanelCentreOnTile(int32 x, int32 y);
 
 void tileMapPanelOnKeyPressed(SDL_Keycode key);
 void tileMapPanelOnKeyReleased(SDL_Keycode key);
+//NOTE(denis): call on SDL_RENDER_TARGETS_RESET, the chunk textures lose what
+// was drawn to them when that happens
+void tileMapPanelOnRenderTargetsReset();
+
+//NOTE(denis): a newly added map becomes the selected one. returns a handle
+// that matches no map if it couldn't be added
+TileMapHandle tileMapPanelCreateNewTileMap();
+//NOTE(denis): none of the tiles are set, returns a handle that matches no map
+// if the tiles couldn't be allocated. the map takes name and tileSetName and
+// frees them when it is removed, if no map was added they're still the caller's
+TileMapHandle tileMapPanelAddTileMap(char *name, uint32 width, uint32 height,
+				     uint32 tileSize, char *tileSetName);
+//NOTE(denis): takes ownership of the view, it is unmapped when the tile map is
+// removed, returns a handle that matches no map if the tiles couldn't be allocated
+// or the file's palette is too big to give every entry an id. the view and
+// tileSetName are left alone in that case, tileSetName is taken the same way
+// tileMapPanelAddTileMap takes it
+TileMapHandle tileMapPanelAddMappedTileMap(TileMapView *view, char *tileSetName);
+//NOTE(denis): if it was the selected map then nothing is selected afterwards
+void tileMapPanelRemoveTileMap(TileMapHandle handle);
+
+//NOTE(denis): in bytes, only applies to maps added afterwards
+void tileMapPanelSetMemoryBudget(uint64 bytes);
+//NOTE(denis): in bytes per map, only applies to maps added afterwards
+void tileMapPanelSetUndoMemoryLimit(uint32 bytes);
 
-TileMap* tileMapPanelCreateNewTileMap();
-TileMap* tileMapPanelAddTileMap(TileMapTile *tiles, char *name,
-				uint32 width, uint32 height, uint32 tileSize,
-				char *tileSetName);
-void tileMapPanelRemoveTileMap(uint32 position);
+//NOTE(denis): undo and redo the last edit to the selected map, return false
+// if there wasn't one
+bool tileMapPanelUndo();
+bool tileMapPanelRedo();
 
 bool tileMapPanelVisible();
 void tileMapPanelSetVisible(bool newValue);
+//NOTE(denis): the part of the panel maps are drawn in
+SDL_Rect tileMapPanelGetMapArea();
 
 bool tileMapPanelTileMapIsValid();
+//NOTE(denis): never 0, while nothing is selected it is an empty map with no tiles
 TileMap* tileMapPanelGetCurrentTileMap();
-uint32 tileMapPanelGetCurrentTileMapIndex();
-void tileMapPanelSelectTileMap(uint32 newSelection);
+TileMapHandle tileMapPanelGetCurrentTileMapHandle();
+//NOTE(denis): returns 0 if the map was removed, the pointer is only good until
+// the next map is added
+TileMap* tileMapPanelGetTileMap(TileMapHandle handle);
+//NOTE(denis): the map using that page table, or 0 if none of them are
+TileMap* tileMapPanelGetTileMapWithPages(TileMapPages *pages);
+void tileMapPanelSelectTileMap(TileMapHandle newSelection);
 
 #endif
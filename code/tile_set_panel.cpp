@@ -1,5 +1,7 @@
 #include "SDL_render.h"
 #include "SDL_surface.h"
+#include "SDL_cpuinfo.h"
+#include <immintrin.h>
 #include "ui_elements.h"
 #include "denis_math.h"
 #include "main.h"
@@ -21,8 +23,25 @@
 
 static SDL_Renderer *_renderer;
 
-static TileSet _tileSets[15];
+//NOTE(denis): a tile set's id is where it is in _tileSets, tile sets are never
+// removed so ids don't change. the name index is an open addressing hash table
+// of id + 1, 0 means the entry is empty, it is kept at most half full
+#define INITIAL_TILE_SETS 16
+#define NO_TILE_SET 0xFFFFFFFF
+
+static TileSet *_tileSets;
 static uint32 _numTileSets;
+static uint32 _maxTileSets;
+static uint32 _selectedTileSet = NO_TILE_SET;
+
+static uint32 *_nameIndex;
+static uint32 _nameIndexSize;
+
+//NOTE(denis): which tile set each drop down item is, item 0 is the selected one
+static uint32 *_dropDownTileSets;
+
+//NOTE(denis): what the panel works on while there are no tile sets
+static TileSet _noTileSet;
 
 static UIPanel _panel;
 static DropDownMenu _tileSetDropDown;
@@ -36,49 +55,743 @@ static bool _importTileSetPressed;
 
 static bool _startedClick;
 
-//NOTE(denis): this function returns false if over 80% of the pixels in
-// a tile have an alpha value below the threshold
-static bool tileIsValid(SDL_Surface *image, SDL_Rect tile)
+//NOTE(denis): FNV-1a
+static uint32 hashTileSetName(char *name)
 {
-    bool result = true;
+    uint32 result = 2166136261u;
 
-    if (SDL_MUSTLOCK(image) == SDL_TRUE)
-	SDL_LockSurface(image);
+    for (uint32 i = 0; name[i] != 0; ++i)
+    {
+	result ^= (uint8)name[i];
+	result *= 16777619u;
+    }
 
-    uint32 bytesPerPixel = image->format->BytesPerPixel;
-    
-    if (bytesPerPixel == 4)
+    return result;
+}
+
+static uint32 findTileSetByName(char *name)
+{
+    uint32 result = NO_TILE_SET;
+
+    if (_nameIndexSize > 0 && name)
+    {
+	uint32 mask = _nameIndexSize-1;
+	uint32 entry = hashTileSetName(name) & mask;
+
+	while (_nameIndex[entry] != 0 && result == NO_TILE_SET)
+	{
+	    uint32 id = _nameIndex[entry]-1;
+	    if (stringsEqual(name, _tileSets[id].name))
+		result = id;
+
+	    entry = (entry+1) & mask;
+	}
+    }
+
+    return result;
+}
+
+//NOTE(denis): if two tile sets have the same name the first one keeps it
+static void addToNameIndex(uint32 id)
+{
+    uint32 mask = _nameIndexSize-1;
+    uint32 entry = hashTileSetName(_tileSets[id].name) & mask;
+
+    bool done = false;
+    while (!done)
     {
-	real32 pixelCount = (real32)tile.w * (real32)tile.h;
-	real32 transparentPixelCount = 0;
+	if (_nameIndex[entry] == 0)
+	{
+	    _nameIndex[entry] = id+1;
+	    done = true;
+	}
+	else if (stringsEqual(_tileSets[id].name, _tileSets[_nameIndex[entry]-1].name))
+	{
+	    done = true;
+	}
+
+	entry = (entry+1) & mask;
+    }
+}
+
+//NOTE(denis): returns NO_TILE_SET if there was no room and the arrays couldn't
+// be grown, the old ones are kept as they were
+static uint32 addTileSet()
+{
+    if (_numTileSets == _maxTileSets)
+    {
+	uint32 newMaxTileSets = MAX(_maxTileSets*2, INITIAL_TILE_SETS);
+	uint32 newNameIndexSize = newMaxTileSets*2;
 	
-	uint32 *row = (uint32*)((uint8*)image->pixels + tile.x*bytesPerPixel + tile.y*image->pitch);
-	for (int32 i = 0; i < tile.h; ++i)
+	TileSet *newTileSets = (TileSet*)HEAP_ALLOC(newMaxTileSets*sizeof(TileSet));
+	uint32 *newDropDownTileSets = (uint32*)HEAP_ALLOC(newMaxTileSets*sizeof(uint32));
+	uint32 *newNameIndex = (uint32*)HEAP_ALLOC(newNameIndexSize*sizeof(uint32));
+
+	if (!newTileSets || !newDropDownTileSets || !newNameIndex)
 	{
-	    uint32 *pixel = row;
-	    for (int32 j = 0; j < tile.w; ++j)
+	    if (newTileSets)
+	    {
+		HEAP_FREE(newTileSets);
+	    }
+	    if (newDropDownTileSets)
+	    {
+		HEAP_FREE(newDropDownTileSets);
+	    }
+	    if (newNameIndex)
 	    {
-		uint32 alphaValue = (*pixel) & image->format->Amask;
-		alphaValue >>= image->format->Ashift;
+		HEAP_FREE(newNameIndex);
+	    }
+	    
+	    return NO_TILE_SET;
+	}
+
+	for (uint32 i = 0; i < _numTileSets; ++i)
+	{
+	    newTileSets[i] = _tileSets[i];
+	    newDropDownTileSets[i] = _dropDownTileSets[i];
+	}
+
+	if (_tileSets)
+	{
+	    HEAP_FREE(_tileSets);
+	}
+	if (_dropDownTileSets)
+	{
+	    HEAP_FREE(_dropDownTileSets);
+	}
+	if (_nameIndex)
+	{
+	    HEAP_FREE(_nameIndex);
+	}
+
+	_tileSets = newTileSets;
+	_dropDownTileSets = newDropDownTileSets;
+	_maxTileSets = newMaxTileSets;
+	_nameIndex = newNameIndex;
+	_nameIndexSize = newNameIndexSize;
+
+	for (uint32 i = 0; i < _numTileSets; ++i)
+	{
+	    addToNameIndex(i);
+	}
+    }
+
+    return _numTileSets++;
+}
+
+static TileSet* getSelectedTileSet()
+{
+    TileSet *result = &_noTileSet;
+
+    if (_selectedTileSet != NO_TILE_SET)
+	result = _tileSets + _selectedTileSet;
 
-		if (alphaValue < ALPHA_THRESHOLD)
-		    ++transparentPixelCount;
+    return result;
+}
+
+//NOTE(denis): a tile is invalid if over 80% of its pixels have an alpha value
+// below the threshold. each of these counts how many of a run of pixels do
+typedef uint32 CountTransparentPixels(uint32 *pixels, uint32 numPixels,
+				      uint32 alphaMask, uint32 alphaShift);
+
+static uint32 countTransparentPixelsScalar(uint32 *pixels, uint32 numPixels,
+					   uint32 alphaMask, uint32 alphaShift)
+{
+    uint32 result = 0;
+
+    for (uint32 i = 0; i < numPixels; ++i)
+    {
+	if (((pixels[i] & alphaMask) >> alphaShift) < ALPHA_THRESHOLD)
+	    ++result;
+    }
+
+    return result;
+}
+
+static uint32 countTransparentPixelsSSE2(uint32 *pixels, uint32 numPixels,
+					 uint32 alphaMask, uint32 alphaShift)
+{
+    __m128i mask = _mm_set1_epi32((int32)alphaMask);
+    __m128i shift = _mm_cvtsi32_si128((int32)alphaShift);
+    __m128i threshold = _mm_set1_epi32(ALPHA_THRESHOLD);
+    __m128i counts = _mm_setzero_si128();
+
+    uint32 numWide = numPixels & ~3u;
+    for (uint32 i = 0; i < numWide; i += 4)
+    {
+	__m128i alpha = _mm_loadu_si128((__m128i*)(pixels + i));
+	alpha = _mm_srl_epi32(_mm_and_si128(alpha, mask), shift);
+
+	//NOTE(denis): the compare is -1 in every lane that is transparent
+	counts = _mm_sub_epi32(counts, _mm_cmplt_epi32(alpha, threshold));
+    }
+
+    uint32 lanes[4];
+    _mm_storeu_si128((__m128i*)lanes, counts);
+    uint32 result = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    return result + countTransparentPixelsScalar(pixels + numWide, numPixels - numWide,
+						 alphaMask, alphaShift);
+}
+
+//NOTE(denis): msvc lets any function use AVX2, gcc and clang need to be told
+// for just this one so the rest still runs on machines without it
+#if defined(__GNUC__)
+__attribute__((target("avx2")))
+#endif
+static uint32 countTransparentPixelsAVX2(uint32 *pixels, uint32 numPixels,
+					 uint32 alphaMask, uint32 alphaShift)
+{
+    __m256i mask = _mm256_set1_epi32((int32)alphaMask);
+    __m128i shift = _mm_cvtsi32_si128((int32)alphaShift);
+    __m256i threshold = _mm256_set1_epi32(ALPHA_THRESHOLD);
+    __m256i counts = _mm256_setzero_si256();
+
+    uint32 numWide = numPixels & ~7u;
+    for (uint32 i = 0; i < numWide; i += 8)
+    {
+	__m256i alpha = _mm256_loadu_si256((__m256i*)(pixels + i));
+	alpha = _mm256_srl_epi32(_mm256_and_si256(alpha, mask), shift);
+	counts = _mm256_sub_epi32(counts, _mm256_cmpgt_epi32(threshold, alpha));
+    }
+
+    uint32 lanes[8];
+    _mm256_storeu_si256((__m256i*)lanes, counts);
+    _mm256_zeroupper();
+
+    uint32 result = 0;
+    for (uint32 i = 0; i < 8; ++i)
+    {
+	result += lanes[i];
+    }
+
+    return result + countTransparentPixelsScalar(pixels + numWide, numPixels - numWide,
+						 alphaMask, alphaShift);
+}
+
+//NOTE(denis): importing a sheet is done on other threads a row of tiles at a
+// time. a row works out which of its tiles are valid, its part of every mip
+// level, which ends with the average colour of each tile, and a hash of each
+// valid tile's pixels. everything goes into arrays laid out like the sheet, so
+// the tiles are put in the tile set in the same order however the rows were
+// shared out between the threads. once every row is done the hashes are used
+// to find the tiles that are duplicates of one before them
+#define MAX_IMPORT_THREADS 16
+
+struct TileSetImport
+{
+    uint32 tileSetId;
+
+    SDL_Surface *image;
+    //NOTE(denis): the sheet as ARGB8888, the mips and hashes are made from it.
+    // if it couldn't be made the tiles are only checked for being valid
+    SDL_Surface *converted;
+
+    uint32 tileSize;
+    uint32 numXTiles;
+    uint32 numYTiles;
+    CountTransparentPixels *countTransparentPixels;
+
+    bool *validTiles;
+    uint64 *tileHashes;
+    uint32 *canonicalTiles;
+
+    //NOTE(denis): levels[0] is the converted sheet, every level after it is a mip
+    uint32 *levels[MAX_TILE_SET_MIPS];
+    uint32 levelWidths[MAX_TILE_SET_MIPS];
+    uint32 levelTileSizes[MAX_TILE_SET_MIPS];
+    uint32 numLevels;
+
+    SDL_atomic_t nextRow;
+    SDL_atomic_t rowsDone;
+    SDL_atomic_t finished;
+
+    SDL_Thread *threads[MAX_IMPORT_THREADS];
+};
+
+static TileSetImport *_activeImport;
+
+//NOTE(denis): the row is gone over a row of pixels at a time, keeping a count
+// for every tile in it. a tile stops being counted as soon as it is over the
+// limit or the pixels it has left can't take it over, and the rest of the row
+// is skipped once all of its tiles are decided. images that aren't 4 bytes a
+// pixel aren't checked, all their tiles are valid
+static void findValidTilesInRow(TileSetImport *import, uint32 tileY,
+				uint32 *transparentCounts, bool *decided)
+{
+    SDL_Surface *image = import->image;
+    uint32 tileSize = import->tileSize;
+    uint32 numXTiles = import->numXTiles;
+
+    if (image->format->BytesPerPixel != 4)
+	return;
+
+    uint32 alphaMask = image->format->Amask;
+    uint32 alphaShift = image->format->Ashift;
+    uint32 maxTransparent = (uint32)(tileSize*tileSize*TRANSPARENT_RATIO_THRESHOLD);
+
+    bool *validRow = import->validTiles + tileY*numXTiles;
+    uint32 numUndecided = numXTiles;
+
+    for (uint32 i = 0; i < numXTiles; ++i)
+    {
+	transparentCounts[i] = 0;
+	decided[i] = false;
+    }
+
+    for (uint32 y = 0; y < tileSize && numUndecided > 0; ++y)
+    {
+	uint32 *row = (uint32*)((uint8*)image->pixels + (tileY*tileSize + y)*image->pitch);
+	uint32 pixelsLeft = (tileSize - y - 1)*tileSize;
+
+	for (uint32 tileX = 0; tileX < numXTiles; ++tileX)
+	{
+	    if (decided[tileX])
+		continue;
+
+	    uint32 count = transparentCounts[tileX] +
+		import->countTransparentPixels(row + tileX*tileSize, tileSize,
+					       alphaMask, alphaShift);
+	    transparentCounts[tileX] = count;
+
+	    if (count > maxTransparent)
+	    {
+		validRow[tileX] = false;
+		decided[tileX] = true;
+		--numUndecided;
+	    }
+	    else if (count + pixelsLeft <= maxTransparent)
+	    {
+		decided[tileX] = true;
+		--numUndecided;
+	    }
+	}
+    }
+}
+
+//NOTE(denis): every tile is shrunk on its own so no colour bleeds in from the
+// tiles around it, and colours are weighted by alpha so the see through pixels
+// at the edges of a tile don't darken it. each level is made from the one
+// before it, the rows of tiles in a level only need the same row in the last one
+static void makeMipsForRow(TileSetImport *import, uint32 tileY)
+{
+    for (uint32 level = 1; level < import->numLevels; ++level)
+    {
+	uint32 *source = import->levels[level-1];
+	uint32 sourceWidth = import->levelWidths[level-1];
+	uint32 sourceTileSize = import->levelTileSizes[level-1];
+
+	uint32 *destination = import->levels[level];
+	uint32 levelWidth = import->levelWidths[level];
+	uint32 levelTileSize = import->levelTileSizes[level];
+
+	uint32 firstRow = tileY*levelTileSize;
+	for (uint32 y = firstRow; y < firstRow + levelTileSize; ++y)
+	{
+	    uint32 sourceTileY = y/levelTileSize*sourceTileSize;
+	    uint32 firstY = sourceTileY + y%levelTileSize*sourceTileSize/levelTileSize;
+	    uint32 lastY = sourceTileY + (y%levelTileSize + 1)*sourceTileSize/levelTileSize;
+	    
+	    for (uint32 x = 0; x < levelWidth; ++x)
+	    {
+		uint32 sourceTileX = x/levelTileSize*sourceTileSize;
+		uint32 firstX = sourceTileX + x%levelTileSize*sourceTileSize/levelTileSize;
+		uint32 lastX = sourceTileX + (x%levelTileSize + 1)*sourceTileSize/levelTileSize;
+
+		uint32 alpha = 0;
+		uint32 red = 0;
+		uint32 green = 0;
+		uint32 blue = 0;
+		uint32 numPixels = 0;
 		
-		++pixel;
+		for (uint32 i = firstY; i < lastY; ++i)
+		{
+		    for (uint32 j = firstX; j < lastX; ++j)
+		    {
+			uint32 pixel = source[i*sourceWidth + j];
+			uint32 pixelAlpha = pixel >> 24;
+
+			alpha += pixelAlpha;
+			red += ((pixel >> 16) & 0xFF)*pixelAlpha;
+			green += ((pixel >> 8) & 0xFF)*pixelAlpha;
+			blue += (pixel & 0xFF)*pixelAlpha;
+			++numPixels;
+		    }
+		}
+
+		uint32 colour = 0;
+		if (alpha != 0)
+		{
+		    colour = ((alpha/numPixels) << 24) | ((red/alpha) << 16) |
+			((green/alpha) << 8) | (blue/alpha);
+		}
+		destination[y*levelWidth + x] = colour;
 	    }
-	    row = (uint32*)((uint8*)row + image->pitch);
 	}
+    }
+}
 
-	if ((transparentPixelCount/pixelCount) > TRANSPARENT_RATIO_THRESHOLD)
-	    result = false;
+//NOTE(denis): FNV-1a, a pixel at a time instead of a byte at a time
+static void hashTilesInRow(TileSetImport *import, uint32 tileY)
+{
+    uint32 *pixels = import->levels[0];
+    uint32 width = import->levelWidths[0];
+    uint32 tileSize = import->tileSize;
+
+    for (uint32 tileX = 0; tileX < import->numXTiles; ++tileX)
+    {
+	uint32 index = tileY*import->numXTiles + tileX;
+	if (!import->validTiles[index])
+	    continue;
+
+	uint64 hash = 14695981039346656037ull;
+	for (uint32 i = 0; i < tileSize; ++i)
+	{
+	    uint32 *row = pixels + (tileY*tileSize + i)*width + tileX*tileSize;
+	    for (uint32 j = 0; j < tileSize; ++j)
+	    {
+		hash ^= row[j];
+		hash *= 1099511628211ull;
+	    }
+	}
+
+	import->tileHashes[index] = hash;
     }
-    
-    if (SDL_MUSTLOCK(image) == SDL_TRUE)
-	SDL_UnlockSurface(image);
-    
+}
+
+static bool tilePixelsMatch(TileSetImport *import, uint32 firstCell, uint32 secondCell)
+{
+    uint32 *pixels = import->levels[0];
+    uint32 width = import->levelWidths[0];
+    uint32 tileSize = import->tileSize;
+
+    uint32 *first = pixels + firstCell/import->numXTiles*tileSize*width +
+	firstCell%import->numXTiles*tileSize;
+    uint32 *second = pixels + secondCell/import->numXTiles*tileSize*width +
+	secondCell%import->numXTiles*tileSize;
+
+    bool result = true;
+    for (uint32 i = 0; i < tileSize && result; ++i)
+    {
+	for (uint32 j = 0; j < tileSize; ++j)
+	{
+	    if (first[i*width + j] != second[i*width + j])
+	    {
+		result = false;
+		break;
+	    }
+	}
+    }
+
     return result;
 }
 
+//NOTE(denis): the tiles are gone through in sheet order so the first of every
+// set of duplicates is the one that is kept. the hash table is cell + 1 by
+// hash, 0 is empty. tiles with the same hash have their pixels compared, so a
+// collision never makes two different tiles one
+static void findDuplicateTiles(TileSetImport *import)
+{
+    uint32 numCells = import->numXTiles*import->numYTiles;
+    if (!import->tileHashes || numCells == 0)
+	return;
+
+    uint32 tableSize = 1;
+    while (tableSize < numCells*2)
+	tableSize *= 2;
+    uint32 mask = tableSize-1;
+
+    uint32 *table = (uint32*)HEAP_ALLOC(tableSize*sizeof(uint32));
+    uint32 *canonicalTiles = (uint32*)HEAP_ALLOC(numCells*sizeof(uint32));
+    if (!table || !canonicalTiles)
+    {
+	if (table)
+	{
+	    HEAP_FREE(table);
+	}
+	if (canonicalTiles)
+	{
+	    HEAP_FREE(canonicalTiles);
+	}
+	return;
+    }
+
+    uint32 numDuplicates = 0;
+    for (uint32 cell = 0; cell < numCells; ++cell)
+    {
+	canonicalTiles[cell] = cell;
+	if (!import->validTiles[cell])
+	    continue;
+
+	uint64 hash = import->tileHashes[cell];
+	uint32 slot = (uint32)(hash ^ (hash >> 32)) & mask;
+
+	while (table[slot] != 0)
+	{
+	    uint32 other = table[slot]-1;
+	    if (import->tileHashes[other] == hash && tilePixelsMatch(import, other, cell))
+	    {
+		canonicalTiles[cell] = other;
+		++numDuplicates;
+		break;
+	    }
+
+	    slot = (slot+1) & mask;
+	}
+
+	if (table[slot] == 0)
+	    table[slot] = cell+1;
+    }
+
+    HEAP_FREE(table);
+
+    if (numDuplicates > 0)
+    {
+	import->canonicalTiles = canonicalTiles;
+    }
+    else
+    {
+	HEAP_FREE(canonicalTiles);
+    }
+}
+
+static int importThreadProc(void *data)
+{
+    TileSetImport *import = (TileSetImport*)data;
+
+    //NOTE(denis): if these can't be made the tiles are all left valid
+    uint32 *transparentCounts = (uint32*)HEAP_ALLOC(import->numXTiles*sizeof(uint32));
+    bool *decided = (bool*)HEAP_ALLOC(import->numXTiles*sizeof(bool));
+
+    int32 row = SDL_AtomicAdd(&import->nextRow, 1);
+    while ((uint32)row < import->numYTiles)
+    {
+	if (transparentCounts && decided)
+	    findValidTilesInRow(import, row, transparentCounts, decided);
+
+	if (import->converted)
+	{
+	    makeMipsForRow(import, row);
+	    if (import->tileHashes)
+		hashTilesInRow(import, row);
+	}
+
+	//NOTE(denis): whichever thread does the last row looks for the duplicates,
+	// that needs the hashes of every row
+	if (SDL_AtomicAdd(&import->rowsDone, 1) + 1 == (int32)import->numYTiles)
+	{
+	    if (import->converted)
+		findDuplicateTiles(import);
+	    SDL_AtomicSet(&import->finished, 1);
+	}
+
+	row = SDL_AtomicAdd(&import->nextRow, 1);
+    }
+
+    if (transparentCounts)
+    {
+	HEAP_FREE(transparentCounts);
+    }
+    if (decided)
+    {
+	HEAP_FREE(decided);
+    }
+
+    return 0;
+}
+
+//NOTE(denis): textures can only be made on the main thread, so the mip levels
+// are only turned into them here, along with putting the tiles in the tile set
+static void finishTileSetImport()
+{
+    TileSetImport *import = _activeImport;
+    _activeImport = 0;
+
+    for (int32 i = 0; i < MAX_IMPORT_THREADS; ++i)
+    {
+	if (import->threads[i])
+	    SDL_WaitThread(import->threads[i], 0);
+    }
+
+    TileSet *tileSet = _tileSets + import->tileSetId;
+    uint32 numXTiles = import->numXTiles;
+    uint32 numYTiles = import->numYTiles;
+
+    if (SDL_MUSTLOCK(import->image) == SDL_TRUE)
+	SDL_UnlockSurface(import->image);
+
+    for (uint32 level = 1; level < import->numLevels; ++level)
+    {
+	uint32 levelWidth = import->levelWidths[level];
+	uint32 levelHeight = numYTiles*import->levelTileSizes[level];
+
+	SDL_Texture *texture = SDL_CreateTexture(_renderer, SDL_PIXELFORMAT_ARGB8888,
+						 SDL_TEXTUREACCESS_STATIC,
+						 levelWidth, levelHeight);
+	if (!texture)
+	    break;
+	
+	SDL_UpdateTexture(texture, NULL, import->levels[level], levelWidth*sizeof(uint32));
+	SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+	tileSet->mips[tileSet->numMips++] = texture;
+    }
+
+    //NOTE(denis): the last level is one pixel a tile, it is kept around as the
+    // tile set's tile colours
+    uint32 lastLevel = tileSet->numMips-1;
+    if (lastLevel > 0 && import->levelTileSizes[lastLevel] == 1)
+    {
+	tileSet->tileColours = import->levels[lastLevel];
+	tileSet->widthInTiles = numXTiles;
+	import->levels[lastLevel] = 0;
+    }
+
+    for (uint32 level = 1; level < import->numLevels; ++level)
+    {
+	if (import->levels[level])
+	{
+	    HEAP_FREE(import->levels[level]);
+	}
+    }
+
+    if (import->converted)
+    {
+	if (SDL_MUSTLOCK(import->converted) == SDL_TRUE)
+	    SDL_UnlockSurface(import->converted);
+	SDL_FreeSurface(import->converted);
+    }
+
+    //NOTE(denis): keep track of every valid tile in the tile set, leaving out
+    // the duplicates
+    tileSet->tiles = (Tile*)HEAP_ALLOC(sizeof(Tile)*numXTiles*numYTiles);
+    tileSet->numTiles = 0;
+    tileSet->canonicalTiles = import->canonicalTiles;
+
+    for (uint32 i = 0; i < numYTiles && tileSet->tiles; ++i)
+    {
+	for (uint32 j = 0; j < numXTiles; ++j)
+	{
+	    uint32 cell = i*numXTiles + j;
+	    bool duplicate = import->canonicalTiles && import->canonicalTiles[cell] != cell;
+	    
+	    if (import->validTiles[cell] && !duplicate)
+	    {
+		Tile *nextTile = (tileSet->tiles + tileSet->numTiles);
+		nextTile->sheetPos.x = j*import->tileSize;
+		nextTile->sheetPos.y = i*import->tileSize;
+		nextTile->size = import->tileSize;
+		++tileSet->numTiles;
+	    }
+	}
+    }
+
+    //NOTE(denis): nothing is selected until now, before the tiles are known
+    // there's nothing sensible to paint with
+    if (tileSet->numTiles > 0)
+    {
+	tileSet->selectedTile.sheetPos = tileSet->tiles[0].sheetPos;
+	tileSet->selectedTile.size = import->tileSize;
+    }
+
+    //NOTE(denis): the hashes were only for finding the duplicates
+    if (import->tileHashes)
+    {
+	HEAP_FREE(import->tileHashes);
+    }
+    HEAP_FREE(import->validTiles);
+    HEAP_FREE(import);
+
+    ui_requestRedraw();
+}
+
+static void startTileSetImport(uint32 tileSetId)
+{
+    TileSet *tileSet = _tileSets + tileSetId;
+    uint32 numXTiles = tileSet->imageSize.w/tileSet->tileSize;
+    uint32 numYTiles = tileSet->imageSize.h/tileSet->tileSize;
+
+    TileSetImport *import = (TileSetImport*)HEAP_ALLOC(sizeof(TileSetImport));
+    if (!import)
+	return;
+
+    import->validTiles = (bool*)HEAP_ALLOC(numXTiles*numYTiles*sizeof(bool));
+    if (!import->validTiles)
+    {
+	HEAP_FREE(import);
+	return;
+    }
+
+    for (uint32 i = 0; i < numXTiles*numYTiles; ++i)
+    {
+	import->validTiles[i] = true;
+    }
+
+    import->tileSetId = tileSetId;
+    import->image = tileSet->surface;
+    import->tileSize = tileSet->tileSize;
+    import->numXTiles = numXTiles;
+    import->numYTiles = numYTiles;
+
+    import->countTransparentPixels = countTransparentPixelsScalar;
+    if (SDL_HasAVX2())
+	import->countTransparentPixels = countTransparentPixelsAVX2;
+    else if (SDL_HasSSE2())
+	import->countTransparentPixels = countTransparentPixelsSSE2;
+
+    import->converted = SDL_ConvertSurfaceFormat(tileSet->surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    if (import->converted)
+    {
+	if (SDL_MUSTLOCK(import->converted) == SDL_TRUE)
+	    SDL_LockSurface(import->converted);
+
+	import->tileHashes = (uint64*)HEAP_ALLOC(numXTiles*numYTiles*sizeof(uint64));
+
+	import->levels[0] = (uint32*)import->converted->pixels;
+	import->levelWidths[0] = import->converted->pitch/sizeof(uint32);
+	import->levelTileSizes[0] = tileSet->tileSize;
+	import->numLevels = 1;
+
+	while (import->levelTileSizes[import->numLevels-1] > 1 &&
+	       import->numLevels < MAX_TILE_SET_MIPS)
+	{
+	    uint32 levelTileSize = import->levelTileSizes[import->numLevels-1]/2;
+	    uint32 levelWidth = numXTiles*levelTileSize;
+	    uint32 levelHeight = numYTiles*levelTileSize;
+
+	    uint32 *level = (uint32*)HEAP_ALLOC(levelWidth*levelHeight*sizeof(uint32));
+	    if (!level)
+		break;
+
+	    import->levels[import->numLevels] = level;
+	    import->levelWidths[import->numLevels] = levelWidth;
+	    import->levelTileSizes[import->numLevels] = levelTileSize;
+	    ++import->numLevels;
+	}
+    }
+
+    if (SDL_MUSTLOCK(import->image) == SDL_TRUE)
+	SDL_LockSurface(import->image);
+
+    _activeImport = import;
+
+    //NOTE(denis): this thread doesn't take any rows so it can keep handling
+    // input, unless no threads could be made at all
+    int32 numThreads = MIN(MIN(SDL_GetCPUCount(), MAX_IMPORT_THREADS), (int32)numYTiles);
+    bool anyThreads = false;
+    for (int32 i = 0; i < numThreads; ++i)
+    {
+	import->threads[i] = SDL_CreateThread(importThreadProc, "TileSetImport", import);
+	if (import->threads[i])
+	    anyThreads = true;
+    }
+
+    if (!anyThreads)
+    {
+	importThreadProc(import);
+	finishTileSetImport();
+    }
+}
+
 void tileSetPanelCreateNew(SDL_Renderer *renderer,
 			   uint32 x, uint32 y, uint32 width, uint32 height)
 {
@@ -108,13 +821,16 @@ void tileSetPanelCreateNew(SDL_Renderer *renderer,
 
 void tileSetPanelDraw()
 {
+    PROFILE_SCOPE(PROFILE_TILE_SET_DRAW);
+    
     if (_panel.visible)
     {
 	ui_draw(&_panel);
-		    
-	if (_tileSets[0].image != 0)
+
+	TileSet *tileSet = getSelectedTileSet();
+	if (tileSet->image != 0)
 	{
-	    int tileSize = _tileSets[0].tileSize;
+	    int tileSize = tileSet->tileSize;
 	    int tilesPerRow = (_panel.getWidth() - PADDING*2)/tileSize;
 			
 	    int tilesPadding = (_panel.getWidth() - tilesPerRow*tileSize)/2;
@@ -124,14 +840,14 @@ void tileSetPanelDraw()
 	    
 	    uint32 lastY = 0;
 	    
-	    for (uint32 i = 0; i < _tileSets[0].numTiles; ++i)
+	    for (uint32 i = 0; i < tileSet->numTiles; ++i)
 	    {		
 		//TODO(denis): this doesn't need to be done every frame
 		// only when everything is resized
 		uint32 xValue = tileSetStartX + (i%tilesPerRow)*tileSize;
 		uint32 yValue = tileSetStartY + (i/tilesPerRow)*tileSize;
 		
-		Tile *currentTile = _tileSets[0].tiles + i;
+		Tile *currentTile = tileSet->tiles + i;
 		
 		currentTile->pos.x = xValue;
 		currentTile->pos.y = yValue;
@@ -149,13 +865,13 @@ void tileSetPanelDraw()
 		    _tempSelectedTile.y = currentTile->sheetPos.y;
 		}
 
-		drawTile(_renderer, _tileSets[0].image, currentTile->sheetPos,
+		drawTile(_renderer, tileSet->image, currentTile->sheetPos,
 			 currentTile->pos, currentTile->size);
 	    }
 	    
 	    ui_draw(&_selectedTileText);
-	    drawTile(_renderer, _tileSets[0].image, _tileSets[0].selectedTile.sheetPos,
-		     _tileSets[0].selectedTile.pos, _tileSets[0].selectedTile.size);
+	    drawTile(_renderer, tileSet->image, tileSet->selectedTile.sheetPos,
+		     tileSet->selectedTile.pos, tileSet->selectedTile.size);
 	}
 
 	//TODO(denis): bad fix for the drawing order problem
@@ -168,6 +884,12 @@ void tileSetPanelDraw()
 
 void tileSetPanelOnMouseMove(Vector2 mousePos)
 {
+    PROFILE_SCOPE(PROFILE_TILE_SET_INPUT);
+    
+    int oldHighlighted = _tileSetDropDown.highlightedItem;
+    SDL_Rect oldSelection = _selectionBox.pos;
+    bool oldSelectionVisible = _selectionVisible;
+    
     if (_tileSetDropDown.isOpen && pointInRect(mousePos, _tileSetDropDown.getRect()))
     {
 	int highlighted = _tileSetDropDown.getItemAt(mousePos);
@@ -175,13 +897,14 @@ void tileSetPanelOnMouseMove(Vector2 mousePos)
     }
     else if (!_tileSetDropDown.isOpen)
     {
-	if (_tileSets[0].tiles)
+	TileSet *tileSet = getSelectedTileSet();
+	if (tileSet->tiles)
 	{
 	    _selectionVisible = false;
 
-	    for (uint32 i = 0; i < _tileSets[0].numTiles; ++i)
+	    for (uint32 i = 0; i < tileSet->numTiles; ++i)
 	    {
-		Tile *currentTile = &_tileSets[0].tiles[i];
+		Tile *currentTile = &tileSet->tiles[i];
 
 		SDL_Rect tileRect = {currentTile->pos.x, currentTile->pos.y,
 				     currentTile->size, currentTile->size};
@@ -194,17 +917,27 @@ void tileSetPanelOnMouseMove(Vector2 mousePos)
 	    }
 	}
     }
+
+    if (oldHighlighted != _tileSetDropDown.highlightedItem ||
+	!rectsEqual(oldSelection, _selectionBox.pos) ||
+	oldSelectionVisible != _selectionVisible)
+    {
+	ui_requestRedraw();
+    }
 }
 
 void tileSetPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton)
 {
+    PROFILE_SCOPE(PROFILE_TILE_SET_INPUT);
+    
     if (mouseButton == SDL_BUTTON_LEFT)
     {
 	_tileSetDropDown.startedClick = pointInRect(mousePos, _tileSetDropDown.getRect());
 
-	for (uint32 i = 0; i < _tileSets[0].numTiles; ++i)
+	TileSet *tileSet = getSelectedTileSet();
+	for (uint32 i = 0; i < tileSet->numTiles; ++i)
 	{
-	    Tile *currentTile = &_tileSets[0].tiles[i];
+	    Tile *currentTile = &tileSet->tiles[i];
 	    SDL_Rect tileRect = {currentTile->pos.x, currentTile->pos.y,
 				 currentTile->size, currentTile->size};
 	    
@@ -216,6 +949,8 @@ void tileSetPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton)
 
 void tileSetPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
 {
+    PROFILE_SCOPE(PROFILE_TILE_SET_INPUT);
+    
     if (_tileSetDropDown.isOpen)
     {
 	if (pointInRect(mousePos, _tileSetDropDown.getRect()))
@@ -227,9 +962,10 @@ void tileSetPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
 		{
 		    _importTileSetPressed = true;
 		}
-		else
+		else if (selection < (int)_numTileSets)
 		{
-		    SWAP_DATA(_tileSets[selection], _tileSets[0], TileSet);
+		    SWAP_DATA(_dropDownTileSets[selection], _dropDownTileSets[0], uint32);
+		    _selectedTileSet = _dropDownTileSets[0];
 
 		    _tileSetDropDown.items[selection].setPosition(_tileSetDropDown.items[0].getPosition());
 		    SWAP_DATA(_tileSetDropDown.items[selection],
@@ -249,16 +985,25 @@ void tileSetPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton)
     }
     else if (_selectionVisible && _startedClick && mouseButton == SDL_BUTTON_LEFT)
     {
-	_tileSets[0].selectedTile.sheetPos.x = _tempSelectedTile.x;
-	_tileSets[0].selectedTile.sheetPos.y = _tempSelectedTile.y;
-	_tileSets[0].selectedTile.size = _tempSelectedTile.w;
+	//NOTE(denis): a duplicate on the sheet paints with the tile that was kept
+	// for it, so maps never pick up positions that have to be remapped
+	TileSet *tileSet = getSelectedTileSet();
+	Point2 sheetPos = {_tempSelectedTile.x, _tempSelectedTile.y};
+	tileSet->selectedTile.sheetPos = getCanonicalSheetPos(tileSet, sheetPos);
+	tileSet->selectedTile.size = _tempSelectedTile.w;
     }
 }
 
-void tileSetPanelInitializeNewTileSet(char *name, SDL_Surface *image, uint32 tileSize)
+bool tileSetPanelInitializeNewTileSet(char *name, SDL_Surface *image, uint32 tileSize)
 {
-    TileSet *currentTileSet = &_tileSets[_numTileSets];
-    ++_numTileSets;
+    //NOTE(denis): only one import at a time
+    tileSetPanelFinishImport();
+
+    uint32 id = addTileSet();
+    if (id == NO_TILE_SET)
+	return false;
+    
+    TileSet *currentTileSet = _tileSets + id;
     //TODO(denis): currentTileSet.name has to be freed if ever
     // the tileset is deleted
     currentTileSet->name = name;
@@ -266,31 +1011,8 @@ void tileSetPanelInitializeNewTileSet(char *name, SDL_Surface *image, uint32 til
     currentTileSet->image = SDL_CreateTextureFromSurface(_renderer, image);
     currentTileSet->tileSize = tileSize;
     SDL_GetClipRect(image, &currentTileSet->imageSize);
-    
-    uint32 numXTiles = currentTileSet->imageSize.w/tileSize;
-    uint32 numYTiles = currentTileSet->imageSize.h/tileSize;
-    currentTileSet->tiles = (Tile*)HEAP_ALLOC(sizeof(Tile)*numXTiles*numYTiles);
-    currentTileSet->numTiles = 0;
-
-    //NOTE(denis): keep track of every valid tile in the tile set
-    for (uint32 i = 0; i < numYTiles; ++i)
-    {
-	for (uint32 j = 0; j < numXTiles; ++j)
-	{
-	    SDL_Rect currentTile = {j*tileSize, i*tileSize, tileSize, tileSize};
-	    if (tileIsValid(image, currentTile))
-	    {
-		Tile *nextTile = (currentTileSet->tiles + currentTileSet->numTiles);
-		nextTile->sheetPos.x = j*tileSize;
-		nextTile->sheetPos.y = i*tileSize;
-		nextTile->size = tileSize;
-		++currentTileSet->numTiles;
-	    }
-	}
-    }
-
-    currentTileSet->selectedTile.size = tileSize;
-    currentTileSet->selectedTile.sheetPos = currentTileSet->tiles[0].sheetPos;
+    currentTileSet->mips[0] = currentTileSet->image;
+    currentTileSet->numMips = 1;
     
     _selectedTileText.pos.y = _panel.panel.pos.y + _panel.getHeight() -
 	_selectedTileText.pos.h - PADDING - tileSize/2;
@@ -299,8 +1021,12 @@ void tileSetPanelInitializeNewTileSet(char *name, SDL_Surface *image, uint32 til
     currentTileSet->selectedTile.pos.y = _selectedTileText.pos.y;
     currentTileSet->selectedTile.pos.y = _selectedTileText.pos.y - tileSize/2 + _selectedTileText.pos.h/2;
     
+    addToNameIndex(id);
+    _selectedTileSet = id;
+    
     if (_numTileSets == 1)
     {
+	_dropDownTileSets[0] = id;
 	_tileSetDropDown.changeItem(name, 0);
 	_tileSetDropDown.setPosition({_tileSetDropDown.getRect().x, _tileSetDropDown.getRect().y});
     }
@@ -309,7 +1035,8 @@ void tileSetPanelInitializeNewTileSet(char *name, SDL_Surface *image, uint32 til
 	int newPos = _tileSetDropDown.itemCount-1;
 	_tileSetDropDown.addItem(name, newPos);
 
-	SWAP_DATA(_tileSets[newPos], _tileSets[0], TileSet);
+	_dropDownTileSets[newPos] = _dropDownTileSets[0];
+	_dropDownTileSets[0] = id;
 
 	_tileSetDropDown.items[newPos].setPosition(_tileSetDropDown.items[0].getPosition());
 	SWAP_DATA(_tileSetDropDown.items[newPos],
@@ -317,29 +1044,48 @@ void tileSetPanelInitializeNewTileSet(char *name, SDL_Surface *image, uint32 til
     }
 
     initializeSelectionBox(_renderer, &_selectionBox, tileSize);
+
+    startTileSetImport(id);
+
+    return true;
+}
+
+void tileSetPanelUpdateImport()
+{
+    if (_activeImport && SDL_AtomicGet(&_activeImport->finished))
+    {
+	finishTileSetImport();
+    }
+}
+
+void tileSetPanelFinishImport()
+{
+    if (_activeImport)
+	finishTileSetImport();
+}
+
+bool tileSetPanelImportInProgress()
+{
+    return _activeImport != 0;
 }
 
 Tile tileSetPanelGetSelectedTile()
 {
-    return _tileSets[0].selectedTile;
+    return getSelectedTileSet()->selectedTile;
 }
 
 TileSet* tileSetPanelGetCurrentTileSet()
 {
-    return &_tileSets[0];
+    return getSelectedTileSet();
 }
 
 TileSet* tileSetPanelGetTileSetByName(char* name)
 {
     TileSet *result = 0;
-    
-    for (uint32 i = 0; i < _numTileSets && !result; ++i)
-    {
-	if (stringsEqual(name, _tileSets[i].name))
-	{
-	    result = &_tileSets[i];
-	}
-    }
+
+    uint32 id = findTileSetByName(name);
+    if (id != NO_TILE_SET)
+	result = _tileSets + id;
 
     return result;
 }
@@ -359,17 +1105,12 @@ bool tileSetPanelImportTileSetPressed()
 
 int tileSetPanelGetCurrentTileSize()
 {
-    int result = 0;
-    
-    if (_numTileSets > 0)
-	result = _tileSets[0].tileSize;
-
-    return result;
+    return getSelectedTileSet()->tileSize;
 }
 
 char* tileSetPanelGetCurrentTileSetFileName()
 {
-    return _tileSets[0].name;
+    return getSelectedTileSet()->name;
 }
 
 bool tileSetPanelVisible()
@@ -12,11 +12,23 @@ void tileSetPanelOnMouseMove(Vector2 mousePos);
 void tileSetPanelOnMouseDown(Vector2 mousePos, uint8 mouseButton);
 void tileSetPanelOnMouseUp(Vector2 mousePos, uint8 mouseButton);
 
-void tileSetPanelInitializeNewTileSet(char *name, SDL_Surface *image, uint32 tileSize);
+//NOTE(denis): the new tile set's tiles are found on other threads, until they
+// are put in it has none. tiles that are duplicates of one before them on the
+// sheet are left out. returns false if there was no room for another tile set,
+// the name and image are then still the caller's
+bool tileSetPanelInitializeNewTileSet(char *name, SDL_Surface *image, uint32 tileSize);
+//NOTE(denis): call once a frame, puts the tiles in once every row of the sheet is done
+void tileSetPanelUpdateImport();
+//NOTE(denis): waits for the tile set being imported and puts its tiles in
+void tileSetPanelFinishImport();
+bool tileSetPanelImportInProgress();
 
 Tile tileSetPanelGetSelectedTile();
 
+//NOTE(denis): never 0, with no tile sets it is an empty one with no tiles. the
+// pointers from these are only good until the next tile set is added
 TileSet* tileSetPanelGetCurrentTileSet();
+//NOTE(denis): returns 0 if there is no tile set with that name
 TileSet* tileSetPanelGetTileSetByName(char* name);
 
 bool tileSetPanelImportTileSetPressed();
@@ -1,6 +1,7 @@
 #include "ui_elements.h"
 #include "main.h"
 #include "SDL_render.h"
+#include "SDL_timer.h"
 #include "TEMP_GeneralFunctions.cpp"
 
 #include "denis_adt.h"
@@ -250,10 +251,16 @@ bool MenuBar::onMouseMove(Vector2 mousePos)
 	    result = true;
 	    SDL_Rect tempRect = this->menus[i].getRect();
 	    int selectedY = (mousePos.y - tempRect.y)/this->menus[i].items[0].pos.h;
+	    if (this->menus[i].highlightedItem != selectedY)
+		ui_requestRedraw();
 	    this->menus[i].highlightedItem = selectedY;
 	}
 	else
+	{
+	    if (this->menus[i].highlightedItem != -1)
+		ui_requestRedraw();
 	    this->menus[i].highlightedItem = -1;
+	}
     }
     
     return result;
@@ -325,6 +332,58 @@ static int _selectedFont;
 
 static TextCursor _cursor;
 
+static bool _redrawRequested = true;
+static bool _timedRedrawRequested;
+static uint32 _timedRedrawTicks;
+
+void ui_requestRedraw()
+{
+    _redrawRequested = true;
+}
+
+void ui_requestRedrawAt(uint32 ticks)
+{
+    if (!_timedRedrawRequested || SDL_TICKS_PASSED(_timedRedrawTicks, ticks))
+    {
+	_timedRedrawRequested = true;
+	_timedRedrawTicks = ticks;
+    }
+}
+
+bool ui_redrawNeeded()
+{
+    return _redrawRequested ||
+	(_timedRedrawRequested && SDL_TICKS_PASSED(SDL_GetTicks(), _timedRedrawTicks));
+}
+
+uint32 ui_getTimeUntilRedraw(uint32 maxWait)
+{
+    uint32 result = maxWait;
+
+    if (_redrawRequested)
+    {
+	result = 0;
+    }
+    else if (_timedRedrawRequested)
+    {
+	uint32 now = SDL_GetTicks();
+	if (SDL_TICKS_PASSED(now, _timedRedrawTicks))
+	    result = 0;
+	else
+	    result = MIN(maxWait, _timedRedrawTicks - now);
+    }
+
+    return result;
+}
+
+void ui_redrawStarted()
+{
+    _redrawRequested = false;
+    
+    if (_timedRedrawRequested && SDL_TICKS_PASSED(SDL_GetTicks(), _timedRedrawTicks))
+	_timedRedrawRequested = false;
+}
+
 static void ui_delete(LinkedList *ll)
 {
     Node *current = ll->front;
@@ -415,7 +474,7 @@ bool ui_init(SDL_Renderer *renderer, char *fontName, int fontSize)
 	    
         _cursor.pos.w = 5;
         _cursor.pos.h = 15;
-        _cursor.flashRate = 22;
+	_cursor.flashRate = 370;
         _cursor.visible = true;
 	
 	result = true;
@@ -520,7 +579,7 @@ bool ui_processMouseUp(UIPanel *panel, Vector2 mousePos, Uint8 button)
 		    if (data->selected)
 		    {
 			resetCursorPosition(data);
-			_cursor.flashCounter = 0;
+			_cursor.flashStart = SDL_GetTicks();
 			processed = true;
 		    }
 		}
@@ -1016,19 +1075,18 @@ void ui_draw(UIPanel *panel)
 
 	if (editTextSelected)
 	{
-	    if (_cursor.flashCounter >= _cursor.flashRate)
+	    uint32 timeFlashing = SDL_GetTicks() - _cursor.flashStart;
+	    uint32 numFlashes = timeFlashing/_cursor.flashRate;
+	    
+	    _cursor.visible = numFlashes % 2 == 0;
+	    if (!_cursor.visible)
 	    {
 		//TODO(denis): don't hardcode this, probably
 		SDL_SetRenderDrawColor(_renderer, 140,140,140,255);
 		SDL_RenderFillRect(_renderer, &_cursor.pos);
-		_cursor.visible = false;
-	    }
-	    if (!_cursor.visible && _cursor.flashCounter >= _cursor.flashRate*2)
-	    {
-		_cursor.visible = true;
-		_cursor.flashCounter = 0;
 	    }
-	    ++_cursor.flashCounter;
+
+	    ui_requestRedrawAt(_cursor.flashStart + (numFlashes+1)*_cursor.flashRate);
 	}
     }
 }
@@ -20,11 +20,12 @@ struct Button
     void destroy();
 };
 
+//NOTE(denis): flashRate is how many milliseconds the cursor stays on (and off)
 struct TextCursor
 {
     SDL_Rect pos;
-    int flashCounter;
-    int flashRate;
+    uint32 flashStart;
+    uint32 flashRate;
     bool visible;
 };
 
@@ -166,6 +167,18 @@ struct UIPanel
 bool ui_init(SDL_Renderer *renderer, char *fontName, int fontSize);
 void ui_destroy();
 
+//NOTE(denis): the main loop only draws a frame when something asked for one,
+// anything that changes what is on screen outside of a click or key press
+// has to call ui_requestRedraw
+void ui_requestRedraw();
+//NOTE(denis): for things that change on their own later, like the cursor flashing
+void ui_requestRedrawAt(uint32 ticks);
+bool ui_redrawNeeded();
+//NOTE(denis): milliseconds until the next timed redraw, or maxWait if there isn't one
+uint32 ui_getTimeUntilRedraw(uint32 maxWait);
+//NOTE(denis): call right before drawing a frame
+void ui_redrawStarted();
+
 //NOTE(denis): returns false if the font was not found
 bool ui_setFont(char *fontName, int fontSize);
 